@@ -0,0 +1,15 @@
+#include "toy.h"
+
+// Entrypoint of the executables built with `make aot`. The script is
+// compiled ahead of time by `translate_to_c.node.js`, so there is no
+// bundled compiler.
+
+compiled_file_t *get_builtin_file(void) {
+    die("no compiler in ahead-of-time compiled executables");
+}
+
+int main(void) {
+    current_isolate = toy_isolate_new();
+    eval_compiled_file(get_aot_file());
+    return 0;
+}
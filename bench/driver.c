@@ -0,0 +1,324 @@
+// Runs toy workloads several times and reports, as JSON, for each one:
+//   - the median and the minimum wall-clock time
+//   - the machine instructions executed (null if the CPU counters are
+//     not available) and the VM instructions (see `TOY_PROFILE`)
+//   - the peak resident set size
+//   - the number of garbage collections (see `TOY_GC_TRACE`)
+// The counts come from an extra run, instrumented. With a baseline,
+// which is a previous output of the driver, the changes are printed to
+// the standard error.
+//
+// Usage: make bench, or
+//   bench/driver [-n runs] [-b baseline.json] toy workload.js...
+
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_NAME 64
+
+typedef struct result {
+    char name[MAX_NAME];
+    double median_ms, min_ms;
+    long long instructions; // -1 if unknown
+    long long vm_instructions;
+    long peak_rss_kb;
+    long gc_count;
+} result_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void fail(const char *message) {
+    perror(message);
+    exit(1);
+}
+
+// Counts the instructions of the process in user space, from its next
+// `exec()`. Returns -1 if it can't.
+static int open_instruction_counter(pid_t pid) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+typedef struct run {
+    double ms;
+    long rss_kb;
+    long long instructions;
+    char *errors; // The standard error, if instrumented
+} run_t;
+
+// Runs `toy script`, with its standard output discarded. The instrumented
+// run enables the profiler and the GC trace, and captures the standard
+// error.
+static run_t run(const char *toy, const char *script, int instrumented) {
+    int go[2], errors[2];
+    if (pipe(go) || pipe(errors)) {
+        fail("pipe");
+    }
+    fflush(stdout); // Otherwise the child would write the buffer again
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid < 0) {
+        fail("fork");
+    }
+    if (!pid) {
+        char c;
+        close(go[1]);
+        close(errors[0]);
+        if (read(go[0], &c, 1) != 1) {
+            _exit(127);
+        }
+        freopen("/dev/null", "w", stdout);
+        if (instrumented) {
+            dup2(errors[1], STDERR_FILENO);
+            setenv("TOY_PROFILE", "opcodes-json", 1);
+            setenv("TOY_GC_TRACE", "1", 1);
+        } else {
+            freopen("/dev/null", "w", stderr);
+        }
+        execl(toy, toy, script, (char *)NULL);
+        _exit(127);
+    }
+    close(go[0]);
+    close(errors[1]);
+
+    // The child waits for the counter before `exec()`.
+    int counter = instrumented ? open_instruction_counter(pid) : -1;
+    if (write(go[1], "", 1) != 1) {
+        fail("write");
+    }
+    close(go[1]);
+
+    run_t r = {.instructions = -1, .errors = 0};
+    size_t length = 0, capacity = 4096;
+    r.errors = malloc(capacity);
+    ssize_t n;
+    while ((n = read(errors[0], r.errors + length,
+                     capacity - length - 1)) > 0) {
+        length += n;
+        if (capacity - length < 2) {
+            capacity *= 2;
+            r.errors = realloc(r.errors, capacity);
+        }
+    }
+    r.errors[length] = 0;
+    close(errors[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        fail("wait4");
+    }
+    r.ms = now_ms() - start;
+    r.rss_kb = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s failed:\n%s", script, r.errors);
+        exit(1);
+    }
+    if (counter >= 0) {
+        uint64_t count;
+        if (read(counter, &count, sizeof(count)) == sizeof(count)) {
+            r.instructions = count;
+        }
+        close(counter);
+    }
+    return r;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void name_workload(char *name, const char *path) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    snprintf(name, MAX_NAME, "%s", base);
+    char *dot = strrchr(name, '.');
+    if (dot) {
+        *dot = 0;
+    }
+}
+
+static result_t bench(const char *toy, const char *script, int runs) {
+    result_t r = {.peak_rss_kb = 0, .gc_count = 0};
+    name_workload(r.name, script);
+
+    double *times = malloc(sizeof(double) * runs);
+    for (int i = 0; i < runs; i++) {
+        run_t one = run(toy, script, 0);
+        times[i] = one.ms;
+        if (one.rss_kb > r.peak_rss_kb) {
+            r.peak_rss_kb = one.rss_kb;
+        }
+        free(one.errors);
+    }
+    qsort(times, runs, sizeof(double), compare_doubles);
+    r.min_ms = times[0];
+    r.median_ms = runs % 2 ? times[runs / 2] :
+        (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    free(times);
+
+    run_t counted = run(toy, script, 1);
+    r.instructions = counted.instructions;
+    r.vm_instructions = -1;
+    for (char *line = counted.errors; *line; ) {
+        char *end = strchr(line, '\n');
+        if (strncmp(line, "gc ", 3) == 0) {
+            r.gc_count++;
+        }
+        char *dispatched = strstr(line, "\"dispatched\": ");
+        if (dispatched && (!end || dispatched < end)) {
+            r.vm_instructions = atoll(dispatched + 14);
+        }
+        if (!end) {
+            break;
+        }
+        line = end + 1;
+    }
+    free(counted.errors);
+    return r;
+}
+
+// One workload per line, see `main()`.
+static int parse_result(const char *line, result_t *r) {
+    const char *name = strstr(line, "\"name\": \"");
+    if (!name) {
+        return 0;
+    }
+    if (sscanf(name, "\"name\": \"%63[^\"]\", \"median_ms\": %lf, "
+               "\"min_ms\": %lf", r->name, &r->median_ms, &r->min_ms) != 3) {
+        return 0;
+    }
+    const char *vm = strstr(line, "\"vm_instructions\": ");
+    r->vm_instructions = vm ? atoll(vm + 19) : -1;
+    const char *rss = strstr(line, "\"peak_rss_kb\": ");
+    r->peak_rss_kb = rss ? atol(rss + 15) : 0;
+    return 1;
+}
+
+static result_t *read_baseline(const char *path, size_t *count) {
+    FILE *file = fopen(path, "r");
+    *count = 0;
+    if (!file) {
+        return NULL;
+    }
+    result_t *results = NULL;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        result_t r;
+        if (parse_result(line, &r)) {
+            results = realloc(results, sizeof(result_t) * (*count + 1));
+            results[(*count)++] = r;
+        }
+    }
+    fclose(file);
+    return results;
+}
+
+static double change(double new, double old) {
+    return old ? 100 * (new - old) / old : 0;
+}
+
+static void compare(const result_t *results, size_t count,
+                    const result_t *baseline, size_t baseline_count) {
+    fprintf(stderr, "%-14s %10s %9s %16s %9s %10s\n", "workload",
+            "median ms", "change", "vm instructions", "change", "rss change");
+    for (size_t i = 0; i < count; i++) {
+        const result_t *r = results + i, *old = NULL;
+        for (size_t j = 0; j < baseline_count; j++) {
+            if (strcmp(baseline[j].name, r->name) == 0) {
+                old = baseline + j;
+            }
+        }
+        if (!old) {
+            fprintf(stderr, "%-14s %10.1f %9s %16lld\n", r->name,
+                    r->median_ms, "new", r->vm_instructions);
+            continue;
+        }
+        fprintf(stderr, "%-14s %10.1f %+8.1f%% %16lld %+8.1f%% %+9.1f%%\n",
+                r->name, r->median_ms, change(r->median_ms, old->median_ms),
+                r->vm_instructions,
+                change(r->vm_instructions, old->vm_instructions),
+                change(r->peak_rss_kb, old->peak_rss_kb));
+    }
+}
+
+static void print_count(long long n) {
+    if (n < 0) {
+        printf("null");
+    } else {
+        printf("%lld", n);
+    }
+}
+
+int main(int argc, char **argv) {
+    int runs = 5;
+    const char *baseline_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+        if (opt == 'n') {
+            runs = atoi(optarg);
+        } else if (opt == 'b') {
+            baseline_path = optarg;
+        } else {
+            return 2;
+        }
+    }
+    if (runs < 1 || argc - optind < 2) {
+        fprintf(stderr, "usage: %s [-n runs] [-b baseline.json] "
+                "toy workload.js...\n", argv[0]);
+        return 2;
+    }
+    const char *toy = argv[optind];
+    size_t count = argc - optind - 1;
+    result_t *results = malloc(sizeof(result_t) * count);
+
+    printf("{\"runs\": %d, \"workloads\": [\n", runs);
+    for (size_t i = 0; i < count; i++) {
+        result_t *r = results + i;
+        *r = bench(toy, argv[optind + 1 + i], runs);
+        printf("  {\"name\": \"%s\", \"median_ms\": %.1f, \"min_ms\": %.1f, "
+               "\"instructions\": ", r->name, r->median_ms, r->min_ms);
+        print_count(r->instructions);
+        printf(", \"vm_instructions\": ");
+        print_count(r->vm_instructions);
+        printf(", \"peak_rss_kb\": %ld, \"gc_count\": %ld}%s\n",
+               r->peak_rss_kb, r->gc_count, i + 1 < count ? "," : "");
+        fflush(stdout);
+    }
+    printf("]}\n");
+
+    if (baseline_path) {
+        size_t baseline_count;
+        result_t *baseline = read_baseline(baseline_path, &baseline_count);
+        if (baseline) {
+            compare(results, count, baseline, baseline_count);
+        } else {
+            fprintf(stderr, "no baseline in %s\n", baseline_path);
+        }
+        free(baseline);
+    }
+    free(results);
+    return 0;
+}
@@ -0,0 +1,99 @@
+// Pause of a full collection of a large heap, against the number of
+// marking threads (see `collect_garbage.c`). The heap is made of
+// records, and of a deeply nested list which used to overflow the C
+// stack of the recursive marking. Before each collection, as many
+// records become garbage. The sweep, which follows the pause unless
+// `TOY_GC_SWEEP=eager`, is timed apart.
+//
+// Usage: make gc-bench && bench/gc_bench [records] [max threads]
+
+#include <time.h>
+#include "../toy.h"
+
+#define DEPTH (1000 * 1000)
+#define REPEAT 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static value_t build_records(unsigned long records) {
+    value_t root = v_list();
+    for (unsigned long i = 0; i < records; i++) {
+        value_t record = v_dict();
+        value_t tags = v_list();
+        v_list_push(tags, v_integer(i));
+        v_list_push(tags, v_string("tag"));
+        value_t nested = v_dict();
+        v_set(nested, v_string("value"), v_integer(i));
+        v_set(record, v_string("name"), v_string("record"));
+        v_set(record, v_string("tags"), tags);
+        v_set(record, v_string("nested"), nested);
+        v_list_push(root, record);
+    }
+    return root;
+}
+
+static value_t build_heap(unsigned long records) {
+    value_t root = build_records(records);
+    v_inc_ref(root);
+    value_t deep = v_list();
+    v_list_push(root, deep);
+    for (unsigned i = 0; i < DEPTH; i++) {
+        value_t inner = v_list();
+        v_list_push(deep, inner);
+        deep = inner;
+    }
+    return root;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    unsigned long records = argc > 1 ? strtoul(argv[1], NULL, 10) : 500000;
+    unsigned max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : 8;
+
+    current_isolate = toy_isolate_new();
+    value_t root = build_heap(records);
+    collect_garbage(); // The keys of the dicts are garbage.
+    finish_sweep(current_isolate);
+    unsigned long count = current_isolate->object_count;
+    printf("%lu live objects\n", count);
+    printf("%8s %14s %14s %14s\n", "threads", "min pause (ms)",
+           "median (ms)", "sweep (ms)");
+
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        set_gc_threads(threads);
+        double pauses[REPEAT], sweeps[REPEAT];
+        for (int i = 0; i < REPEAT; i++) {
+            build_records(records);
+            double start = now();
+            collect_garbage();
+            double middle = now();
+            finish_sweep(current_isolate);
+            pauses[i] = (middle - start) * 1000;
+            sweeps[i] = (now() - middle) * 1000;
+            if (current_isolate->object_count != count) {
+                die("gc_bench: live objects were collected");
+            }
+        }
+        qsort(pauses, REPEAT, sizeof(double), compare_doubles);
+        qsort(sweeps, REPEAT, sizeof(double), compare_doubles);
+        printf("%8u %14.1f %14.1f %14.1f\n", threads, pauses[0],
+               pauses[REPEAT / 2], sweeps[REPEAT / 2]);
+    }
+
+    v_dec_ref(root);
+    collect_garbage();
+    finish_sweep(current_isolate);
+    if (current_isolate->object_count) {
+        die("gc_bench: garbage survived");
+    }
+    toy_isolate_free(current_isolate);
+    return 0;
+}
@@ -0,0 +1,46 @@
+'use strict';
+
+// Writes to the standard output a script with more than 100k constants
+// in a single function, like the large generated scripts. Its constant
+// indices, and the targets of the jumps of its loop, need the
+// `extended_arg` prefix (see `encodeInstructions()` in `compile.js`).
+// The script checks its own results, and dies if they are wrong.
+//
+// Usage: node bench/gen_constants.node.js [count] > bench/constants.js
+// The script has `count` numbers and `count` strings (50001 by default).
+
+var count = Number(process.argv[2] || 50001);
+
+var numbers = [];
+var strings = [];
+var i = 0;
+while (i < count) {
+    numbers.push(String(i));
+    strings.push("'s" + i + "'");
+    i = i + 1;
+}
+
+var lines = [
+    '// Generated by bench/gen_constants.node.js, ' + 2 * count +
+        ' constants',
+    'var numbers = [' + numbers.join(', ') + '];',
+    'var strings = [' + strings.join(', ') + '];',
+    'var last = function (list) { return list[list.length - 1]; };',
+    'var sum = 0;',
+    'var i = 0;',
+    'while (i < numbers.length) {',
+    '    sum = sum + numbers[i];',
+    '    if (strings[i] !== \'s\' + i) {',
+    '        die(\'wrong string \' + i);',
+    '    }',
+    '    i = i + 1;',
+    '}',
+    'if (sum !== ' + count * (count - 1) / 2 + ') {',
+    '    die(\'wrong sum\');',
+    '}',
+    'if (last(strings) !== \'s' + (count - 1) + '\') {',
+    '    die(\'wrong last string\');',
+    '}',
+    'print(sum);',
+];
+process.stdout.write(lines.join('\n') + '\n');
@@ -0,0 +1,10 @@
+// A consumer which waits for more values than it gets: it is still
+// blocked on `recv` when the script ends, which must die with a deadlock
+// error.
+var c = channel(1);
+spawn(function (x) {
+    print(c.recv());
+    print(c.recv());
+});
+c.send(1);
+print('main');
@@ -0,0 +1,8 @@
+// A producer which outlives its consumer: it is still blocked on `send`
+// when the script ends, which must die with a deadlock error.
+var c = channel(1);
+spawn(function (x) {
+    c.send(1);
+    c.send(2);
+});
+print('main');
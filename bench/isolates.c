@@ -0,0 +1,89 @@
+// Stress test of the embedding API (see `isolate.h`): N threads each
+// evaluate the same script many times in their own isolate, for N = 1,
+// 2, 4... up to the given maximum. Each run checks its own results, and
+// the throughput is compared with the single-threaded one.
+//
+// Usage: make isolates-bench && bench/isolates [max threads] [evals]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../isolate.h"
+
+// Allocates a lot, so that the collectors of the isolates work too.
+static const char *const script =
+    "var fib = function (n) {\n"
+    "    if (n < 2) { return n; }\n"
+    "    return fib(n - 1) + fib(n - 2);\n"
+    "};\n"
+    "var records = [];\n"
+    "var i = 0;\n"
+    "while (i < 2000) {\n"
+    "    records.push({id: i, name: 'record ' + i, tags: [i % 7, i % 3]});\n"
+    "    i = i + 1;\n"
+    "}\n"
+    "var total = 0;\n"
+    "i = 0;\n"
+    "while (i < records.length) {\n"
+    "    total = total + records[i].id + records[i].tags[0];\n"
+    "    i = i + 1;\n"
+    "}\n"
+    "if (total !== 2004995) { die('wrong total'); }\n"
+    "if (fib(18) !== 2584) { die('wrong fib'); }\n"
+    "if (records.map(function (r) { return r.name; }).join(',').length\n"
+    "    !== 22889) { die('wrong join'); }\n";
+
+static unsigned eval_count = 20;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *run(void *unused) {
+    (void)unused;
+    toy_isolate_t *isolate = toy_isolate_new();
+    for (unsigned i = 0; i < eval_count; i++) {
+        if (toy_isolate_eval(isolate, script)) {
+            fprintf(stderr, "isolates: %s\n", toy_isolate_error(isolate));
+            exit(1);
+        }
+    }
+    toy_isolate_free(isolate);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) :
+        cpus > 4 ? cpus : 4;
+    if (argc > 2) {
+        eval_count = strtoul(argv[2], NULL, 10);
+    }
+    pthread_t *threads = malloc(sizeof(pthread_t) * max_threads);
+
+    printf("%ld CPUs, %u evaluations per thread\n", cpus, eval_count);
+    printf("%8s %10s %12s %8s\n", "threads", "time (s)", "evals/s", "scaling");
+    double single = 0;
+    for (unsigned n = 1; n <= max_threads; n *= 2) {
+        double start = now();
+        for (unsigned i = 0; i < n; i++) {
+            pthread_create(&threads[i], NULL, run, NULL);
+        }
+        for (unsigned i = 0; i < n; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        double elapsed = now() - start;
+        double throughput = n * eval_count / elapsed;
+        if (n == 1) {
+            single = throughput;
+        }
+        printf("%8u %10.3f %12.1f %7.2fx\n", n, elapsed, throughput,
+               throughput / single);
+    }
+    free(threads);
+    return 0;
+}
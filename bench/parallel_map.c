@@ -0,0 +1,71 @@
+// Speedup of `parallel.map` (see `parallel.c`) on a CPU-bound workload
+// made of function calls, against the number of workers. `list.map` is
+// the baseline.
+//
+// Usage: make parallel-bench && bench/parallel_map [max workers]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../isolate.h"
+
+static const char *const prelude =
+    "var fib = function (n) {\n"
+    "    if (n < 2) { return n; }\n"
+    "    return fib(n - 1) + fib(n - 2);\n"
+    "};\n"
+    "var work = function (record) {\n"
+    "    return {id: record.id, value: fib(record.n)};\n"
+    "};\n"
+    "var records = [];\n"
+    "while (records.length < 64) {\n"
+    "    records.push({id: records.length, n: 17 + records.length % 4});\n"
+    "}\n"
+    "var check = function (results) {\n"
+    "    if (results.length !== 64 || results[63].id !== 63 ||\n"
+    "        results[63].value !== 6765) {\n"
+    "        die('wrong results');\n"
+    "    }\n"
+    "};\n";
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Times the evaluation of the prelude, followed by `code`.
+static double run(const char *code) {
+    char source[4096];
+    snprintf(source, sizeof(source), "%s%s\n", prelude, code);
+    toy_isolate_t *isolate = toy_isolate_new();
+    double start = now();
+    if (toy_isolate_eval(isolate, source)) {
+        fprintf(stderr, "parallel_map: %s\n", toy_isolate_error(isolate));
+        exit(1);
+    }
+    double elapsed = now() - start;
+    toy_isolate_free(isolate);
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_workers = argc > 1 ? strtoul(argv[1], NULL, 10) :
+        cpus > 4 ? cpus : 4;
+
+    printf("%ld CPUs\n", cpus);
+    double baseline = run("check(records.map(work));");
+    printf("%-20s %8.3f s\n", "list.map", baseline);
+    for (unsigned n = 1; n <= max_workers; n *= 2) {
+        char code[128];
+        snprintf(code, sizeof(code), "parallel.workers = %u;\n"
+                 "check(parallel.map(records)(work));", n);
+        double elapsed = run(code);
+        char label[32];
+        snprintf(label, sizeof(label), "parallel.map, %u", n);
+        printf("%-20s %8.3f s %7.2fx\n", label, elapsed, baseline / elapsed);
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+
+// Appended to `compile.js` (see `make bench`): compiles the compiler.
+var readFile = function (path) {
+    var next = fileLines(path);
+    var lines = [];
+    var line = next();
+    while (line !== null) {
+        lines.push(line);
+        line = next();
+    }
+    return lines.join('\n');
+};
+var funcs = module.exports(readFile('compile.js'));
+print(funcs.length);
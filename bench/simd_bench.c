@@ -0,0 +1,184 @@
+// Microbenchmarks of the kernels of `simd.c`, at every level supported
+// by the CPU. The results of each level are checked against the scalar
+// ones first.
+//
+// Usage: make simd-bench && bench/simd_bench
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../simd.h"
+
+static const char *const levels[] = {"scalar", "sse2", "sse4.2", "avx2"};
+
+#define SIZE (16 << 20)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t random_state = 42;
+
+static uint32_t next_random(void) {
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 8;
+}
+
+static void fill_text(char *s, size_t n, const char *alphabet) {
+    size_t length = strlen(alphabet);
+    for (size_t i = 0; i < n; i++) {
+        s[i] = alphabet[next_random() % length];
+    }
+    s[n] = 0;
+}
+
+// Fills `s` with `n` bytes of valid UTF-8 text.
+static void fill_utf8(char *s, size_t n) {
+    static const char *const chars[] = {
+        "a", "b", " ", "\"", "\\", "\xc3\xa9", "\xe2\x82\xac",
+        "\xf0\x9f\x98\x80",
+    };
+    size_t i = 0;
+    while (i < n) {
+        const char *c = chars[next_random() % 8];
+        size_t length = strlen(c);
+        if (i + length > n) {
+            c = "a";
+            length = 1;
+        }
+        memcpy(s + i, c, length);
+        i += length;
+    }
+    s[n] = 0;
+}
+
+static void fail(const char *what, size_t n) {
+    fprintf(stderr, "simd_bench: %s differs at size %zu\n", what, n);
+    exit(1);
+}
+
+static const struct {
+    const char *s;
+    int valid;
+} utf8_cases[] = {
+    {"plain ascii", 1},
+    {"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80", 1},
+    {"\xf4\x8f\xbf\xbf", 1},          // U+10FFFF
+    {"\xc0\xaf", 0},                    // Overlong
+    {"\xe0\x80\xaf", 0},               // Overlong
+    {"\xf0\x80\x80\xaf", 0},           // Overlong
+    {"\xed\xa0\x80", 0},               // Surrogate
+    {"\xf4\x90\x80\x80", 0},           // Above U+10FFFF
+    {"\xf8\x88\x80\x80\x80", 0},       // 5 bytes
+    {"abc\xe2\x82", 0},                 // Truncated
+    {"\x80", 0},                         // Lone continuation
+    {"\xc3\xa9\xa9", 0},                // Extra continuation
+};
+
+// Compares the current level with the scalar one on random inputs.
+static void check_level(const char *level) {
+    for (size_t i = 0; i < sizeof(utf8_cases) / sizeof(*utf8_cases); i++) {
+        // At the beginning, in the middle and at the end of the blocks
+        for (size_t offset = 0; offset < 40; offset++) {
+            char s[100];
+            memset(s, 'x', offset);
+            strcpy(s + offset, utf8_cases[i].s);
+            if (simd_is_valid_utf8(s, strlen(s)) != utf8_cases[i].valid) {
+                fail("is_valid_utf8", strlen(s));
+            }
+        }
+    }
+
+    char s[300], needle[8];
+    simd_byte_set_t set;
+    simd_byte_set_init(&set, "xyz\"\\", 5);
+    simd_byte_set_add_range(&set, 0xc0, 0xff);
+    for (int round = 0; round < 2000; round++) {
+        size_t n = next_random() % 290;
+        if (round % 2) {
+            fill_utf8(s, n);
+        } else {
+            fill_text(s, n, "abxyz");
+        }
+        size_t k = 1 + next_random() % 5;
+        fill_text(needle, k, "ab");
+        if (round % 3 == 0 && n > k + 1) {
+            // A corrupted UTF-8 sequence
+            s[next_random() % n] = (char)0xe2;
+        }
+
+        simd_force_level("scalar");
+        size_t found = simd_find_substring(s, n, needle, k);
+        size_t in_set = simd_find_in_set(&set, s, n);
+        size_t not_in_set = simd_find_not_in_set(&set, s, n);
+        int valid = simd_is_valid_utf8(s, n);
+
+        simd_force_level(level);
+        if (simd_find_substring(s, n, needle, k) != found) {
+            fail("find_substring", n);
+        }
+        if (simd_find_in_set(&set, s, n) != in_set) {
+            fail("find_in_set", n);
+        }
+        if (simd_find_not_in_set(&set, s, n) != not_in_set) {
+            fail("find_not_in_set", n);
+        }
+        if (simd_is_valid_utf8(s, n) != valid) {
+            fail("is_valid_utf8", n);
+        }
+    }
+}
+
+#define BENCH(name, expression)                                         \
+    do {                                                                \
+        double best = 1e9;                                              \
+        for (int run = 0; run < 5; run++) {                             \
+            double start = now();                                       \
+            sink += (expression);                                       \
+            double elapsed = now() - start;                             \
+            best = elapsed < best ? elapsed : best;                     \
+        }                                                               \
+        printf("%-8s %-18s %8.2f GB/s\n", level, name,                  \
+               SIZE / best / 1e9);                                      \
+    } while (0)
+
+int main(void) {
+    char *text = malloc(SIZE + 1);
+    char *utf8 = malloc(SIZE + 1);
+    double *numbers = malloc(sizeof(double) * (SIZE / 8));
+    fill_text(text, SIZE, "abcdefghijklmnopqrstuvwxyz ");
+    fill_utf8(utf8, SIZE);
+    for (size_t i = 0; i < SIZE / 8; i++) {
+        numbers[i] = next_random() % 1000;
+    }
+
+    simd_byte_set_t quote_or_backslash, letters;
+    simd_byte_set_init(&quote_or_backslash, "\"\\", 2);
+    simd_byte_set_init(&letters, " ", 1);
+    simd_byte_set_add_range(&letters, 'a', 'z');
+
+    double sink = 0;
+    for (size_t i = 0; i < sizeof(levels) / sizeof(*levels); i++) {
+        const char *level = levels[i];
+        if (!simd_force_level(level)) {
+            continue;
+        }
+        check_level(level);
+
+        BENCH("find_substring",
+              simd_find_substring(text, SIZE, "needle", 6));
+        BENCH("find_in_set",
+              simd_find_in_set(&quote_or_backslash, text, SIZE));
+        BENCH("find_not_in_set",
+              simd_find_not_in_set(&letters, text, SIZE));
+        BENCH("utf8 (ascii)", simd_is_valid_utf8(text, SIZE));
+        BENCH("utf8 (mixed)", simd_is_valid_utf8(utf8, SIZE));
+        BENCH("sum", simd_sum(numbers, SIZE / 8));
+        BENCH("dot", simd_dot(numbers, numbers, SIZE / 8));
+    }
+    return sink == 42; // Keeps the results alive
+}
@@ -0,0 +1,36 @@
+// Closures: counters, curried functions and callbacks
+var counter = function (start) {
+    var n = start;
+    return function (step) {
+        n = n + step;
+        return n;
+    };
+};
+var add = function (a) {
+    return function (b) {
+        return a + b;
+    };
+};
+var total = 0;
+var i = 0;
+while (i < 20000) {
+    var c = counter(i);
+    c(1);
+    total = total + c(2) + add(i)(1);
+    i = i + 1;
+}
+var compose = function (f) {
+    return function (g) {
+        return function (x) {
+            return f(g(x));
+        };
+    };
+};
+var inc = add(1);
+var twice = compose(inc)(inc);
+i = 0;
+while (i < 50000) {
+    total = total + twice(i) % 3;
+    i = i + 1;
+}
+print(total);
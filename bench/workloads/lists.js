@@ -0,0 +1,20 @@
+// Pushes onto lists, then scans them
+var list = [];
+var i = 0;
+while (i < 200000) {
+    list.push(i * 3 % 1000);
+    i = i + 1;
+}
+var sum = 0;
+var max = 0;
+i = 0;
+while (i < list.length) {
+    var x = list[i];
+    sum = sum + x;
+    if (x > max) {
+        max = x;
+    }
+    i = i + 1;
+}
+var evens = list.filter(function (x) { return x % 2 === 0; });
+print(sum + ' ' + max + ' ' + evens.length + ' ' + list.indexOf(999));
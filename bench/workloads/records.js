@@ -0,0 +1,20 @@
+// Dict-heavy code: builds records, then groups them by a key
+var records = [];
+var i = 0;
+while (i < 100000) {
+    records.push({id: i, name: 'user' + i, group: 'g' + i % 100, score: i % 7});
+    i = i + 1;
+}
+var totals = {};
+i = 0;
+while (i < records.length) {
+    var r = records[i];
+    if (!(r.group in totals)) {
+        totals[r.group] = {count: 0, score: 0};
+    }
+    var t = totals[r.group];
+    t.count = t.count + 1;
+    t.score = t.score + r.score;
+    i = i + 1;
+}
+print(totals.g42.count + ' ' + totals.g42.score);
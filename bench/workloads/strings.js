@@ -0,0 +1,17 @@
+// String building by concatenation and joins, and splitting
+var parts = [];
+var i = 0;
+while (i < 100000) {
+    var s = 'item' + i;
+    s = s + ':' + s.length;
+    parts.push(s);
+    i = i + 1;
+}
+var joined = parts.join(',');
+var line = '';
+i = 0;
+while (i < 2000) {
+    line = line + 'ab';
+    i = i + 1;
+}
+print(joined.length + ' ' + joined.split(',').length + ' ' + line.length);
@@ -14,3 +14,39 @@ void bvalue_array_to_v(value_t *v, const bvalue_t *b, size_t length) {
         v[i] = bvalue_to_v(b[i]);
     }
 }
+
+// Returns a new file made of copies of the given functions. Their
+// constants are converted to values of the current isolate.
+compiled_file_t *new_builtin_file(compiled_func_t *const *funcs,
+                                  size_t count) {
+    compiled_file_t *file = xmalloc(sizeof(*file));
+    *file = (compiled_file_t){
+        .funcs = xmalloc(sizeof(compiled_func_t *) * count),
+        .func_count = count,
+        .source = v_null,
+        .compiler = v_null,
+    };
+    for (size_t i = 0; i < count; i++) {
+        compiled_func_t *func = xmalloc(sizeof(*func));
+        *func = *funcs[i];
+        func->file = file;
+        if (func->param_name) {
+            func->param_name = xstrdup(func->param_name);
+        }
+        func->name = xstrdup(func->name);
+        func->lines = xmalloc(sizeof(uint32_t) * (2 * func->line_count | 1));
+        if (func->line_count) {
+            memcpy(func->lines, funcs[i]->lines,
+                   sizeof(uint32_t) * 2 * func->line_count);
+        }
+        func->code = xmalloc(func->code_length);
+        memcpy(func->code, funcs[i]->code, func->code_length);
+        func->consts = xmalloc(sizeof(value_t) * func->const_count);
+        bvalue_array_to_v(func->consts, func->bconsts, func->const_count);
+        file->funcs[i] = func;
+    }
+    for (size_t i = 0; i < count; i++) {
+        verify_func(file->funcs[i]);
+    }
+    return file;
+}
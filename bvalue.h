@@ -32,4 +32,8 @@ struct bvalue {
 
 void bvalue_array_to_v(value_t *v, const bvalue_t *b, size_t length);
 
+struct compiled_func;
+struct compiled_file *new_builtin_file(struct compiled_func *const *funcs,
+                                       size_t count);
+
 #endif /* BUILTIN_H */
@@ -1,54 +1,141 @@
 #include "toy.h"
+#include <inttypes.h>
+#include <sched.h>
+#include <time.h>
 
-static void mark_object(object_t *object);
-static void mark_compiled_func(const struct compiled_func *cf);
+// Mark and sweep. The roots are the objects with a nonzero `ref_count`.
+// The marking is not recursive: the grey objects (marked, but whose
+// children are not) wait on an explicit stack.
+//
+// With `TOY_GC_THREADS=n`, the heaps of more than `PARALLEL_THRESHOLD`
+// objects are marked by n threads. Each thread has a private stack, and
+// moves its surplus to a deque from which the idle threads steal. The
+// mark bits are then set atomically.
+//
+// The pause contains only the marking: the list of objects is then
+// detached from the isolate, and swept later. `TOY_GC_SWEEP` selects
+// when:
+//   - `lazy` (the default): each allocation sweeps `SWEEP_STEP` objects
+//   - `background`: a thread sweeps them while the interpreter runs
+//   - `eager`: at once, during the pause
+// Either way, the sweep is finished before the next marking.
+//
+// Each collection records statistics (`gc_stats_t`), which are complete
+// once its sweep is done. `gc.stats()` returns those of the last one,
+// and `TOY_GC_TRACE=1` prints them to the standard error. Moreover,
+// `gc.heapSnapshot(path)` writes the object graph to a file.
 
-static void mark_value(value_t v) {
-    if (v_is_object(v)) {
-        mark_object(v.object);
-    }
+#define PARALLEL_THRESHOLD (64 * 1024)
+#define SHARE_CHUNK 256
+#define SWEEP_STEP 64
+
+typedef struct mark_stack {
+    object_t **items;
+    size_t length, capacity;
+} mark_stack_t;
+
+// The owner pushes and pops at the end, the thieves take from the
+// beginning. `length` can be read without the lock.
+typedef struct mark_deque {
+    pthread_mutex_t mutex;
+    object_t **items;
+    size_t begin, end, capacity;
+    size_t length;
+} mark_deque_t;
+
+typedef struct marker marker_t;
+
+typedef struct parallel_mark {
+    marker_t *markers;
+    unsigned count;
+    unsigned idle; // Number of markers which found no work
+} parallel_mark_t;
+
+struct marker {
+    mark_stack_t stack;
+    parallel_mark_t *parallel; // Null if marking alone
+    mark_deque_t deque;
+    unsigned index;
+    unsigned long marked[OBJECT_TYPE_COUNT]; // Number of objects by type
+};
+
+static double now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
 }
 
-static void mark_dict(dict_t *dict) {
-    for (dict_entry_t *e = *dict; e; e = e->next) {
-        mark_value(e->value);
+
+
+//////////////////////////////////////////////////// MARKING
+
+
+
+static void stack_push(mark_stack_t *stack, object_t *object) {
+    if (stack->length == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->items = xrealloc(stack->items,
+                                sizeof(object_t *) * stack->capacity);
     }
+    stack->items[stack->length++] = object;
 }
 
-static void mark_compiled_file(const struct compiled_file *cf) {
-    for (size_t i = 0; i < cf->func_count; i++) {
-        mark_compiled_func(cf->funcs + i);
+// Returns nonzero if the object was not marked yet.
+static int try_mark(marker_t *m, object_t *object) {
+    if (!m->parallel) {
+        if (object->marked) {
+            return 0;
+        }
+        object->marked = 1;
+        m->marked[object->type]++;
+        return 1;
     }
+    if (__atomic_load_n(&object->marked, __ATOMIC_RELAXED) ||
+        __atomic_exchange_n(&object->marked, 1, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    m->marked[object->type]++;
+    return 1;
 }
 
-static void mark_compiled_func(const struct compiled_func *cf) {
-    for (size_t i = 0; i < cf->const_count; i++) {
-        mark_value(cf->consts[i]);
+static void mark_value(marker_t *m, value_t v) {
+    if (v_is_object(v) && try_mark(m, v.object)) {
+        stack_push(&m->stack, v.object);
     }
 }
 
-static void mark_func(object_t *object) {
-    mark_value(object->func.parent_scope);
-    const struct compiled_func *cf = object->func.compiled;
-    if (cf) {
-        mark_compiled_func(cf);
-        mark_compiled_file(cf->file);
+static void mark_compiled_func(marker_t *m, const struct compiled_func *cf) {
+    for (size_t i = 0; i < cf->const_count; i++) {
+        mark_value(m, cf->consts[i]);
     }
 }
 
-static void mark_object(object_t *object) {
-    if (object->marked) {
-        return;
+static void mark_compiled_file(marker_t *m, const struct compiled_file *cf) {
+    for (size_t i = 0; i < cf->func_count; i++) {
+        mark_compiled_func(m, cf->funcs[i]);
     }
+}
 
-    object->marked = 1;
+// Marks the children of a grey object.
+static void scan_object(marker_t *m, object_t *object) {
     switch (object->type) {
     case object_type_list:
+        for (size_t i = 0; i < object->list.length; i++) {
+            mark_value(m, object->list.items[i]);
+        }
+        break;
     case object_type_dict:
-        mark_dict(&object->dict);
+        for (dict_entry_t *e = object->dict; e; e = e->next) {
+            mark_value(m, e->value);
+        }
         break;
     case object_type_func: {
-        mark_func(object);
+        mark_value(m, object->func.parent_scope);
+        const struct compiled_func *cf = object->func.compiled;
+        if (cf) {
+            mark_compiled_func(m, cf);
+            mark_compiled_file(m, cf->file);
+        }
         break;
     }
     default:
@@ -56,33 +143,547 @@ static void mark_object(object_t *object) {
     }
 }
 
-void collect_garbage(void) {
-    for (object_t *o = big_linked_list; o; o = o->next) {
-        o->marked = 0;
+
+
+//////////////////////////////////////////////////// WORK STEALING
+
+
+
+// Moves the newest grey objects of the private stack to the deque.
+static void share(marker_t *m) {
+    mark_deque_t *d = &m->deque;
+    pthread_mutex_lock(&d->mutex);
+    if (d->begin == d->end) {
+        d->begin = d->end = 0;
+    }
+    if (d->end + SHARE_CHUNK > d->capacity) {
+        size_t length = d->end - d->begin;
+        memmove(d->items, d->items + d->begin, sizeof(object_t *) * length);
+        d->begin = 0;
+        d->end = length;
+        if (length + SHARE_CHUNK > d->capacity) {
+            d->capacity = (length + SHARE_CHUNK) * 2;
+            d->items = xrealloc(d->items, sizeof(object_t *) * d->capacity);
+        }
+    }
+    m->stack.length -= SHARE_CHUNK;
+    memcpy(d->items + d->end, m->stack.items + m->stack.length,
+           sizeof(object_t *) * SHARE_CHUNK);
+    d->end += SHARE_CHUNK;
+    __atomic_store_n(&d->length, d->end - d->begin, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&d->mutex);
+}
+
+// Moves objects of `d` to the private stack: at most SHARE_CHUNK from
+// the end of its own deque, half of the deque of another marker.
+static int take(marker_t *m, mark_deque_t *d) {
+    if (!__atomic_load_n(&d->length, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    pthread_mutex_lock(&d->mutex);
+    size_t length = d->end - d->begin;
+    size_t count;
+    if (d == &m->deque) {
+        count = length < SHARE_CHUNK ? length : SHARE_CHUNK;
+        d->end -= count;
+        for (size_t i = 0; i < count; i++) {
+            stack_push(&m->stack, d->items[d->end + i]);
+        }
+    } else {
+        count = (length + 1) / 2;
+        for (size_t i = 0; i < count; i++) {
+            stack_push(&m->stack, d->items[d->begin + i]);
+        }
+        d->begin += count;
+    }
+    __atomic_store_n(&d->length, length - count, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&d->mutex);
+    return count != 0;
+}
+
+static int find_work(marker_t *m) {
+    parallel_mark_t *p = m->parallel;
+    if (take(m, &m->deque)) {
+        return 1;
+    }
+    for (unsigned i = 1; i < p->count; i++) {
+        if (take(m, &p->markers[(m->index + i) % p->count].deque)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Returns zero when every marker is idle, and all the deques empty.
+static int refill(marker_t *m) {
+    parallel_mark_t *p = m->parallel;
+    if (find_work(m)) {
+        return 1;
+    }
+    __atomic_add_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        if (__atomic_load_n(&p->idle, __ATOMIC_SEQ_CST) == p->count) {
+            return 0;
+        }
+        for (unsigned i = 0; i < p->count; i++) {
+            if (__atomic_load_n(&p->markers[i].deque.length,
+                                __ATOMIC_RELAXED)) {
+                __atomic_sub_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+                if (find_work(m)) {
+                    return 1;
+                }
+                __atomic_add_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+        }
+        sched_yield();
+    }
+}
+
+static void drain(marker_t *m) {
+    do {
+        while (m->stack.length) {
+            object_t *object = m->stack.items[--m->stack.length];
+            scan_object(m, object);
+            if (m->parallel && m->stack.length > 2 * SHARE_CHUNK &&
+                !__atomic_load_n(&m->deque.length, __ATOMIC_RELAXED)) {
+                share(m);
+            }
+        }
+    } while (m->parallel && refill(m));
+}
+
+static void *run_marker(void *m) {
+    drain(m);
+    return NULL;
+}
+
+// Adds the number of marked objects of each type to `marked`.
+static void mark_in_parallel(toy_isolate_t *isolate, unsigned count,
+                             unsigned long *marked) {
+    parallel_mark_t p = {
+        .markers = xcalloc(count, sizeof(marker_t)),
+        .count = count,
+        .idle = 0,
+    };
+    for (unsigned i = 0; i < count; i++) {
+        p.markers[i].parallel = &p;
+        p.markers[i].index = i;
+        pthread_mutex_init(&p.markers[i].deque.mutex, NULL);
+    }
+
+    // The roots are dealt before the threads start.
+    unsigned next = 0;
+    for (object_t *o = isolate->big_linked_list; o; o = o->next) {
+        if (o->ref_count && !o->marked) {
+            o->marked = 1;
+            p.markers[next].marked[o->type]++;
+            stack_push(&p.markers[next].stack, o);
+            next = (next + 1) % count;
+        }
+    }
+
+    pthread_t *threads = xmalloc(sizeof(pthread_t) * count);
+    for (unsigned i = 1; i < count; i++) {
+        if (pthread_create(&threads[i], NULL, run_marker, &p.markers[i])) {
+            die("cannot create a marking thread");
+        }
+    }
+    drain(&p.markers[0]);
+    for (unsigned i = 1; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        for (int type = 0; type < OBJECT_TYPE_COUNT; type++) {
+            marked[type] += p.markers[i].marked[type];
+        }
+        free(p.markers[i].stack.items);
+        free(p.markers[i].deque.items);
+        pthread_mutex_destroy(&p.markers[i].deque.mutex);
+    }
+    free(threads);
+    free(p.markers);
+}
+
+static void mark_alone(toy_isolate_t *isolate, unsigned long *marked) {
+    marker_t m = {.stack = {0}, .parallel = 0, .marked = {0}};
+    for (object_t *o = isolate->big_linked_list; o; o = o->next) {
+        if (o->ref_count && try_mark(&m, o)) {
+            stack_push(&m.stack, o);
+            drain(&m);
+        }
+    }
+    free(m.stack.items);
+    for (int type = 0; type < OBJECT_TYPE_COUNT; type++) {
+        marked[type] += m.marked[type];
+    }
+}
+
+
+
+//////////////////////////////////////////////////// SWEEPING
+
+
+
+// The sweep does not use `current_isolate`, since it can run on the
+// sweeper thread. The survivors are unmarked, and moved to another list.
+static void sweep(sweep_t *s, unsigned long count) {
+    double start = now_ms();
+    while (s->unswept && count--) {
+        object_t *o = s->unswept;
+        s->unswept = o->next;
+        if (o->marked) {
+            o->marked = 0;
+            o->prev = s->last_survivor;
+            o->next = 0;
+            if (s->last_survivor) {
+                s->last_survivor->next = o;
+            } else {
+                s->survivors = o;
+            }
+            s->last_survivor = o;
+        } else {
+            s->stats.freed[o->type]++;
+            s->stats.bytes_freed += object_size(o);
+            destroy_object(o);
+            s->freed++;
+        }
+    }
+    s->stats.sweep_ms += now_ms() - start;
+}
+
+static void *run_sweeper(void *s) {
+    sweep(s, -1);
+    return NULL;
+}
+
+static int gc_trace;
+
+static void init_gc_trace(void) {
+    const char *s = getenv("TOY_GC_TRACE");
+    gc_trace = s && *s && strcmp(s, "0") != 0;
+}
+
+static unsigned long sum_types(const unsigned long *counts) {
+    unsigned long sum = 0;
+    for (int type = 0; type < OBJECT_TYPE_COUNT; type++) {
+        sum += counts[type];
     }
+    return sum;
+}
+
+static void print_trace(const gc_stats_t *stats) {
+    fprintf(stderr, "gc %lu (%s): %lu objects, %lu marked, %lu freed "
+            "(%zu bytes), mark %.3f ms, sweep %.3f ms\n", stats->number,
+            stats->reason, stats->objects_before, sum_types(stats->marked),
+            sum_types(stats->freed), stats->bytes_freed, stats->mark_ms,
+            stats->sweep_ms);
+}
 
-    for (object_t *o = big_linked_list; o; o = o->next) {
-        if (o->ref_count) {
-            mark_object(o);
+// Puts the survivors back into the list of the isolate.
+static void end_sweep(toy_isolate_t *isolate) {
+    sweep_t *s = &isolate->sweep;
+    isolate->last_gc = s->stats;
+    if (gc_trace) {
+        print_trace(&s->stats);
+    }
+    if (s->survivors) {
+        s->last_survivor->next = isolate->big_linked_list;
+        if (isolate->big_linked_list) {
+            isolate->big_linked_list->prev = s->last_survivor;
         }
+        isolate->big_linked_list = s->survivors;
+    }
+    isolate->object_count -= s->freed;
+    *s = (sweep_t){.state = sweep_state_done};
+}
+
+void sweep_lazily(toy_isolate_t *isolate) {
+    sweep(&isolate->sweep, SWEEP_STEP);
+    if (!isolate->sweep.unswept) {
+        end_sweep(isolate);
     }
+}
 
-    object_t *o = big_linked_list;
-    while (o) {
-        object_t *next = o->next;
-        if (!o->marked) {
-            free_object_unsafe(o);
+void finish_sweep(toy_isolate_t *isolate) {
+    switch (isolate->sweep.state) {
+    case sweep_state_done:
+        return;
+    case sweep_state_lazy:
+        sweep(&isolate->sweep, -1);
+        break;
+    case sweep_state_background:
+        pthread_join(isolate->sweep.sweeper, NULL);
+        break;
+    }
+    end_sweep(isolate);
+}
+
+static enum sweep_state sweep_mode = sweep_state_lazy;
+
+static void init_sweep_mode(void) {
+    const char *s = getenv("TOY_GC_SWEEP");
+    if (!s || strcmp(s, "lazy") == 0) {
+        return;
+    }
+    if (strcmp(s, "background") == 0) {
+        sweep_mode = sweep_state_background;
+    } else if (strcmp(s, "eager") == 0) {
+        sweep_mode = sweep_state_done;
+    } else {
+        die("TOY_GC_SWEEP must be lazy, background or eager");
+    }
+}
+
+static void start_sweep(toy_isolate_t *isolate, const gc_stats_t *stats) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_sweep_mode);
+
+    sweep_t *s = &isolate->sweep;
+    *s = (sweep_t){
+        .state = sweep_mode,
+        .unswept = isolate->big_linked_list,
+        .survivors = 0,
+        .last_survivor = 0,
+        .freed = 0,
+        .stats = *stats,
+    };
+    isolate->big_linked_list = 0;
+    switch (sweep_mode) {
+    case sweep_state_done:
+        sweep(s, -1);
+        end_sweep(isolate);
+        break;
+    case sweep_state_lazy:
+        break;
+    case sweep_state_background:
+        if (pthread_create(&s->sweeper, NULL, run_sweeper, s)) {
+            s->state = sweep_state_lazy;
         }
-        o = next;
+        break;
+    }
+}
+
+
+
+//////////////////////////////////////////////////// COLLECTION
+
+
+
+static unsigned gc_threads;
+
+static void init_gc_threads(void) {
+    if (gc_threads) {
+        return; // Already set
+    }
+    const char *s = getenv("TOY_GC_THREADS");
+    gc_threads = s ? strtoul(s, NULL, 10) : 1;
+    if (!gc_threads) {
+        gc_threads = 1;
     }
 }
 
-static unsigned long object_count_after_last_gc = 0;
+void set_gc_threads(unsigned count) {
+    gc_threads = count ? count : 1;
+}
+
+static unsigned get_gc_threads(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_gc_threads);
+    return gc_threads;
+}
+
+// The marks are cleared by the sweep, so every object is unmarked
+// between two collections.
+static void collect(const char *reason) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_gc_trace);
+
+    toy_isolate_t *isolate = current_isolate;
+    finish_sweep(isolate);
+
+    gc_stats_t stats = {
+        .number = ++isolate->gc_count,
+        .reason = reason,
+        .objects_before = isolate->object_count,
+    };
+    double start = now_ms();
+    unsigned threads = get_gc_threads();
+    if (threads > 1 && isolate->object_count >= PARALLEL_THRESHOLD) {
+        mark_in_parallel(isolate, threads, stats.marked);
+    } else {
+        mark_alone(isolate, stats.marked);
+    }
+    stats.mark_ms = now_ms() - start;
+    isolate->allocation_count_since_last_gc = 0;
+    isolate->object_count_after_last_gc = sum_types(stats.marked);
+    start_sweep(isolate, &stats);
+}
+
+void collect_garbage(void) {
+    collect("explicit");
+}
 
+// Collects when there have been more allocations since the last
+// collection than objects marked by it.
 void request_garbage_collection(void) {
-    if (allocation_count_since_last_gc > object_count_after_last_gc) {
-        collect_garbage();
-        allocation_count_since_last_gc = 0;
-        object_count_after_last_gc = object_count;
+    toy_isolate_t *isolate = current_isolate;
+    if (isolate->allocation_count_since_last_gc >
+        isolate->object_count_after_last_gc) {
+        collect("allocations");
     }
 }
+
+
+
+//////////////////////////////////////////////////// INSTRUMENTATION
+
+
+
+static const char *const type_names[OBJECT_TYPE_COUNT] = {
+    [object_type_dict] = "dict",
+    [object_type_list] = "list",
+    [object_type_string] = "string",
+    [object_type_func] = "function",
+    [object_type_float64_array] = "Float64Array",
+    [object_type_line_reader] = "lineReader",
+};
+
+static value_t counts_by_type(const unsigned long *counts) {
+    value_t dict = v_dict();
+    for (int type = 0; type < OBJECT_TYPE_COUNT; type++) {
+        v_set(dict, v_string(type_names[type]), v_integer(counts[type]));
+    }
+    return dict;
+}
+
+// Returns the statistics of the last collection, after finishing its
+// sweep. `collections` is null if there was none.
+static value_t v_gc_stats(value_t ctx, value_t unused) {
+    (void)ctx;
+    (void)unused;
+    toy_isolate_t *isolate = current_isolate;
+    finish_sweep(isolate);
+    const gc_stats_t *s = &isolate->last_gc;
+    value_t stats = v_dict();
+    v_set(stats, v_string("collections"), v_integer(isolate->gc_count));
+    v_set(stats, v_string("objects"), v_integer(isolate->object_count));
+    if (!s->number) {
+        return stats;
+    }
+    v_set(stats, v_string("reason"), v_string(s->reason));
+    v_set(stats, v_string("objectsBefore"), v_integer(s->objects_before));
+    v_set(stats, v_string("marked"), counts_by_type(s->marked));
+    v_set(stats, v_string("freed"), counts_by_type(s->freed));
+    v_set(stats, v_string("bytesFreed"), v_integer(s->bytes_freed));
+    v_set(stats, v_string("markMs"), v_number(s->mark_ms));
+    v_set(stats, v_string("sweepMs"), v_number(s->sweep_ms));
+    return stats;
+}
+
+static value_t v_gc_collect(value_t ctx, value_t unused) {
+    (void)ctx;
+    (void)unused;
+    collect_garbage();
+    return v_null;
+}
+
+static void write_json_string(FILE *file, const char *s) {
+    fputc('"', file);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void write_edge(FILE *file, int *first, value_t v) {
+    if (v_is_object(v)) {
+        fprintf(file, "%s%" PRIuPTR, *first ? "" : ", ", (uintptr_t)v.object);
+        *first = 0;
+    }
+}
+
+// One JSON object per line, like:
+//   {"id": 1234, "type": "dict", "size": 96, "refs": 0,
+//    "edges": [5678], "keys": ["a"]}
+// `refs` is the reference count: the objects which have some are the
+// roots. The edges are the objects referenced by the object. The `keys`
+// of a dict are the ones of its edges. The edges of a function are its
+// parent scope and its constants.
+static void write_object(FILE *file, const object_t *o) {
+    fprintf(file, "{\"id\": %" PRIuPTR ", \"type\": \"%s\", \"size\": %zu, "
+            "\"refs\": %d, \"edges\": [", (uintptr_t)o, type_names[o->type],
+            object_size(o), o->ref_count);
+    int first = 1;
+    switch (o->type) {
+    case object_type_list:
+        for (size_t i = 0; i < o->list.length; i++) {
+            write_edge(file, &first, o->list.items[i]);
+        }
+        break;
+    case object_type_dict:
+        for (dict_entry_t *e = o->dict; e; e = e->next) {
+            write_edge(file, &first, e->value);
+        }
+        fprintf(file, "], \"keys\": [");
+        first = 1;
+        for (dict_entry_t *e = o->dict; e; e = e->next) {
+            if (v_is_object(e->value)) {
+                fprintf(file, first ? "" : ", ");
+                write_json_string(file, e->key);
+                first = 0;
+            }
+        }
+        break;
+    case object_type_func: {
+        write_edge(file, &first, o->func.parent_scope);
+        const struct compiled_func *cf = o->func.compiled;
+        for (size_t i = 0; cf && i < cf->const_count; i++) {
+            write_edge(file, &first, cf->consts[i]);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    fprintf(file, "]}\n");
+}
+
+// Collects the garbage, then writes the remaining objects to the file.
+// Returns their number.
+static value_t v_gc_heap_snapshot(value_t ctx, value_t path) {
+    (void)ctx;
+    v_assert_type(path, string);
+    collect("snapshot");
+    toy_isolate_t *isolate = current_isolate;
+    finish_sweep(isolate);
+    FILE *file = fopen(path.object->string, "w");
+    if (!file) {
+        die("gc.heapSnapshot(): cannot open the file");
+    }
+    unsigned long count = 0;
+    for (object_t *o = isolate->big_linked_list; o; o = o->next) {
+        write_object(file, o);
+        count++;
+    }
+    if (fclose(file)) {
+        die("gc.heapSnapshot(): cannot write the file");
+    }
+    return v_integer(count);
+}
+
+value_t get_gc(void) {
+    value_t gc = v_dict();
+    v_set(gc, v_string("stats"), v_native_func(v_gc_stats));
+    v_set(gc, v_string("collect"), v_native_func(v_gc_collect));
+    v_set(gc, v_string("heapSnapshot"), v_native_func(v_gc_heap_snapshot));
+    return gc;
+}
@@ -1,4 +1,5 @@
 #include "toy.h"
+#include "simd.h"
 #include <errno.h>
 
 static value_t v_die(value_t ctx, value_t message) {
@@ -8,9 +9,14 @@ static value_t v_die(value_t ctx, value_t message) {
 
 static value_t v_print(value_t ctx, value_t message) {
     (void)ctx;
-    char *s = v_to_string(message);
-    puts(s);
-    free(s);
+    if (v_is_string(message)) {
+        io_write(message.object->string, message.object->string_length);
+    } else {
+        char *s = v_to_string(message);
+        io_write(s, strlen(s));
+        free(s);
+    }
+    io_write("\n", 1);
     return v_null;
 }
 
@@ -33,6 +39,227 @@ static value_t v_math_floor(value_t ctx, value_t number) {
     return v_number(v_to_integer(number));
 }
 
+static const char *const keywords[] = {
+    "else", "false", "function", "if", "in", "null", "return", "true",
+    "typeof", "var", "while",
+};
+
+// Longest ones first.
+static const char *const punctuators[] = {
+    "===", "!==", "<=", ">=", "&&", "||",
+    "(", ")", "{", "}", "[", "]", ",", ";", ":", ".", "=",
+    "+", "-", "*", "/", "%", "<", ">", "!",
+};
+
+static int is_letter(char c) {
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+static int is_digit(char c) {
+    return '0' <= c && c <= '9';
+}
+
+static int is_keyword(const char *s) {
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(*keywords); i++) {
+        if (strcmp(keywords[i], s) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+typedef struct lexer lexer_t;
+
+struct lexer {
+    const char *source;
+    const char *source_end; // The terminating NUL
+    const char *p;
+    unsigned line;
+    char *buffer; // Large enough for any token
+};
+
+// The lexer scans the runs of whitespace, identifier characters and
+// string characters with the vectorized kernels of `simd.c`.
+static simd_byte_set_t whitespace_set, word_set, string_special_set,
+    newline_set;
+
+static void init_lexer_sets(void) {
+    simd_byte_set_init(&whitespace_set, " \n\r\t", 4);
+    simd_byte_set_init(&word_set, "_", 1);
+    simd_byte_set_add_range(&word_set, 'a', 'z');
+    simd_byte_set_add_range(&word_set, 'A', 'Z');
+    simd_byte_set_add_range(&word_set, '0', '9');
+    simd_byte_set_init(&string_special_set, "\0'\\\n", 4);
+    simd_byte_set_init(&newline_set, "\n", 1);
+}
+
+__attribute__((noreturn))
+static void lexer_syntax_error(const lexer_t *lexer) {
+    char message[64];
+    snprintf(message, sizeof(message), "syntax error (line %u)", lexer->line);
+    die(message);
+}
+
+static unsigned count_newlines(const char *p, size_t n) {
+    unsigned count = 0;
+    const char *end = p + n;
+    while ((p = memchr(p, '\n', end - p))) {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+static void lexer_skip_whitespace(lexer_t *lexer) {
+    const char *p = lexer->p;
+    for (;;) {
+        if (p[0] == '/' && p[1] == '/') {
+            p += simd_find_in_set(&newline_set, p, lexer->source_end - p);
+        }
+        size_t n = simd_find_not_in_set(&whitespace_set, p,
+                                        lexer->source_end - p);
+        lexer->line += count_newlines(p, n);
+        p += n;
+        if (p[0] != '/' || p[1] != '/') {
+            lexer->p = p;
+            return;
+        }
+    }
+}
+
+static void token_set(value_t token, const char *key, value_t v) {
+    dict_set(&token.object->dict, key, v);
+}
+
+static void lexer_word(lexer_t *lexer, value_t token) {
+    const char *p = lexer->p;
+    size_t length = simd_find_not_in_set(&word_set, p, lexer->source_end - p);
+    memcpy(lexer->buffer, p, length);
+    lexer->buffer[length] = 0;
+    lexer->p += length;
+    const char *type = is_keyword(lexer->buffer) ? "keyword" : "identifier";
+    token_set(token, "type", v_string(type));
+    token_set(token, "string", v_string(lexer->buffer));
+}
+
+static void lexer_number(lexer_t *lexer, value_t token) {
+    double n = 0;
+    while (is_digit(*lexer->p)) {
+        n = n * 10 + (*lexer->p - '0');
+        lexer->p++;
+    }
+    token_set(token, "type", v_string("number"));
+    token_set(token, "value", v_number(n));
+}
+
+static void lexer_string(lexer_t *lexer, value_t token) {
+    size_t length = 0;
+    const char *p = lexer->p + 1;
+    for (;;) {
+        size_t run = simd_find_in_set(&string_special_set, p,
+                                      lexer->source_end - p);
+        memcpy(lexer->buffer + length, p, run);
+        length += run;
+        p += run;
+
+        char c = *p++;
+        if (!c) {
+            lexer_syntax_error(lexer);
+        }
+        if (c == '\'') {
+            break;
+        }
+        if (c == '\\') {
+            switch (*p++) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case '\'': c = '\''; break;
+            case '\\': c = '\\'; break;
+            default: lexer_syntax_error(lexer);
+            }
+        } else if (c == '\n') {
+            lexer->line++;
+        }
+        lexer->buffer[length++] = c;
+    }
+    lexer->buffer[length] = 0;
+    lexer->p = p;
+    token_set(token, "type", v_string("string"));
+    token_set(token, "value", v_string(lexer->buffer));
+}
+
+static void lexer_punctuator(lexer_t *lexer, value_t token) {
+    size_t count = sizeof(punctuators) / sizeof(*punctuators);
+    for (size_t i = 0; i < count; i++) {
+        size_t length = strlen(punctuators[i]);
+        if (strncmp(lexer->p, punctuators[i], length) == 0) {
+            lexer->p += length;
+            token_set(token, "type", v_string("punctuator"));
+            token_set(token, "string", v_string(punctuators[i]));
+            return;
+        }
+    }
+    lexer_syntax_error(lexer);
+}
+
+// Native version of `lex()` in `compile.js`, which has the same output.
+// The argument is either a string or a dict like the argument of `lex()`.
+static value_t v_tokenize(value_t ctx, value_t arg) {
+    (void)ctx;
+    value_t vsource = arg;
+    size_t begin = 0, end = (size_t)-1;
+    unsigned line = 1;
+    if (v_is_dict(arg)) {
+        vsource = v_get(arg, v_string("source"));
+        begin = v_to_integer(v_get(arg, v_string("begin")));
+        end = v_to_integer(v_get(arg, v_string("end")));
+        line = v_to_integer(v_get(arg, v_string("line")));
+    }
+    v_assert_type(vsource, string);
+    const char *source = vsource.object->string;
+    size_t length = strlen(source);
+    if (begin > length) {
+        begin = length;
+    }
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_lexer_sets);
+    lexer_t lexer = {
+        .source = source,
+        .source_end = source + length,
+        .p = source + begin,
+        .line = line,
+        .buffer = xmalloc(length - begin + 1),
+    };
+    value_t tokens = v_list();
+
+    for (;;) {
+        lexer_skip_whitespace(&lexer);
+        value_t token = v_dict();
+        token_set(token, "index", v_integer(lexer.p - source));
+        token_set(token, "line", v_integer(lexer.line));
+        v_list_push(tokens, token);
+
+        char c = *lexer.p;
+        if (!c || (size_t)(lexer.p - source) >= end) {
+            token_set(token, "type", v_string("eof"));
+            break;
+        }
+        if (is_letter(c) || c == '_') {
+            lexer_word(&lexer, token);
+        } else if (is_digit(c)) {
+            lexer_number(&lexer, token);
+        } else if (c == '\'') {
+            lexer_string(&lexer, token);
+        } else {
+            lexer_punctuator(&lexer, token);
+        }
+    }
+
+    free(lexer.buffer);
+    return tokens;
+}
+
 static value_t get_math(void) {
     value_t m = v_dict();
     v_set(m, v_string("floor"), v_native_func(v_math_floor));
@@ -43,8 +270,21 @@ static value_t get_global_scope(void) {
     value_t scope = v_dict();
     v_set(scope, v_string("die"), v_native_func(v_die));
     v_set(scope, v_string("print"), v_native_func(v_print));
+    v_set(scope, v_string("flush"), v_native_func(v_flush));
+    v_set(scope, v_string("readLine"), v_native_func(v_read_line));
+    v_set(scope, v_string("readStdin"), v_native_func(v_read_stdin));
+    v_set(scope, v_string("fileLines"), v_native_func(v_file_lines));
     v_set(scope, v_string("parseInt"), v_native_func(v_parse_int));
+    v_set(scope, v_string("tokenize"), v_native_func(v_tokenize));
     v_set(scope, v_string("Math"), get_math());
+    v_set(scope, v_string("JSON"), get_json());
+    v_set(scope, v_string("parallel"), get_parallel());
+    v_set(scope, v_string("gc"), get_gc());
+    v_set(scope, v_string("spawn"), v_native_func(v_spawn));
+    v_set(scope, v_string("yield"), v_native_func(v_yield));
+    v_set(scope, v_string("channel"), v_native_func(v_channel));
+    v_set(scope, v_string("Float64Array"),
+          v_native_func(v_new_float64_array));
     return scope;
 }
 
@@ -57,20 +297,53 @@ static value_t import_nodejs_module(value_t file_func, value_t global_scope) {
     return v_get(module, v_string("exports"));
 }
 
-static value_t get_builtin_file_func(void) {
-    compiled_file_t *file = get_builtin_file();
-    value_t vglobal = {
-        .type = value_type_object,
-        .object = new_compiled_func_object(file->funcs),
-    };
-    return vglobal;
+// The builtin compiler is loaded once per isolate, since its constants
+// are objects of the isolate.
+static value_t get_compiler(void) {
+    toy_isolate_t *isolate = current_isolate;
+    if (v_is_null(isolate->compiler)) {
+        compiled_file_t *file = get_builtin_file();
+        isolate->builtin_file = file;
+        value_t vglobal = {
+            .type = value_type_object,
+            .object = new_compiled_func_object(file->funcs[0]),
+        };
+        value_t compiler = import_nodejs_module(vglobal, get_global_scope());
+        if (!v_is_func(compiler)) {
+            die("the builtin compiler module must export a function");
+        }
+        v_inc_ref(compiler);
+        isolate->compiler = compiler;
+    }
+    return isolate->compiler;
 }
 
-static value_t import_builtin_compiler_module(void) {
-    return import_nodejs_module(get_builtin_file_func(), get_global_scope());
+// The line table is a flat list, see `addLine` in `compile.js`.
+static uint32_t *translate_lines(value_t vlines, size_t *count) {
+    size_t length = v_is_null(vlines) ? 0 : v_list_length(vlines);
+    uint32_t *lines = xmalloc(sizeof(uint32_t) * (length | 1));
+    for (size_t i = 0; i < length; i++) {
+        lines[i] = v_to_integer(v_get(vlines, v_integer(i)));
+    }
+    *count = length / 2;
+    return lines;
 }
 
 static compiled_func_t translate_compiled_func(value_t vfunc) {
+    char *param_name = v_to_string(v_get(vfunc, v_string("paramName")));
+    char *name = v_to_string(v_get(vfunc, v_string("name")));
+
+    value_t vlazy = v_get(vfunc, v_string("lazy"));
+    if (!v_is_null(vlazy)) {
+        return (compiled_func_t){
+            .param_name = param_name,
+            .name = name,
+            .source_begin = v_to_integer(v_get(vlazy, v_string("begin"))),
+            .source_end = v_to_integer(v_get(vlazy, v_string("end"))),
+            .source_line = v_to_integer(v_get(vlazy, v_string("line"))),
+        };
+    }
+
     value_t vcode = v_get(vfunc, v_string("code"));
     value_t vconsts = v_get(vfunc, v_string("consts"));
     size_t code_length = v_list_length(vcode);
@@ -79,11 +352,11 @@ static compiled_func_t translate_compiled_func(value_t vfunc) {
     value_t *consts = xmalloc(sizeof(value_t) * const_count);
 
     for (size_t i = 0; i < const_count; i++) {
-        consts[i] = v_get(vconsts, v_number(i));
+        consts[i] = v_get(vconsts, v_integer(i));
     }
 
     for (size_t i = 0; i < code_length; i++) {
-        value_t vinstr = v_get(vcode, v_number(i));
+        value_t vinstr = v_get(vcode, v_integer(i));
         if (v_is_string(vinstr)) {
             int opcode = string_to_opcode(vinstr.object->string);
             if (opcode == -1) {
@@ -95,51 +368,143 @@ static compiled_func_t translate_compiled_func(value_t vfunc) {
         }
     }
 
+    size_t line_count;
+    uint32_t *lines = translate_lines(v_get(vfunc, v_string("lines")),
+                                      &line_count);
+
     return (compiled_func_t){
-        .param_name = v_to_string(v_get(vfunc, v_string("paramName"))),
+        .param_name = param_name,
+        .name = name,
+        .lines = lines,
+        .line_count = line_count,
         .code = code,
+        .code_length = code_length,
         .consts = consts,
         .const_count = const_count,
+        .register_count = v_to_integer(
+            v_get(vfunc, v_string("registerCount"))),
     };
 }
 
+// Appends the functions of the given list, from the index `first`.
+static void append_compiled_funcs(compiled_file_t *file, value_t vfuncs,
+                                  size_t first) {
+    size_t count = v_list_length(vfuncs);
+    if (count <= first) {
+        return;
+    }
+    size_t new_count = file->func_count + count - first;
+    file->funcs = xrealloc(file->funcs, sizeof(compiled_func_t *) * new_count);
+    for (size_t i = first; i < count; i++) {
+        value_t vfunc = v_get(vfuncs, v_integer(i));
+        compiled_func_t *func = xmalloc(sizeof(compiled_func_t));
+        *func = translate_compiled_func(vfunc);
+        func->file = file;
+        file->funcs[file->func_count++] = func;
+    }
+    // After the loop, since the functions load the ones which follow them
+    for (size_t i = new_count - (count - first); i < new_count; i++) {
+        verify_func(file->funcs[i]);
+    }
+}
+
 static compiled_file_t *translate_compiled_file(value_t vfuncs) {
     compiled_file_t *file = xmalloc(sizeof(compiled_file_t));
-    file->func_count = v_list_length(vfuncs);
-    file->funcs = xmalloc(sizeof(compiled_func_t) * file->func_count);
-    for (size_t i = 0; i < file->func_count; i++) {
-        value_t vfunc = v_get(vfuncs, v_number(i));
-        compiled_func_t func = translate_compiled_func(vfunc);
-        func.file = file;
-        memcpy(file->funcs + i, &func, sizeof(compiled_func_t));
-    }
+    *file = (compiled_file_t){
+        .funcs = 0,
+        .func_count = 0,
+        .source = v_null,
+        .compiler = v_null,
+    };
+    append_compiled_funcs(file, vfuncs, 0);
     return file;
 }
 
-static void free_compiled_file(compiled_file_t *file) {
+void free_compiled_file(compiled_file_t *file) {
     for (size_t i = 0; i < file->func_count; i++) {
-        compiled_func_t *func = file->funcs + i;
+        compiled_func_t *func = file->funcs[i];
+        jit_free(func);
         free(func->code);
         free(func->consts);
         free(func->param_name);
+        free(func->name);
+        free(func->lines);
+        free(func);
     }
+    v_dec_ref(file->source);
+    v_dec_ref(file->compiler);
     free(file->funcs);
     free(file);
 }
 
-value_t eval_source(const char *source) {
-    value_t compile_func = import_builtin_compiler_module();
-    if (!v_is_func(compile_func)) {
-        die("the builtin compiler module must export a function");
+// `TOY_VM=register` selects the register-based code (see `compile.js`)
+// for the evaluated files. The builtin compiler is always stack-based.
+static int use_register_vm(void) {
+    const char *vm = getenv("TOY_VM");
+    return vm && strcmp(vm, "register") == 0;
+}
+
+// Lazy functions are compiled on their first call. Their nested functions
+// are appended to the file, as lazy functions too.
+void compile_lazily(compiled_func_t *func) {
+    compiled_file_t *file = func->file;
+    if (v_is_null(file->compiler)) {
+        die("compile_lazily(): no compiler");
     }
 
-    value_t compiled_funcs = call_func(compile_func, v_string(source));
-    compiled_file_t *file = translate_compiled_file(compiled_funcs);
+    value_t request = v_dict();
+    v_set(request, v_string("source"), file->source);
+    v_set(request, v_string("lazy"), v_number(1));
+    v_set(request, v_string("begin"), v_number(func->source_begin));
+    v_set(request, v_string("end"), v_number(func->source_end));
+    v_set(request, v_string("line"), v_number(func->source_line));
+    v_set(request, v_string("base"), v_number(file->func_count));
+    v_set(request, v_string("registers"), v_number(use_register_vm()));
+    value_t vfuncs = call_func(file->compiler, request);
+
+    compiled_func_t compiled = translate_compiled_func(
+        v_get(vfuncs, v_integer(0)));
+    func->code = compiled.code;
+    func->code_length = compiled.code_length;
+    func->consts = compiled.consts;
+    func->const_count = compiled.const_count;
+    func->register_count = compiled.register_count;
+    func->lines = compiled.lines;
+    func->line_count = compiled.line_count;
+    free(compiled.param_name);
+    free(compiled.name); // The function has been named with its parent
+    append_compiled_funcs(file, vfuncs, 1);
+    verify_func(func);
+}
+
+// Evaluates the entrypoint of the file in a new global scope.
+value_t eval_compiled_file(compiled_file_t *file) {
     value_t func = {
         .type = value_type_object,
-        .object = new_compiled_func_object(file->funcs),
+        .object = new_compiled_func_object(file->funcs[0]),
     };
     value_t result = eval_func(func, get_global_scope());
+    v_inc_ref(result);
+    run_green_threads();
+    v_dec_ref(result);
+    return result;
+}
+
+value_t eval_source(const char *source) {
+    value_t compile_func = get_compiler();
+    value_t request = v_dict();
+    value_t vsource = v_string(source);
+    v_set(request, v_string("source"), vsource);
+    v_set(request, v_string("lazy"), v_number(1));
+    v_set(request, v_string("registers"), v_number(use_register_vm()));
+    value_t compiled_funcs = call_func(compile_func, request);
+    compiled_file_t *file = translate_compiled_file(compiled_funcs);
+    file->source = vsource;
+    file->compiler = compile_func;
+    v_inc_ref(file->source);
+    v_inc_ref(file->compiler);
+
+    value_t result = eval_compiled_file(file);
     free_compiled_file(file);
     collect_garbage();
     return result;
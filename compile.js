@@ -35,177 +35,268 @@ var keywords = [
     'typeof', 'var', 'while'
 ];
 
-var getLineNumberAtIndex = function (arg) {
-    var lines = 1;
-    var i = 0;
-    while (i < arg.source.length && i < arg.index) {
-        if (arg.source[i] === '\n') {
-            lines = lines + 1;
-        }
-        i = i + 1;
-    }
-    return lines;
-};
+// Longest ones first.
+var punctuators = [
+    '===', '!==', '<=', '>=', '&&', '||',
+    '(', ')', '{', '}', '[', ']', ',', ';', ':', '.', '=',
+    '+', '-', '*', '/', '%', '<', '>', '!'
+];
 
-// Returns a list of statements (they are AST nodes).
-var parse = function (source) {
-    var index = 0; // Don't set directly. Use setIndex().
-    var farthestIndex = 0; // Only used for error management.
+var stringEscapeTable = {
+    n: '\n', t: '\t', r: '\r', '\'': '\'', '\\': '\\',
+};
 
-    // Most of the following parsing functions return a falsy value on
-    // failure, or the read substring on success.
+// Splits the source into a list of tokens, in a single pass. Each token
+// has a `type` (`identifier`, `keyword`, `punctuator`, `number`, `string`
+// or `eof`), the `index` and the `line` where it begins, and either a
+// `string` (the identifier, keyword or punctuator itself) or a `value`.
+//
+// Only the part of the `source` between the indices `begin` and `end` is
+// read. `line` is the line number at `begin`.
+var lex = function (arg) {
+    var source = arg.source;
+    var tokens = [];
+    var index = arg.begin;
+    var line = arg.line;
+
+    var syntaxError = function () {
+        die('syntax error (line ' + line + ')');
+    };
 
-    var setIndex = function (newIndex) {
-        index = newIndex;
-        if (index > farthestIndex) {
-            farthestIndex = index;
+    var skipWhitespace = function () {
+        while (1) {
+            var c = source[index];
+            if (c === '/' && source[index + 1] === '/') {
+                while (source[index] && source[index] !== '\n') {
+                    index = index + 1;
+                }
+                c = source[index];
+            }
+            if (!isWhitespace(c)) {
+                return;
+            }
+            if (c === '\n') {
+                line = line + 1;
+            }
+            index = index + 1;
         }
     };
 
-    // Tries to read the given string.
-    var read = function (expected) {
-        // TODO: String#slice() is slow and performance matters here.
-        if (source.slice(index).indexOf(expected) === 0) {
-            setIndex(index + expected.length);
-            return expected;
+    var startsWith = function (expected) {
+        var i = 0;
+        while (i < expected.length) {
+            if (source[index + i] !== expected[i]) {
+                return 0;
+            }
+            i = i + 1;
         }
+        return 1;
     };
 
-    // Tries to read one character that matches the given predicate.
-    var readCharIf = function (predicate) {
+    var word = function (token) {
+        var string = '';
         var c = source[index];
-        if (predicate(c)) {
-            setIndex(index + 1);
-            return c;
+        while (isLetter(c) || isDigit(c) || c === '_') {
+            string = string + c;
+            index = index + 1;
+            c = source[index];
+        }
+        token.string = string;
+        token.type = 'identifier';
+        if (keywords.indexOf(string) !== -1) {
+            token.type = 'keyword';
         }
-    };
-
-    // Pretty obvious. See how it is used below.
-    var backtrack = function (func) {
-        return function (arg) {
-            var begin = index;
-            var result = func(arg);
-            if (result) {
-                return result;
-            }
-            index = begin;
-        };
-    };
-
-    var createToken = function (token) {
-        token.index = index;
         return token;
     };
 
-    var digit = function () {
-        return readCharIf(isDigit);
-    };
-    var letter = function () {
-        return readCharIf(isLetter);
-    };
-    var whitespace = function () {
-        // That's bit hackish for performance reasons.
-        while (1) {
-            if (source[index] === '/' && source[index + 1] === '/') {
-                setIndex(index + 2);
-                while (readCharIf(function (c) {return c !== '\n';})) {}
-            }
-            if (!readCharIf(isWhitespace)) {
-                return 1;
-            }
+    var number = function (token) {
+        var string = '';
+        while (isDigit(source[index])) {
+            string = string + source[index];
+            index = index + 1;
         }
+        token.type = 'number';
+        token.value = parseInt(string);
+        return token;
     };
 
-    var stringEscapeTable = {
-        n: '\n', t: '\t', r: '\r', '\'': '\'', '\\': '\\',
-    };
-    var string = backtrack(function () {
-        whitespace();
-        var quote = read('\'');
-        if (!quote) {
-            return;
-        }
-
+    var string = function (token) {
         var value = '';
+        index = index + 1;
         while (1) {
             var c = source[index];
-            setIndex(index + 1);
+            index = index + 1;
             if (!c) {
-                return;
+                syntaxError();
             }
             if (c === '\'') {
-                return createToken({type: 'string', value});
+                token.type = 'string';
+                token.value = value;
+                return token;
             }
             if (c === '\\') {
                 var d = source[index];
-                setIndex(index + 1);
+                index = index + 1;
                 if (!(d in stringEscapeTable)) {
-                    return;
+                    syntaxError();
                 }
                 value = value + stringEscapeTable[d];
             }
             if (c !== '\\') {
+                if (c === '\n') {
+                    line = line + 1;
+                }
                 value = value + c;
             }
         }
-    });
+    };
 
-    var identifierish = backtrack(function () {
-        whitespace();
-        var string = letter() || read('_');
-        if (!string) {
-            return;
-        }
-        while (1) {
-            var c = digit() || letter() || read('_');
-            if (!c) {
-                return string;
+    var punctuator = function (token) {
+        var i = 0;
+        while (i < punctuators.length) {
+            if (startsWith(punctuators[i])) {
+                token.type = 'punctuator';
+                token.string = punctuators[i];
+                index = index + punctuators[i].length;
+                return token;
             }
-            string = string + c;
+            i = i + 1;
         }
-    });
+        syntaxError();
+    };
 
-    var identifier = backtrack(function () {
-        var string = identifierish();
-        if (string && keywords.indexOf(string) === -1) {
-            return createToken({type: 'identifier', string});
+    var next = function () {
+        skipWhitespace();
+        var token = {index, line};
+        var c = source[index];
+        if (!c || index >= arg.end) {
+            token.type = 'eof';
+            return token;
         }
-    });
+        if (isLetter(c) || c === '_') {
+            return word(token);
+        }
+        if (isDigit(c)) {
+            return number(token);
+        }
+        if (c === '\'') {
+            return string(token);
+        }
+        return punctuator(token);
+    };
 
-    var number = backtrack(function () {
-        whitespace();
-        var string = digit();
-        if (!string) {
-            return;
+    while (1) {
+        var token = next();
+        tokens.push(token);
+        if (token.type === 'eof') {
+            return tokens;
         }
-        while (1) {
-            var c = digit();
-            if (!c) {
-                return createToken({
-                    type: 'number',
-                    value: parseInt(string)
-                });
-            }
-            string = string + c;
+    }
+};
+
+// Toy has a native `tokenize` builtin, which is way faster than `lex`.
+// Node.js does not.
+var tokenizeSource = function (arg) {
+    if (typeof tokenize === 'function') {
+        return tokenize(arg);
+    }
+    return lex(arg);
+};
+
+// Returns a list of statements (they are AST nodes). The argument has the
+// properties of the argument of `lex`, and:
+// - `lazy`: if truthy, the bodies of nested functions are only checked for
+//   syntax errors. Their nodes get a `lazy` property instead of children,
+//   with the location of the function in the source. See `module.exports`.
+// - `isFunction`: if truthy, the source must be a function expression,
+//   whose body is parsed even in lazy mode. Its node is the only item of
+//   the returned list.
+var parse = function (arg) {
+    var tokens = tokenizeSource(arg);
+    var position = 0; // Index of the next token
+    var farthest = 0; // Only used for error management.
+    var functionDepth = 1; // The whole file is a function.
+    if (arg.isFunction) {
+        functionDepth = 0;
+    }
+
+    // Most of the following parsing functions return a falsy value on
+    // failure, or the read token or AST node on success.
+
+    var next = function () {
+        position = position + 1;
+        if (position > farthest) {
+            farthest = position;
         }
-    });
+        return tokens[position - 1];
+    };
 
-    var keyword = backtrack(function () {
-        var string = identifierish();
-        if (string && keywords.indexOf(string) !== -1) {
-            return string;
+    // Tries to read a token of the given type.
+    var readType = function (type) {
+        if (tokens[position].type === type) {
+            return next();
         }
-    });
+    };
 
-    var thisKeyword = backtrack(function (expected) {
-        var string = keyword();
-        if (string === expected) {
-            return string;
+    // Tries to read the given punctuator or keyword.
+    var read = function (expected) {
+        var token = tokens[position];
+        if (token.string === expected &&
+            (token.type === 'punctuator' || token.type === 'keyword')) {
+            next();
+            return expected;
         }
-    });
+    };
+
+    // Pretty obvious. See how it is used below.
+    var backtrack = function (func) {
+        return function (arg) {
+            var begin = position;
+            var result = func(arg);
+            if (result) {
+                return result;
+            }
+            position = begin;
+        };
+    };
+
+    // Packrat parsing: like `backtrack`, but the result is computed only
+    // once for a given position and stored in the `memo` of the token.
+    // This keeps the parsing time linear. The rule must not take any
+    // argument.
+    var memoize = function (arg) {
+        var name = arg[0];
+        var rule = backtrack(arg[1]);
+        return function () {
+            var token = tokens[position];
+            if (!token.memo) {
+                token.memo = {};
+            }
+            var memo = token.memo;
+            if (name in memo) {
+                position = memo[name].end;
+                return memo[name].result;
+            }
+            var result = rule();
+            memo[name] = {result, end: position};
+            return result;
+        };
+    };
+
+    var identifier = function () {
+        return readType('identifier');
+    };
+
+    var number = function () {
+        return readType('number');
+    };
+
+    var string = function () {
+        return readType('string');
+    };
 
     var nullExpr = function () {
-        return thisKeyword('null') && {type: 'null'};
+        return read('null') && {type: 'null'};
     };
 
     var literal = function () {
@@ -214,12 +305,10 @@ var parse = function (source) {
 
     // Used to parse parentheses, braces or square brackets.
     var wrapped = backtrack(function (arg) {
-        whitespace();
         if (!read(arg.left)) {
             return;
         }
         var e = arg.body();
-        whitespace();
         if (read(arg.right)) {
             return e;
         }
@@ -248,7 +337,7 @@ var parse = function (source) {
     };
 
     var statements = function () {
-        return sequence({item: statement, sep: whitespace});
+        return sequence({item: statement, sep: function () {return 1;}});
     };
 
     var block = function () {
@@ -274,13 +363,11 @@ var parse = function (source) {
     };
 
     var dictEntry = backtrack(function () {
-        var left = identifier() || string();
-        if (!left) {
+        var key = identifier() || string();
+        if (!key) {
             return;
         }
-        left.type = 'string';
-        left.value = left.string || left.value;
-        whitespace();
+        var left = {type: 'string', value: key.string || key.value};
         if (!read(':')) {
             var right = {
                 type: 'identifier',
@@ -310,7 +397,6 @@ var parse = function (source) {
     };
 
     var postfixDot = backtrack(function () {
-        whitespace();
         return read('.') && identifier();
     });
 
@@ -332,7 +418,10 @@ var parse = function (source) {
         return;
     };
 
-    var postfix = function () {
+    // The left operand of assignments is parsed as a postfix expression.
+    // Without memoization, it would be parsed twice when there is no
+    // assignment.
+    var postfix = memoize(['postfix', function () {
         var left = atom();
         while (left) {
             var n = postfixRight(left);
@@ -342,10 +431,10 @@ var parse = function (source) {
             left = n;
         }
         return left;
-    };
+    }]);
 
     var whileStatement = backtrack(function () {
-        if (!thisKeyword('while')) {
+        if (!read('while')) {
             return;
         }
         var cond = paren();
@@ -356,7 +445,7 @@ var parse = function (source) {
     });
 
     var ifStatement = backtrack(function () {
-        if (!thisKeyword('if')) {
+        if (!read('if')) {
             return;
         }
         var cond = paren();
@@ -367,11 +456,10 @@ var parse = function (source) {
     });
 
     var varExpr = backtrack(function () {
-        if (!thisKeyword('var')) {
+        if (!read('var')) {
             return;
         }
         var name = identifier();
-        whitespace();
         var eq = read('=');
         var value = expr();
         if (name && eq && value) {
@@ -380,7 +468,7 @@ var parse = function (source) {
     });
 
     var returnExpr = backtrack(function () {
-        if (!thisKeyword('return')) {
+        if (!read('return')) {
             return;
         }
         return {
@@ -389,17 +477,45 @@ var parse = function (source) {
         };
     });
 
+    // Parses a block but drops its nodes, so that its syntax errors are
+    // reported now. Returns the index of its end in the source.
+    var skipBlock = function () {
+        if (block()) {
+            return tokens[position - 1].index + 1;
+        }
+    };
+
     var func = backtrack(function () {
-        if (!thisKeyword('function')) {
+        var keyword = tokens[position];
+        if (!read('function')) {
             return;
         }
         var optionalId = function () {
             return identifier() || {type: 'null'};
         };
         var param = wrapped({left: '(', body: optionalId, right: ')'});
+        if (!param) {
+            return;
+        }
+        if (arg.lazy && functionDepth) {
+            var end = skipBlock();
+            if (end) {
+                var lazy = {begin: keyword.index, end, line: keyword.line};
+                return {
+                    type: 'function',
+                    param,
+                    children: [],
+                    lazy,
+                    line: keyword.line,
+                };
+            }
+            return;
+        }
+        functionDepth = functionDepth + 1;
         var b = block();
-        if (param && b) {
-            return {type: 'function', param, children: b};
+        functionDepth = functionDepth - 1;
+        if (b) {
+            return {type: 'function', param, children: b, line: keyword.line};
         }
     });
 
@@ -415,6 +531,9 @@ var parse = function (source) {
                     return left;
                 }
                 var right = arg.next();
+                if (!right) {
+                    return;
+                }
                 left = {type: 'binaryOp', left, op, right};
             }
             return left;
@@ -425,7 +544,6 @@ var parse = function (source) {
         return function (next) {
             var parseOp = function () {
                 var i = 0;
-                whitespace();
                 while (i < opStrings.length) {
                     var op = read(opStrings[i]);
                     if (op) {
@@ -440,8 +558,7 @@ var parse = function (source) {
     };
 
     var unary = backtrack(function () {
-        whitespace();
-        var op = read('-') || read('!') || thisKeyword('typeof');
+        var op = read('-') || read('!') || read('typeof');
         var right = postfix();
         if (op && right) {
             return {type: 'unaryOp', op, right};
@@ -458,7 +575,6 @@ var parse = function (source) {
 
     var assignment_ = backtrack(function () {
         var left = postfix();
-        whitespace();
         if (!left || !read('=')) {
             return;
         }
@@ -477,30 +593,290 @@ var parse = function (source) {
 
     var exprStatement = backtrack(function () {
         var e = expr();
-        whitespace();
         if (read(';')) {
             return e;
         }
     });
 
+    // Statements have the `line` where they begin, for the line tables
+    // of the compiled functions.
     var statement = function () {
-        return whileStatement() || ifStatement() || exprStatement();
+        var line = tokens[position].line;
+        var s = whileStatement() || ifStatement() || exprStatement();
+        if (s) {
+            s.line = line;
+        }
+        return s;
     };
 
-    var result = statements();
-    whitespace();
-    if (!result || index < source.length) {
-        if (index > farthestIndex) {
-            farthestIndex = index;
-        }
-        var line = getLineNumberAtIndex({source, index: farthestIndex});
-        die('syntax error (line ' + line + ')');
+    var result = null;
+    if (arg.isFunction) {
+        var f = func();
+        result = f && [f];
+    }
+    if (!arg.isFunction) {
+        result = statements();
+    }
+    if (!result || tokens[position].type !== 'eof') {
+        die('syntax error (line ' + tokens[farthest].line + ')');
     }
     return result;
 };
 
 
 
+//////////////////////////////////////////////////////// CONSTANT FOLDING
+
+
+
+// Everything here follows the semantics of the VM (see `value.c`), which
+// are not always the ones of JavaScript.
+
+var isConstant = function (node) {
+    return node.type === 'number' || node.type === 'string' ||
+        node.type === 'null';
+};
+
+var constantToBool = function (node) {
+    if (node.type === 'number') {
+        return node.value !== 0;
+    }
+    if (node.type === 'string') {
+        return node.value.length !== 0;
+    }
+    return 0;
+};
+
+var numberNode = function (value) {
+    return {type: 'number', value};
+};
+
+var boolNode = function (value) {
+    if (value) {
+        return numberNode(1);
+    }
+    return numberNode(0);
+};
+
+var isSafeInteger = function (n) {
+    return -9007199254740991 <= n && n <= 9007199254740991 &&
+        Math.floor(n) === n;
+};
+
+// Returns the folded node, or a falsy value if the operation must be left
+// to the VM.
+var foldNumbers = function (node) {
+    var a = node.left.value;
+    var b = node.right.value;
+    var op = node.op;
+    if (!isSafeInteger(a) || !isSafeInteger(b)) {
+        return;
+    }
+    var result = null;
+    if (op === '+') {
+        result = a + b;
+    }
+    if (op === '-') {
+        result = a - b;
+    }
+    if (op === '*') {
+        result = a * b;
+    }
+    // Only exact divisions, fractions would be printed differently.
+    if (op === '/' && b !== 0 && a % b === 0) {
+        result = a / b;
+    }
+    if (op === '%' && b !== 0) {
+        result = a % b;
+    }
+    if (result !== null && isSafeInteger(result)) {
+        return numberNode(result);
+    }
+
+    if (op === '<') {
+        return boolNode(a < b);
+    }
+    if (op === '>') {
+        return boolNode(a > b);
+    }
+    if (op === '<=') {
+        return boolNode(a <= b);
+    }
+    if (op === '>=') {
+        return boolNode(a >= b);
+    }
+};
+
+var constantsEqual = function (arg) {
+    var a = arg[0];
+    var b = arg[1];
+    return a.type === b.type && (a.type === 'null' || a.value === b.value);
+};
+
+var foldBinaryOp = function (node) {
+    var left = node.left;
+    var right = node.right;
+
+    if (node.op === '&&' && isConstant(left)) {
+        if (constantToBool(left)) {
+            return right;
+        }
+        return left;
+    }
+    if (node.op === '||' && isConstant(left)) {
+        if (constantToBool(left)) {
+            return left;
+        }
+        return right;
+    }
+
+    if (!isConstant(left) || !isConstant(right)) {
+        return node;
+    }
+    if (node.op === '===') {
+        return boolNode(constantsEqual([left, right]));
+    }
+    if (node.op === '!==') {
+        return boolNode(!constantsEqual([left, right]));
+    }
+    if (left.type === 'number' && right.type === 'number') {
+        return foldNumbers(node) || node;
+    }
+    if (left.type === 'string' && right.type === 'string' &&
+        node.op === '+') {
+        return {type: 'string', value: left.value + right.value};
+    }
+    return node;
+};
+
+var foldUnaryOp = function (node) {
+    var right = node.right;
+    if (!isConstant(right)) {
+        return node;
+    }
+    if (node.op === '-' && right.type === 'number') {
+        return numberNode(-right.value);
+    }
+    if (node.op === '!') {
+        return boolNode(!constantToBool(right));
+    }
+    if (node.op === 'typeof') {
+        return {type: 'string', value: right.type};
+    }
+    return node;
+};
+
+// Returns the folded expression. Function bodies are folded in place.
+var foldExpr = function (node) {
+    if (node.type === 'binaryOp') {
+        node.left = foldExpr(node.left);
+        node.right = foldExpr(node.right);
+        return foldBinaryOp(node);
+    }
+
+    if (node.type === 'unaryOp') {
+        node.right = foldExpr(node.right);
+        return foldUnaryOp(node);
+    }
+
+    if (node.type === 'subscript') {
+        node.left = foldExpr(node.left);
+        node.right = foldExpr(node.right);
+        return node;
+    }
+
+    if (node.type === 'assignment') {
+        node.left = foldExpr(node.left);
+        node.right = foldExpr(node.right);
+        return node;
+    }
+
+    if (node.type === 'list') {
+        node.children = foldExprList(node.children);
+        return node;
+    }
+
+    if (node.type === 'dict') {
+        var i = 0;
+        while (i < node.children.length) {
+            var entry = node.children[i];
+            entry.right = foldExpr(entry.right);
+            i = i + 1;
+        }
+        return node;
+    }
+
+    if (node.type === 'function') {
+        node.children = foldStatements(node.children);
+        return node;
+    }
+
+    return node;
+};
+
+var foldExprList = function (list) {
+    var folded = [];
+    var i = 0;
+    while (i < list.length) {
+        folded.push(foldExpr(list[i]));
+        i = i + 1;
+    }
+    return folded;
+};
+
+// Returns a list of statements, since statements can disappear or be
+// replaced by the body of an `if`.
+var foldStatement = function (node) {
+    if (node.type === 'if' || node.type === 'while') {
+        node.cond = foldExpr(node.cond);
+        node.children = foldStatements(node.children);
+        if (!isConstant(node.cond)) {
+            return [node];
+        }
+        if (!constantToBool(node.cond)) {
+            return [];
+        }
+        if (node.type === 'if') {
+            return node.children; // Blocks have no scope of their own.
+        }
+        return [node]; // See `compileStatement`.
+    }
+
+    if (node.type === 'var' || node.type === 'return') {
+        node.value = foldExpr(node.value);
+        return [node];
+    }
+
+    var expr = foldExpr(node);
+    if (isConstant(expr)) {
+        return []; // For instance `'use strict';`
+    }
+    expr.line = node.line;
+    return [expr];
+};
+
+// Folds a list of statements. Statements following a `return` are
+// removed.
+var foldStatements = function (statements) {
+    var folded = [];
+    var i = 0;
+    while (i < statements.length) {
+        var list = foldStatement(statements[i]);
+        var j = 0;
+        while (j < list.length) {
+            folded.push(list[j]);
+            if (list[j].type === 'return') {
+                return folded;
+            }
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+    return folded;
+};
+
+
+
 //////////////////////////////////////////////////// BYTECODE GENERATION
 
 
@@ -518,16 +894,35 @@ var unarySignsToNames = {
     'typeof': 'typeof'
 };
 
+var toUint16 = function (n) {
+    return [Math.floor(n / 256), n % 256]; // big endian
+};
+
+// Appends an entry to a line table, which is a flat list of pairs of a
+// code offset and the source line of the code from that offset.
+var addLine = function (arg) {
+    var lines = arg.lines;
+    var length = lines.length;
+    if (!arg.line || (length && lines[length - 1] === arg.line)) {
+        return;
+    }
+    if (length && lines[length - 2] === arg.offset) {
+        lines[length - 1] = arg.line;
+        return;
+    }
+    lines.push(arg.offset);
+    lines.push(arg.line);
+};
+
 var compileFunctionBody = function (statements) {
     var code = [];
     var consts = [];
+    var lines = [];
 
-    var toUint16 = function (n) {
-        return [Math.floor(n / 256), n % 256]; // big endian
-    };
-
+    // The operands may exceed 65535 here, see `encodeInstructions`.
     var genUint16 = function (n) {
-        code = code.concat(toUint16(n));
+        code.push(toUint16(n)[0]);
+        code.push(toUint16(n)[1]);
     };
 
     var setUint16At = function (arg) {
@@ -658,6 +1053,7 @@ var compileFunctionBody = function (statements) {
     };
 
     var compileStatement = function (expr) {
+        addLine({lines, offset: code.length, line: expr.line});
         if (expr.type === 'var') {
             genLoadConst(expr.name.string);
             code.push('dup');
@@ -676,15 +1072,21 @@ var compileFunctionBody = function (statements) {
         if (expr.type === 'while') {
             // This is what people call "spaghetty code".
             var beginLabel = code.length;
-            compileExpr(expr.cond);
-            code.push('not');
-            code.push('goto_if');
-            var breakLabel = code.length;
-            genUint16(0);
+            // `while (1)` needs no test.
+            var infinite = isConstant(expr.cond) && constantToBool(expr.cond);
+            if (!infinite) {
+                compileExpr(expr.cond);
+                code.push('not');
+                code.push('goto_if');
+                var breakLabel = code.length;
+                genUint16(0);
+            }
             compileStatements(expr.children);
             code.push('goto');
             genUint16(beginLabel);
-            setUint16At([code.length, breakLabel]);
+            if (!infinite) {
+                setUint16At([code.length, breakLabel]);
+            }
             return;
         }
 
@@ -716,16 +1118,36 @@ var compileFunctionBody = function (statements) {
     code.push('load_null');
     code.push('return');
 
-    return {consts, code};
+    var optimized = optimize([code, lines]);
+    return {consts, code: optimized.code, lines: optimized.lines};
+};
+
+// Gives a name to an anonymous function, for the profiler and the
+// error messages. The argument is the node and the name.
+var nameFunction = function (arg) {
+    var node = arg[0];
+    if (node.type === 'function' && !node.name) {
+        node.name = arg[1];
+    }
 };
 
 // Returns a list of the functions present in the given AST node.
-// Performs a depth-first search.
+// Performs a depth-first search. Functions assigned to a variable or a
+// property are named after it.
 var getFunctions = function (node) {
     if (node.type === 'var') {
+        nameFunction([node.value, node.name.string]);
         return getFunctions(node.value);
     }
 
+    if (node.type === 'assignment' && node.left.type === 'identifier') {
+        nameFunction([node.right, node.left.string]);
+    }
+    if (node.type === 'assignment' && node.left.type === 'subscript' &&
+        node.left.right.type === 'string') {
+        nameFunction([node.right, node.left.right.value]);
+    }
+
     if (node.type === 'function') {
         return [node].concat(getFunctionsInList(node.children));
     }
@@ -753,6 +1175,7 @@ var getFunctions = function (node) {
     }
 
     if (node.type === 'dictEntry') {
+        nameFunction([node.right, node.left.value]);
         return getFunctions(node.right);
     }
 
@@ -771,19 +1194,19 @@ var getFunctionsInList = function (list) {
 };
 
 // Returns a list of compiled functions.
-var codegen = function (statements) {
-    var root = {
-        type: 'function',
-        children: statements,
-        param: {type: 'null'}
-    };
-
-    // Assign an unique `_id` property to each function. The first function
-    // must be the entrypoint.
+// The first compiled function is the given `root`. The `_id`s of the
+// nested functions, which are their indices in the compiled file, begin
+// at `firstId`. If `registers` is truthy, the register-based code is
+// generated. `isFunction` is set when `root` is a lazy function, which
+// has already been named.
+var codegen = function (arg) {
+    var root = foldExpr(arg.root);
+
+    // Assign an unique `_id` property to each nested function.
     var functions = getFunctions(root);
-    var i = 0;
+    var i = 1;
     while (i < functions.length) {
-        functions[i]._id = i;
+        functions[i]._id = arg.firstId + i - 1;
         i = i + 1;
     }
 
@@ -791,10 +1214,20 @@ var codegen = function (statements) {
     i = 0;
     while (i < functions.length) {
         var func = functions[i];
-        var compiled = compileFunctionBody(func.children);
+        var compiled = {lazy: func.lazy};
+        if (!func.lazy && arg.registers) {
+            compiled = compileRegisterFunctionBody(func);
+        }
+        if (!func.lazy && (!arg.registers || !compiled)) {
+            compiled = compileFunctionBody(func.children);
+        }
         if (func.param.type !== 'null') {
             compiled.paramName = func.param.string;
         }
+        compiled.name = func.name || 'anonymous';
+        if (!i && !arg.isFunction) {
+            compiled.name = 'main'; // The whole file
+        }
         compiledFuncs.push(compiled);
         i = i + 1;
     }
@@ -802,6 +1235,887 @@ var codegen = function (statements) {
 };
 
 
-module.exports = function (source) {
-    return codegen(parse(source));
+
+//////////////////////////////////////////////////// BYTECODE OPTIMIZATION
+
+
+
+// Number of operand bytes following each opcode. Absent means zero.
+// The operands above 65535 take an `extended_arg` prefix, which holds
+// their high 16 bits (see `encodeInstructions`).
+var operandSizes = {
+    extended_arg: 2,
+    load_const: 2, load_func: 2,
+    load_var_const: 2, store_var_const: 2, decl_var_const: 2, get_const: 2,
+    goto: 2, goto_if: 2, goto_unless: 2,
+    goto_if_or_pop: 2, goto_unless_or_pop: 2,
+    goto_unless_eq: 2, goto_unless_neq: 2,
+    goto_unless_lt: 2, goto_unless_gt: 2,
+    goto_unless_lte: 2, goto_unless_gte: 2,
+};
+
+var isJump = function (op) {
+    return op.indexOf('goto') === 0;
+};
+
+// Comparisons which can be fused with a following `goto_unless`.
+var comparisonOps = ['eq', 'neq', 'lt', 'gt', 'lte', 'gte'];
+
+// Opcodes which only push a value. They can be dropped if the value
+// is popped right away.
+var pureLoadOps = ['load_const', 'load_null', 'load_func', 'dup'];
+
+// Turns bytecode into a list of instructions. The operand of a jump is
+// replaced by a `target` property, which is the targeted instruction.
+// The argument is the code and its line table. Each instruction gets its
+// `line`.
+var decodeInstructions = function (arg) {
+    var code = arg[0];
+    var lines = arg[1];
+    var instrs = [];
+    // The index of the instruction of each byte of the code. A list,
+    // since the lookups in a large dict are slow.
+    var indexAtOffset = [];
+    var line = 0;
+    var l = 0;
+    var i = 0;
+    while (i < code.length) {
+        while (l < lines.length && lines[l] <= i) {
+            line = lines[l + 1];
+            l = l + 2;
+        }
+        var instr = {op: code[i], line};
+        if (operandSizes[instr.op]) {
+            instr.arg = code[i + 1] * 256 + code[i + 2];
+        }
+        var end = i + 1 + (operandSizes[instr.op] || 0);
+        while (indexAtOffset.length < end) {
+            indexAtOffset.push(instrs.length);
+        }
+        instrs.push(instr);
+        i = end;
+    }
+
+    i = 0;
+    while (i < instrs.length) {
+        var instr = instrs[i];
+        if (isJump(instr.op)) {
+            instr.target = instrs[indexAtOffset[instr.arg]];
+            instr.target.isTarget = 1;
+        }
+        i = i + 1;
+    }
+    return instrs;
+};
+
+// Removed or fused instructions keep a `forward` property pointing to the
+// instruction which replaces them, so jumps can still be resolved.
+var resolveTarget = function (instr) {
+    while (instr.forward) {
+        instr = instr.forward;
+    }
+    return instr;
+};
+
+// Returns the size of the encoded instruction, with its `extended_arg`
+// prefix if it has the `extended` flag.
+var instructionSize = function (instr) {
+    if (!operandSizes[instr.op]) {
+        return 1;
+    }
+    if (!instr.target && instr.arg > 65535) {
+        instr.extended = 1;
+    }
+    if (instr.extended) {
+        return 6;
+    }
+    return 3;
+};
+
+// The inverse of `decodeInstructions`. Jump targets are recomputed here.
+// Returns the code and its line table.
+var encodeInstructions = function (instrs) {
+    // The jumps beyond 65535 get a prefix, which moves the code after
+    // them. Repeated until no jump needs one more.
+    var changed = 1;
+    var i = 0;
+    while (changed) {
+        changed = 0;
+        var offset = 0;
+        i = 0;
+        while (i < instrs.length) {
+            instrs[i].offset = offset;
+            offset = offset + instructionSize(instrs[i]);
+            i = i + 1;
+        }
+        i = 0;
+        while (i < instrs.length) {
+            var instr = instrs[i];
+            if (instr.target && !instr.extended &&
+                resolveTarget(instr.target).offset > 65535) {
+                instr.extended = 1;
+                changed = 1;
+            }
+            i = i + 1;
+        }
+    }
+
+    var code = [];
+    var lines = [];
+    i = 0;
+    while (i < instrs.length) {
+        var instr = instrs[i];
+        addLine({lines, offset: instr.offset, line: instr.line});
+        var arg = instr.arg;
+        if (instr.target) {
+            arg = resolveTarget(instr.target).offset;
+        }
+        if (instr.extended) {
+            code.push('extended_arg');
+            code.push(toUint16(Math.floor(arg / 65536))[0]);
+            code.push(toUint16(Math.floor(arg / 65536))[1]);
+            arg = arg % 65536;
+        }
+        code.push(instr.op);
+        if (operandSizes[instr.op]) {
+            code.push(toUint16(arg)[0]);
+            code.push(toUint16(arg)[1]);
+        }
+        i = i + 1;
+    }
+    return {code, lines};
+};
+
+// Peephole optimization. Fuses the instruction sequences emitted by
+// `compileFunctionBody` into superinstructions and removes useless stack
+// shuffling.
+var peephole = function (instrs) {
+    var out = [];
+    var i = 0;
+
+    // Does the code at `i` start with the given opcodes? Only the first
+    // instruction of a fused sequence can be the target of a jump.
+    var at = function (ops) {
+        var j = 0;
+        while (j < ops.length) {
+            var instr = instrs[i + j];
+            if (!instr || (j && instr.isTarget)) {
+                return 0;
+            }
+            if (typeof ops[j] === 'string' && instr.op !== ops[j]) {
+                return 0;
+            }
+            if (typeof ops[j] !== 'string' &&
+                ops[j].indexOf(instr.op) === -1) {
+                return 0;
+            }
+            j = j + 1;
+        }
+        return 1;
+    };
+
+    // Replaces the `count` instructions at `i` with the given ones.
+    var replace = function (arg) {
+        var count = arg[0];
+        var replacement = arg[1];
+        var first = instrs[i];
+        first.forward = replacement[0] || instrs[i + count];
+        if (first.isTarget) {
+            first.forward.isTarget = 1;
+        }
+        var j = 0;
+        while (j < replacement.length) {
+            replacement[j].line = first.line;
+            out.push(replacement[j]);
+            j = j + 1;
+        }
+        i = i + count;
+    };
+
+    var fuse = function () {
+        var instr = instrs[i];
+        var next = instrs[i + 1];
+        var third = instrs[i + 2];
+
+        // Assignments
+        if (at(['dup', 'load_const', 'rot', 'store_var', 'pop'])) {
+            return replace([5, [{op: 'store_var_const', arg: next.arg}]]);
+        }
+        if (at(['dup', 'load_const', 'rot', 'store_var'])) {
+            return replace([4, [
+                {op: 'dup'},
+                {op: 'store_var_const', arg: next.arg}
+            ]]);
+        }
+        if (at(['load_const', 'dup', 'decl_var'])) {
+            return replace([3, [
+                {op: 'decl_var_const', arg: instr.arg},
+                {op: 'load_const', arg: instr.arg}
+            ]]);
+        }
+
+        // Loads
+        if (at(['load_const', 'load_var'])) {
+            return replace([2, [{op: 'load_var_const', arg: instr.arg}]]);
+        }
+        if (at(['load_const', 'get'])) {
+            return replace([2, [{op: 'get_const', arg: instr.arg}]]);
+        }
+        if (at([pureLoadOps, 'pop'])) {
+            return replace([2, []]);
+        }
+
+        // Branches
+        if (at(['dup', 'not', 'goto_if', 'pop'])) {
+            return replace([4, [
+                {op: 'goto_unless_or_pop', target: third.target}
+            ]]);
+        }
+        if (at(['dup', 'goto_if', 'pop'])) {
+            return replace([3, [{op: 'goto_if_or_pop', target: next.target}]]);
+        }
+        if (at([comparisonOps, 'not', 'goto_if'])) {
+            return replace([3, [
+                {op: 'goto_unless_' + instr.op, target: third.target}
+            ]]);
+        }
+        if (at(['not', 'not', 'goto_if'])) {
+            return replace([3, [{op: 'goto_if', target: third.target}]]);
+        }
+        if (at(['not', 'goto_if'])) {
+            return replace([2, [{op: 'goto_unless', target: next.target}]]);
+        }
+
+        if (at(['load_null', 'return'])) {
+            return replace([2, [{op: 'return_null'}]]);
+        }
+
+        out.push(instr);
+        i = i + 1;
+    };
+
+    while (i < instrs.length) {
+        fuse();
+    }
+    return out;
+};
+
+var isUnconditionalJump = function (op) {
+    return op === 'goto' || op === 'return' || op === 'return_null';
+};
+
+// Makes jumps to a `goto` jump directly to its target. Jumps to a return
+// instruction are replaced by that return instruction.
+var threadJumps = function (instrs) {
+    var i = 0;
+    while (i < instrs.length) {
+        var instr = instrs[i];
+        if (isJump(instr.op)) {
+            var target = resolveTarget(instr.target);
+            var hops = 0; // Because of `while (1) {}`
+            while (target.op === 'goto' && hops < instrs.length) {
+                target = resolveTarget(target.target);
+                hops = hops + 1;
+            }
+            instr.target = target;
+            if (instr.op === 'goto' && isUnconditionalJump(target.op)) {
+                instr.op = target.op;
+                instr.target = null;
+            }
+        }
+        i = i + 1;
+    }
+    return instrs;
+};
+
+// Removes the instructions that cannot be reached from the entrypoint,
+// then the `goto`s to the next instruction.
+var removeDeadCode = function (instrs) {
+    var i = 0;
+    while (i < instrs.length) {
+        instrs[i].index = i;
+        i = i + 1;
+    }
+
+    var work = [0];
+    instrs[0].reachable = 1;
+    var w = 0;
+    while (w < work.length) {
+        var instr = instrs[work[w]];
+        var successors = [];
+        if (!isUnconditionalJump(instr.op)) {
+            successors.push(instr.index + 1);
+        }
+        if (isJump(instr.op)) {
+            successors.push(resolveTarget(instr.target).index);
+        }
+        i = 0;
+        while (i < successors.length) {
+            var successor = instrs[successors[i]];
+            if (successor && !successor.reachable) {
+                successor.reachable = 1;
+                work.push(successor.index);
+            }
+            i = i + 1;
+        }
+        w = w + 1;
+    }
+
+    var reachable = [];
+    i = 0;
+    while (i < instrs.length) {
+        if (instrs[i].reachable) {
+            reachable.push(instrs[i]);
+        }
+        i = i + 1;
+    }
+
+    var out = [];
+    i = 0;
+    while (i < reachable.length) {
+        var instr = reachable[i];
+        var next = reachable[i + 1];
+        if (instr.op === 'goto' && next &&
+            resolveTarget(instr.target).index === next.index) {
+            instr.forward = next;
+        }
+        if (!instr.forward) {
+            out.push(instr);
+        }
+        i = i + 1;
+    }
+    return out;
+};
+
+// Optimizes the bytecode of a function. The argument is the code and its
+// line table, and so is the result.
+var optimize = function (arg) {
+    var instrs = peephole(decodeInstructions(arg));
+    instrs = removeDeadCode(threadJumps(instrs));
+    return encodeInstructions(instrs);
+};
+
+
+//////////////////////////////////////////////////// REGISTER-BASED BYTECODE
+
+
+
+// An alternative backend, selected with `TOY_VM=register` (see
+// `compile.c`). Its instructions (the `r_*` opcodes) take registers,
+// which are slots in the frame of the function, instead of using the
+// stack. Temporary values live in registers, and so do the variables of
+// the functions which contain no nested function, since no closure can
+// see them. Other variables still live in scopes.
+//
+// A register operand is a single byte. Constant indices, function ids
+// and jump targets take two bytes, like in the stack-based code, but
+// without `extended_arg`: the functions whose operands don't fit are
+// compiled to stack-based code instead.
+
+// Returns the names of the variables declared in the given statements,
+// nested blocks included.
+var getDeclaredNames = function (statements) {
+    var names = [];
+    var i = 0;
+    while (i < statements.length) {
+        var statement = statements[i];
+        if (statement.type === 'var') {
+            names.push(statement.name.string);
+        }
+        if (statement.type === 'while' || statement.type === 'if') {
+            names = names.concat(getDeclaredNames(statement.children));
+        }
+        i = i + 1;
+    }
+    return names;
+};
+
+// Returns the names which the given nodes may read or assign before their
+// `var` statement runs. `declared` lists the names declared before the
+// nodes. A declaration only covers the next statements of its block,
+// nested blocks included.
+var getNamesUsedBeforeDecl = function (arg) {
+    var declared = arg.declared;
+    var names = [];
+    var i = 0;
+    while (i < arg.nodes.length) {
+        var node = arg.nodes[i];
+        var children = [];
+        if (node.type === 'identifier' &&
+            declared.indexOf(node.string) === -1) {
+            names.push(node.string);
+        }
+        if (node.type === 'var') {
+            // Declared before its value is evaluated, like in the
+            // stack-based code
+            declared = declared.concat([node.name.string]);
+            children = [node.value];
+        }
+        if (node.type === 'while' || node.type === 'if') {
+            names = names.concat(getNamesUsedBeforeDecl({
+                nodes: [node.cond],
+                declared,
+            }));
+            children = node.children;
+        }
+        if (['binaryOp', 'assignment', 'subscript', 'dictEntry']
+            .indexOf(node.type) !== -1) {
+            children = [node.left, node.right];
+        }
+        if (node.type === 'unaryOp') {
+            children = [node.right];
+        }
+        if (node.type === 'return') {
+            children = [node.value];
+        }
+        if (node.type === 'list' || node.type === 'dict') {
+            children = node.children;
+        }
+        names = names.concat(getNamesUsedBeforeDecl({
+            nodes: children,
+            declared,
+        }));
+        i = i + 1;
+    }
+    return names;
+};
+
+// Returns a truthy value if the given expression contains an assignment.
+var containsAssignment = function (node) {
+    if (node.type === 'assignment') {
+        return 1;
+    }
+    if (['binaryOp', 'subscript'].indexOf(node.type) !== -1) {
+        return containsAssignment(node.left) ||
+            containsAssignment(node.right);
+    }
+    if (node.type === 'unaryOp' || node.type === 'dictEntry') {
+        return containsAssignment(node.right);
+    }
+    if (node.type === 'list' || node.type === 'dict') {
+        var i = 0;
+        while (i < node.children.length) {
+            if (containsAssignment(node.children[i])) {
+                return 1;
+            }
+            i = i + 1;
+        }
+    }
+    return 0;
+};
+
+var compileRegisterFunctionBody = function (func) {
+    var code = [];
+    var consts = [];
+    var lines = [];
+
+    // Variables stored in registers. The register of a variable is its
+    // index in this list. The variables which may be used before their
+    // declaration stay in the scope, which gives them the semantics of
+    // the stack-based code: they are looked up in the enclosing scopes,
+    // or they are undefined.
+    var localNames = [];
+    if (!getFunctionsInList(func.children).length) {
+        if (func.param.type !== 'null') {
+            localNames.push(func.param.string);
+        }
+        var usedBeforeDecl = getNamesUsedBeforeDecl({
+            nodes: func.children,
+            declared: localNames,
+        });
+        var declared = getDeclaredNames(func.children);
+        var i = 0;
+        while (i < declared.length) {
+            if (localNames.indexOf(declared[i]) === -1 &&
+                usedBeforeDecl.indexOf(declared[i]) === -1) {
+                localNames.push(declared[i]);
+            }
+            i = i + 1;
+        }
+    }
+
+    var maxFuncId = 0;
+
+    // Temporary registers are allocated like a stack, after the locals.
+    var nextRegister = localNames.length;
+    var registerCount = nextRegister;
+
+    var allocRegister = function () {
+        var register = nextRegister;
+        nextRegister = register + 1;
+        if (nextRegister > 256) {
+            die('too many registers');
+        }
+        if (nextRegister > registerCount) {
+            registerCount = nextRegister;
+        }
+        return register;
+    };
+
+    var emit = function (items) {
+        var i = 0;
+        while (i < items.length) {
+            code.push(items[i]);
+            i = i + 1;
+        }
+    };
+
+    // Returns the operand bytes of a new constant.
+    var constOperand = function (c) {
+        var index = consts.length;
+        consts.push(c);
+        return toUint16(index);
+    };
+
+    // Emits a jump instruction whose target is unknown yet. Returns the
+    // position of the target, see `setTarget`.
+    var emitJump = function (items) {
+        emit(items);
+        var label = code.length;
+        emit([0, 0]);
+        return label;
+    };
+
+    // Makes the jump at the given label target the end of the code.
+    var setTarget = function (label) {
+        code[label] = toUint16(code.length)[0];
+        code[label + 1] = toUint16(code.length)[1];
+    };
+
+    var getLocal = function (node) {
+        if (node.type !== 'identifier') {
+            return -1;
+        }
+        return localNames.indexOf(node.string);
+    };
+
+    // Returns the register holding the value of the expression. It is a
+    // new temporary unless the expression is a local variable.
+    var compileAny = function (expr) {
+        var local = getLocal(expr);
+        if (local !== -1) {
+            return local;
+        }
+        var register = allocRegister();
+        compileInto({expr, dst: register});
+        return register;
+    };
+
+    // Compiles the operands of a binary operator. The left one is copied
+    // if the right one might modify it.
+    var compileOperands = function (expr) {
+        var left = compileAny(expr.left);
+        if (getLocal(expr.left) !== -1 && containsAssignment(expr.right)) {
+            var copy = allocRegister();
+            emit(['r_move', copy, left]);
+            left = copy;
+        }
+        return [left, compileAny(expr.right)];
+    };
+
+    // Returns the register holding the assigned value.
+    var compileAssign = function (expr) {
+        var local = getLocal(expr.left);
+        if (local !== -1) {
+            compileInto({expr: expr.right, dst: local});
+            return local;
+        }
+        if (expr.left.type === 'identifier') {
+            var value = compileAny(expr.right);
+            emit(['r_store_var', value].concat(constOperand(expr.left.string)));
+            return value;
+        }
+        if (expr.left.type === 'subscript') {
+            var value = compileAny(expr.right);
+            if (getLocal(expr.right) !== -1 && containsAssignment(expr.left)) {
+                var copy = allocRegister();
+                emit(['r_move', copy, value]);
+                value = copy;
+            }
+            var dict = compileAny(expr.left.left);
+            var key = compileAny(expr.left.right);
+            emit(['r_set', dict, key, value]);
+            return value;
+        }
+        die('unknown lvalue type');
+    };
+
+    // Compiles `&&`, `||`, lists and dicts, which write `dst` before
+    // evaluating all their operands.
+    var compileBuild = function (arg) {
+        var expr = arg.expr;
+        var dst = arg.dst;
+
+        if (expr.type === 'list') {
+            emit(['r_load_empty_list', dst]);
+            var i = 0;
+            while (i < expr.children.length) {
+                var saved = nextRegister;
+                emit(['r_list_push', dst, compileAny(expr.children[i])]);
+                nextRegister = saved;
+                i = i + 1;
+            }
+            return;
+        }
+
+        if (expr.type === 'dict') {
+            emit(['r_load_empty_dict', dst]);
+            var i = 0;
+            while (i < expr.children.length) {
+                var saved = nextRegister;
+                var entry = expr.children[i];
+                var key = compileAny(entry.left);
+                emit(['r_dict_push', dst, key, compileAny(entry.right)]);
+                nextRegister = saved;
+                i = i + 1;
+            }
+            return;
+        }
+
+        compileInto({expr: expr.left, dst});
+        var jump = 'r_goto_if';
+        if (expr.op === '&&') {
+            jump = 'r_goto_unless';
+        }
+        var label = emitJump([jump, dst]);
+        compileInto({expr: expr.right, dst});
+        setTarget(label);
+    };
+
+    // Compiles an expression whose value must end up in the register
+    // `dst`. Only the last instruction writes `dst`, except when building
+    // lists, dicts, `&&` and `||`, which use a temporary if `dst` is a
+    // variable, since the variable may still be read meanwhile.
+    var compileInto = function (arg) {
+        var expr = arg.expr;
+        var dst = arg.dst;
+        var saved = nextRegister;
+
+        var isAndOr = expr.type === 'binaryOp' &&
+            (expr.op === '&&' || expr.op === '||');
+        if (isAndOr || expr.type === 'list' || expr.type === 'dict') {
+            var target = dst;
+            if (dst < localNames.length) {
+                target = allocRegister();
+            }
+            compileBuild({expr, dst: target});
+            if (target !== dst) {
+                emit(['r_move', dst, target]);
+            }
+            nextRegister = saved;
+            return;
+        }
+
+        if (expr.type === 'string' || expr.type === 'number') {
+            return emit(['r_load_const', dst].concat(constOperand(expr.value)));
+        }
+
+        if (expr.type === 'null') {
+            return emit(['r_load_null', dst]);
+        }
+
+        if (expr.type === 'function') {
+            if (expr._id > maxFuncId) {
+                maxFuncId = expr._id;
+            }
+            return emit(['r_load_func', dst].concat(toUint16(expr._id)));
+        }
+
+        if (expr.type === 'identifier') {
+            var local = getLocal(expr);
+            if (local === -1) {
+                return emit(['r_load_var', dst].concat(constOperand(expr.string)));
+            }
+            if (local !== dst) {
+                emit(['r_move', dst, local]);
+            }
+            return;
+        }
+
+        if (expr.type === 'assignment') {
+            var value = compileAssign(expr);
+            if (value !== dst) {
+                emit(['r_move', dst, value]);
+            }
+            nextRegister = saved;
+            return;
+        }
+
+        if (expr.type === 'binaryOp') {
+            if (!opSignsToNames[expr.op]) {
+                die('unknown op ' + expr.op);
+            }
+            var operands = compileOperands(expr);
+            emit(['r_' + opSignsToNames[expr.op], dst].concat(operands));
+            nextRegister = saved;
+            return;
+        }
+
+        if (expr.type === 'unaryOp') {
+            var operand = compileAny(expr.right);
+            emit(['r_' + unarySignsToNames[expr.op], dst, operand]);
+            nextRegister = saved;
+            return;
+        }
+
+        if (expr.type === 'subscript') {
+            var dict = compileAny(expr.left);
+            if (expr.right.type === 'string' || expr.right.type === 'number') {
+                emit(['r_get_const', dst, dict]
+                     .concat(constOperand(expr.right.value)));
+                nextRegister = saved;
+                return;
+            }
+            if (getLocal(expr.left) !== -1 && containsAssignment(expr.right)) {
+                var copy = allocRegister();
+                emit(['r_move', copy, dict]);
+                dict = copy;
+            }
+            emit(['r_get', dst, dict, compileAny(expr.right)]);
+            nextRegister = saved;
+            return;
+        }
+        die('unknown expr type');
+    };
+
+    // Emits a jump taken when `cond` is falsy. Returns its label, see
+    // `setTarget`.
+    var compileJumpUnless = function (cond) {
+        var saved = nextRegister;
+        var label = 0;
+        var op = opSignsToNames[cond.op];
+        if (cond.type === 'binaryOp' && comparisonOps.indexOf(op) !== -1) {
+            label = emitJump(['r_goto_unless_' + op]
+                             .concat(compileOperands(cond)));
+        }
+        if (!label && cond.type === 'unaryOp' && cond.op === '!') {
+            label = emitJump(['r_goto_if', compileAny(cond.right)]);
+        }
+        if (!label) {
+            label = emitJump(['r_goto_unless', compileAny(cond)]);
+        }
+        nextRegister = saved;
+        return label;
+    };
+
+    var compileStatement = function (statement) {
+        var saved = nextRegister;
+        addLine({lines, offset: code.length, line: statement.line});
+
+        if (statement.type === 'var') {
+            var local = getLocal(statement.name);
+            if (local !== -1) {
+                compileInto({expr: statement.value, dst: local});
+                return;
+            }
+            var name = statement.name.string;
+            emit(['r_decl_var'].concat(constOperand(name)));
+            var value = compileAny(statement.value);
+            emit(['r_store_var', value].concat(constOperand(name)));
+            nextRegister = saved;
+            return;
+        }
+
+        if (statement.type === 'return') {
+            emit(['r_return', compileAny(statement.value)]);
+            nextRegister = saved;
+            return;
+        }
+
+        if (statement.type === 'while') {
+            var beginLabel = code.length;
+            var infinite = isConstant(statement.cond) &&
+                constantToBool(statement.cond);
+            var breakLabel = 0;
+            if (!infinite) {
+                breakLabel = compileJumpUnless(statement.cond);
+            }
+            compileStatements(statement.children);
+            emit(['r_goto'].concat(toUint16(beginLabel)));
+            if (!infinite) {
+                setTarget(breakLabel);
+            }
+            return;
+        }
+
+        if (statement.type === 'if') {
+            var label = compileJumpUnless(statement.cond);
+            compileStatements(statement.children);
+            setTarget(label);
+            return;
+        }
+
+        if (statement.type === 'assignment') {
+            compileAssign(statement);
+            nextRegister = saved;
+            return;
+        }
+
+        compileAny(statement);
+        nextRegister = saved;
+    };
+
+    var compileStatements = function (statements) {
+        var i = 0;
+        while (i < statements.length) {
+            compileStatement(statements[i]);
+            i = i + 1;
+        }
+    };
+
+    // Parameters are stored in the scope by the VM.
+    if (localNames.length && func.param.type !== 'null') {
+        emit(['r_load_var', 0].concat(constOperand(func.param.string)));
+    }
+    compileStatements(func.children);
+    emit(['r_return_null']);
+
+    if (!registerCount) {
+        registerCount = 1;
+    }
+    if (consts.length > 65536 || code.length > 65536 || maxFuncId > 65535) {
+        return null;
+    }
+    return {consts, code, lines, registerCount};
+};
+
+
+
+// Compiles a file. Returns the list of its compiled functions, the first
+// one being the entrypoint. The argument is either the source or a dict
+// like the argument of `parse`, with optional location properties.
+//
+// If the argument has a `base` property, only the function at the given
+// location is compiled. This is used to compile the lazy functions. The
+// ids of its nested functions begin at `base`.
+//
+// The `registers` property selects the register-based code.
+module.exports = function (arg) {
+    if (typeof arg === 'string') {
+        arg = {source: arg};
+    }
+    var request = {
+        source: arg.source,
+        begin: arg.begin || 0,
+        end: arg.end || arg.source.length,
+        line: arg.line || 1,
+        lazy: arg.lazy,
+    };
+
+    if (typeof arg.base === 'number') {
+        request.isFunction = 1;
+        return codegen({
+            root: parse(request)[0],
+            firstId: arg.base,
+            registers: arg.registers,
+            isFunction: 1,
+        });
+    }
+
+    var root = {
+        type: 'function',
+        children: parse(request),
+        param: {type: 'null'}
+    };
+    return codegen({root, firstId: 1, registers: arg.registers});
 };
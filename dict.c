@@ -41,7 +41,11 @@ void dict_set(dict_t *dict, const char *key, value_t v) {
         entry->value = v;
         return;
     }
-    entry = xmalloc(sizeof(dict_entry_t));
+    dict_set_new(dict, key, v);
+}
+
+void dict_set_new(dict_t *dict, const char *key, value_t v) {
+    dict_entry_t *entry = xmalloc(sizeof(dict_entry_t));
     entry->key = xstrdup(key);
     entry->value = v;
     entry->next = *dict;
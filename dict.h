@@ -17,6 +17,7 @@ value_t dict_getv(const dict_t *dict, value_t key);
 int dict_has(const dict_t *dict, const char *key);
 int dict_hasv(const dict_t *dict, value_t key);
 void dict_set(dict_t *dict, const char *key, value_t v);
+void dict_set_new(dict_t *dict, const char *key, value_t v); // No lookup
 void dict_setv(dict_t *dict, value_t key, value_t v);
 void dict_delete_all(dict_t *dict);
 
@@ -0,0 +1,136 @@
+#include "toy.h"
+#include "simd.h"
+
+// Float64Arrays store their numbers contiguously, like in JavaScript.
+// The bulk operations below run on vectorized kernels and are much
+// faster than loops over lists.
+
+static value_t new_array(size_t length) {
+    return (value_t){
+        .type = value_type_object,
+        .object = new_float64_array_object(length),
+    };
+}
+
+static float64_array_t *get_array(value_t v) {
+    v_assert_type(v, float64_array);
+    return &v.object->float64_array;
+}
+
+value_t v_new_float64_array(value_t ctx, value_t arg) {
+    (void)ctx;
+    if (v_is_list(arg)) {
+        const list_t *list = &arg.object->list;
+        value_t varray = new_array(list->length);
+        double *data = varray.object->float64_array.data;
+        for (size_t i = 0; i < list->length; i++) {
+            data[i] = v_to_number(list->items[i]);
+        }
+        return varray;
+    }
+    long length = v_to_integer(arg);
+    if (length < 0) {
+        die("invalid Float64Array length");
+    }
+    return new_array(length);
+}
+
+static value_t array_sum(value_t varray, value_t unused) {
+    (void)unused;
+    const float64_array_t *a = get_array(varray);
+    return v_number(simd_sum(a->data, a->length));
+}
+
+// Returns null if the array is empty.
+static value_t array_min(value_t varray, value_t unused) {
+    (void)unused;
+    const float64_array_t *a = get_array(varray);
+    return a->length ? v_number(simd_min(a->data, a->length)) : v_null;
+}
+
+static value_t array_max(value_t varray, value_t unused) {
+    (void)unused;
+    const float64_array_t *a = get_array(varray);
+    return a->length ? v_number(simd_max(a->data, a->length)) : v_null;
+}
+
+static value_t array_dot(value_t va, value_t vb) {
+    const float64_array_t *a = get_array(va), *b = get_array(vb);
+    if (a->length != b->length) {
+        die("dot(): the arrays must have the same length");
+    }
+    return v_number(simd_dot(a->data, b->data, a->length));
+}
+
+// Returns the array itself.
+static value_t array_fill(value_t varray, value_t x) {
+    float64_array_t *a = get_array(varray);
+    simd_fill(a->data, v_to_number(x), a->length);
+    return varray;
+}
+
+// Returns a new array. The operand is a number or an array of the same
+// length.
+static value_t apply_op(enum simd_op op, value_t va, value_t operand) {
+    const float64_array_t *a = get_array(va);
+    value_t vresult = new_array(a->length);
+    double *dst = vresult.object->float64_array.data;
+    if (v_is_float64_array(operand)) {
+        const float64_array_t *b = &operand.object->float64_array;
+        if (a->length != b->length) {
+            die("the arrays must have the same length");
+        }
+        simd_vector_op(op, dst, a->data, b->data, a->length);
+    } else {
+        simd_scalar_op(op, dst, a->data, v_to_number(operand), a->length);
+    }
+    return vresult;
+}
+
+#define X(name)                                                 \
+    static value_t array_##name(value_t va, value_t operand) {  \
+        return apply_op(simd_op_##name, va, operand);           \
+    }
+X(add) X(sub) X(mul) X(div)
+#undef X
+
+// Calls `func` on every number and returns a new array.
+static value_t array_map(value_t varray, value_t func) {
+    const float64_array_t *a = get_array(varray);
+    value_t vresult = new_array(a->length);
+    double *dst = vresult.object->float64_array.data;
+    v_inc_ref(vresult); // `func` can trigger the garbage collector
+    for (size_t i = 0; i < a->length; i++) {
+        dst[i] = v_to_number(call_func(func, v_number(a->data[i])));
+    }
+    v_dec_ref(vresult);
+    return vresult;
+}
+
+value_t get_float64_array_property(value_t array, const char *key) {
+    static const struct {
+        const char *name;
+        native_func_t func;
+    } methods[] = {
+        {"sum", array_sum},
+        {"min", array_min},
+        {"max", array_max},
+        {"dot", array_dot},
+        {"fill", array_fill},
+        {"add", array_add},
+        {"sub", array_sub},
+        {"mul", array_mul},
+        {"div", array_div},
+        {"map", array_map},
+    };
+
+    if (strcmp(key, "length") == 0) {
+        return v_integer(get_array(array)->length);
+    }
+    for (size_t i = 0; i < sizeof(methods) / sizeof(*methods); i++) {
+        if (strcmp(key, methods[i].name) == 0) {
+            return create_method(array, methods[i].func);
+        }
+    }
+    return v_null;
+}
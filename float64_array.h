@@ -0,0 +1,13 @@
+#ifndef FLOAT64_ARRAY_H
+#define FLOAT64_ARRAY_H
+
+#include "value.h"
+
+// The global `Float64Array` function. Its argument is either a length
+// or a list of numbers.
+value_t v_new_float64_array(value_t ctx, value_t arg);
+
+// Returns the method or property `key` of a Float64Array, or null.
+value_t get_float64_array_property(value_t array, const char *key);
+
+#endif /* FLOAT64_ARRAY_H */
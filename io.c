@@ -0,0 +1,257 @@
+#include "toy.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+
+
+//////////////////////////////////////////////////// OUTPUT
+
+
+
+// The buffers are shared by the isolates.
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_length = 0;
+static int output_initialized = 0, output_is_terminal = 0;
+
+static void write_all(int fd, const char *s, size_t n) {
+    while (n) {
+        ssize_t written = write(fd, s, n);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Probably a closed pipe, there is nothing better to do
+            return;
+        }
+        s += written;
+        n -= written;
+    }
+}
+
+static void flush_unlocked(void) {
+    write_all(STDOUT_FILENO, output_buffer, output_length);
+    output_length = 0;
+}
+
+void io_flush(void) {
+    pthread_mutex_lock(&output_mutex);
+    flush_unlocked();
+    pthread_mutex_unlock(&output_mutex);
+}
+
+void io_write(const char *s, size_t n) {
+    pthread_mutex_lock(&output_mutex);
+    if (!output_initialized) {
+        output_initialized = 1;
+        output_is_terminal = isatty(STDOUT_FILENO);
+        atexit(io_flush);
+    }
+    if (output_length + n > OUTPUT_BUFFER_SIZE) {
+        flush_unlocked();
+        if (n > OUTPUT_BUFFER_SIZE / 2) {
+            write_all(STDOUT_FILENO, s, n);
+            n = 0; // Nothing to buffer
+        }
+    }
+    memcpy(output_buffer + output_length, s, n);
+    output_length += n;
+    if (output_is_terminal && memchr(s, '\n', n)) {
+        flush_unlocked();
+    }
+    pthread_mutex_unlock(&output_mutex);
+}
+
+value_t v_flush(value_t ctx, value_t unused) {
+    (void)ctx;
+    (void)unused;
+    io_flush();
+    return v_null;
+}
+
+
+
+//////////////////////////////////////////////////// INPUT
+
+
+
+// Reads a file by large chunks. A line is copied only once, from the
+// buffer to its string.
+struct line_reader {
+    int fd;
+    int eof;
+    char *buffer;
+    size_t begin, end; // Unread data
+    size_t capacity;
+};
+
+static line_reader_t *new_line_reader(int fd) {
+    line_reader_t *reader = xmalloc(sizeof(*reader));
+    *reader = (line_reader_t){
+        .fd = fd,
+        .eof = 0,
+        .buffer = xmalloc(INPUT_BUFFER_SIZE),
+        .begin = 0,
+        .end = 0,
+        .capacity = INPUT_BUFFER_SIZE,
+    };
+    return reader;
+}
+
+void line_reader_free(line_reader_t *reader) {
+    if (reader->fd > STDIN_FILENO) {
+        close(reader->fd);
+    }
+    free(reader->buffer);
+    free(reader);
+}
+
+size_t line_reader_size(const line_reader_t *reader) {
+    return sizeof(*reader) + reader->capacity;
+}
+
+// Reads more data after the unread one. Returns zero at the end of the
+// file.
+static int fill_buffer(line_reader_t *reader) {
+    if (reader->eof) {
+        return 0;
+    }
+    if (reader->fd == STDIN_FILENO) {
+        io_flush(); // For the prompts
+    }
+
+    // Moves the unread data to the beginning, and grows the buffer if
+    // it is full of a single line.
+    size_t unread = reader->end - reader->begin;
+    memmove(reader->buffer, reader->buffer + reader->begin, unread);
+    reader->begin = 0;
+    reader->end = unread;
+    if (unread == reader->capacity) {
+        reader->capacity *= 2;
+        reader->buffer = xrealloc(reader->buffer, reader->capacity);
+    }
+
+    for (;;) {
+        ssize_t n = read(reader->fd, reader->buffer + reader->end,
+                         reader->capacity - reader->end);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            reader->eof = 1;
+            return 0;
+        }
+        reader->end += n;
+        return 1;
+    }
+}
+
+// A NUL character ends the string early.
+static value_t take_string(line_reader_t *reader, size_t length,
+                           size_t skip) {
+    char *s = xstrndup(reader->buffer + reader->begin, length);
+    reader->begin += length + skip;
+    return v_string_owned(s);
+}
+
+// Returns the next line without its line feed (nor its carriage return),
+// or null at the end of the file.
+static value_t read_line(line_reader_t *reader) {
+    size_t searched = 0;
+    for (;;) {
+        const char *begin = reader->buffer + reader->begin;
+        size_t unread = reader->end - reader->begin;
+        const char *newline = memchr(begin + searched, '\n',
+                                     unread - searched);
+        if (newline) {
+            size_t length = newline - begin;
+            if (length && begin[length - 1] == '\r') {
+                return take_string(reader, length - 1, 2);
+            }
+            return take_string(reader, length, 1);
+        }
+        searched = unread;
+        if (!fill_buffer(reader)) {
+            return unread ? take_string(reader, unread, 0) : v_null;
+        }
+    }
+}
+
+// Shared by the isolates. Locked while it is read.
+static pthread_mutex_t stdin_mutex = PTHREAD_MUTEX_INITIALIZER;
+static line_reader_t *stdin_reader = 0;
+
+// Lets the other green threads run while the standard input has nothing
+// to read, instead of blocking them.
+static line_reader_t *lock_stdin_reader(void) {
+    while (1) {
+        pthread_mutex_lock(&stdin_mutex);
+        if (!stdin_reader) {
+            stdin_reader = new_line_reader(STDIN_FILENO);
+        }
+        line_reader_t *reader = stdin_reader;
+        struct pollfd input = {.fd = STDIN_FILENO, .events = POLLIN};
+        if (reader->begin < reader->end || reader->eof ||
+            poll(&input, 1, 0) != 0) {
+            return reader;
+        }
+        pthread_mutex_unlock(&stdin_mutex);
+        if (!green_yield()) {
+            pthread_mutex_lock(&stdin_mutex);
+            return reader;
+        }
+    }
+}
+
+value_t v_read_line(value_t ctx, value_t unused) {
+    (void)ctx;
+    (void)unused;
+    value_t line = read_line(lock_stdin_reader());
+    pthread_mutex_unlock(&stdin_mutex);
+    return line;
+}
+
+// Returns the next chunk of at most `size` bytes (64 KiB by default) of
+// the standard input, or null at the end.
+value_t v_read_stdin(value_t ctx, value_t vsize) {
+    (void)ctx;
+    size_t size = v_is_null(vsize) ? INPUT_BUFFER_SIZE : v_to_integer(vsize);
+    if (!size) {
+        die("readStdin(): invalid size");
+    }
+    line_reader_t *reader = lock_stdin_reader();
+    value_t chunk = v_null;
+    if (reader->begin < reader->end || fill_buffer(reader)) {
+        size_t unread = reader->end - reader->begin;
+        chunk = take_string(reader, unread < size ? unread : size, 0);
+    }
+    pthread_mutex_unlock(&stdin_mutex);
+    return chunk;
+}
+
+static value_t next_file_line(value_t vreader, value_t unused) {
+    (void)unused;
+    return read_line(vreader.object->line_reader);
+}
+
+// Returns a function which returns the next line of the file at each
+// call, and null at the end. The file is closed when the function is
+// garbage collected.
+value_t v_file_lines(value_t ctx, value_t path) {
+    (void)ctx;
+    v_assert_type(path, string);
+    int fd = open(path.object->string, O_RDONLY);
+    if (fd < 0) {
+        die("fileLines(): cannot open the file");
+    }
+    value_t reader = {
+        .type = value_type_object,
+        .object = new_line_reader_object(new_line_reader(fd)),
+    };
+    return create_method(reader, next_file_line);
+}
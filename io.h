@@ -0,0 +1,24 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include "value.h"
+
+// Buffered standard output. The buffer is flushed when it is full, by
+// `flush()`, before reading the standard input, at exit and in `die()`.
+// It is flushed after each line if the output is a terminal.
+void io_write(const char *s, size_t n);
+void io_flush(void);
+
+typedef struct line_reader line_reader_t;
+
+void line_reader_free(line_reader_t *reader);
+size_t line_reader_size(const line_reader_t *reader); // With its buffer
+
+// Builtins
+value_t v_flush(value_t ctx, value_t unused);
+value_t v_read_line(value_t ctx, value_t unused);
+value_t v_read_stdin(value_t ctx, value_t size);
+value_t v_file_lines(value_t ctx, value_t path);
+
+#endif /* IO_H */
@@ -0,0 +1,74 @@
+#include "toy.h"
+
+__thread toy_isolate_t *current_isolate = 0;
+
+toy_isolate_t *toy_isolate_new(void) {
+    init_profile();
+    toy_isolate_t *isolate = xmalloc(sizeof(*isolate));
+    *isolate = (toy_isolate_t){
+        .big_linked_list = 0,
+        .object_count = 0,
+        .allocation_count_since_last_gc = 0,
+        .object_count_after_last_gc = 0,
+        .sweep = {.state = sweep_state_done},
+        .gc_count = 0,
+        .last_gc = {.number = 0},
+        .builtin_file = 0,
+        .compiler = v_null,
+        .scheduler = 0,
+        .error_handler = 0,
+        .error = 0,
+    };
+    return isolate;
+}
+
+void toy_isolate_free(toy_isolate_t *isolate) {
+    toy_isolate_t *previous = current_isolate;
+    current_isolate = isolate;
+    finish_sweep(isolate);
+    free_scheduler(isolate->scheduler);
+    if (isolate->builtin_file) {
+        free_compiled_file(isolate->builtin_file);
+    }
+    while (isolate->big_linked_list) {
+        free_object_unsafe(isolate->big_linked_list);
+    }
+    current_isolate = previous;
+    free(isolate->error);
+    free(isolate);
+}
+
+int isolate_run(toy_isolate_t *isolate, void (*run)(void *data),
+                void *data) {
+    toy_isolate_t *previous = current_isolate;
+    vm_frame_t *frame = current_frame;
+    jmp_buf *previous_handler = isolate->error_handler;
+    jmp_buf handler;
+    int status = 0;
+    current_isolate = isolate;
+    isolate->error_handler = &handler;
+    if (setjmp(handler) == 0) {
+        run(data);
+    } else {
+        status = -1;
+    }
+    isolate->error_handler = previous_handler;
+    current_isolate = previous;
+    current_frame = frame;
+    return status;
+}
+
+static void eval(void *source) {
+    eval_source(source);
+}
+
+int toy_isolate_eval(toy_isolate_t *isolate, const char *source) {
+    if (isolate->error) {
+        return -1;
+    }
+    return isolate_run(isolate, eval, (void *)source);
+}
+
+const char *toy_isolate_error(const toy_isolate_t *isolate) {
+    return isolate->error;
+}
@@ -0,0 +1,26 @@
+#ifndef ISOLATE_H
+#define ISOLATE_H
+
+// Embedding API. An isolate is an interpreter with its own heap, garbage
+// collector and compiler. Several isolates can run at the same time on
+// different threads, but an isolate must not be used by two threads at
+// the same time. Objects never cross isolates.
+//
+// The standard output and input are shared by the whole process.
+
+typedef struct toy_isolate toy_isolate_t;
+
+toy_isolate_t *toy_isolate_new(void);
+
+// Frees every object of the isolate.
+void toy_isolate_free(toy_isolate_t *isolate);
+
+// Compiles and runs the given script in a new global scope. Returns
+// zero on success. On error (where the standalone interpreter would
+// exit), returns -1, and the isolate can only be freed.
+int toy_isolate_eval(toy_isolate_t *isolate, const char *source);
+
+// The message of the last error, or null
+const char *toy_isolate_error(const toy_isolate_t *isolate);
+
+#endif /* ISOLATE_H */
@@ -0,0 +1,620 @@
+#include "toy.h"
+
+// Baseline template JIT, for x86-64 Linux only. It is enabled with
+// `TOY_JIT=<threshold>`: functions are compiled after `threshold` calls
+// or loop iterations.
+//
+// Each instruction is translated into a template which calls a helper
+// function below, with the frame and the operand as arguments. Jumps are
+// native. The frame holds the same stack as `eval_func()`, so that the
+// interpreter can switch to the machine code in the middle of a loop.
+//
+// Functions whose bytecode cannot be compiled stay interpreted. The
+// compiled functions are written into `/tmp/perf-<pid>.map`, for `perf`.
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct jit_frame jit_frame_t;
+
+struct jit_frame {
+    value_t stack[STACK_CAPACITY];
+    size_t size;
+    value_t scope;
+    value_t result;
+};
+
+struct jit_code {
+    unsigned char *code;
+    size_t size; // Of the mapping
+    uint32_t *entries; // Offsets in `code`, indexed by bytecode offsets
+};
+
+typedef void jit_entry_t(jit_frame_t *frame, void *entry);
+
+static unsigned jit_threshold;
+
+static void init_threshold(void) {
+    const char *s = getenv("TOY_JIT");
+    jit_threshold = s ? strtoul(s, NULL, 10) : 0;
+}
+
+static unsigned get_threshold(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_threshold);
+    return jit_threshold;
+}
+
+
+
+//////////////////////////////////////////////////// HELPERS
+
+
+
+static value_t frame_pop(jit_frame_t *f) {
+    if (!f->size) {
+        die("stack underflow");
+    }
+    value_t value = f->stack[--(f->size)];
+    v_dec_ref(value);
+    return value;
+}
+
+static value_t frame_top(jit_frame_t *f) {
+    if (!f->size) {
+        die("empty stack");
+    }
+    return f->stack[f->size - 1];
+}
+
+static void frame_push(jit_frame_t *f, value_t value) {
+    if (f->size == STACK_CAPACITY) {
+        die("stack overflow");
+    }
+    v_inc_ref(value);
+    f->stack[f->size++] = value;
+}
+
+static void frame_flush(jit_frame_t *f) {
+    for (size_t i = 0; i < f->size; i++) {
+        v_dec_ref(f->stack[i]);
+    }
+}
+
+// The operand is either unused, a pointer to a constant, a name or a
+// compiled function. The validity of operands is checked at compile time.
+
+static void op_return(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_flush(f);
+    f->result = f->size ? frame_top(f) : v_null;
+}
+
+static void op_return_null(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_flush(f);
+    f->result = v_null;
+}
+
+static void op_load_const(jit_frame_t *f, uintptr_t c) {
+    frame_push(f, *(const value_t *)c);
+}
+
+static void op_load_null(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_push(f, v_null);
+}
+
+static void op_load_empty_list(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_push(f, v_list());
+}
+
+static void op_load_empty_dict(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_push(f, v_dict());
+}
+
+static void op_list_push(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t item = frame_pop(f);
+    value_t list = frame_top(f);
+    v_assert_type(list, list);
+    v_list_push(list, item);
+}
+
+static void op_dict_push(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t value = frame_pop(f);
+    value_t key = frame_pop(f);
+    v_set(frame_top(f), key, value);
+}
+
+static void op_pop(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_pop(f);
+}
+
+static void op_decl_var(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t vname = frame_pop(f);
+    v_assert_type(vname, string);
+    scope_decl(f->scope, vname.object->string);
+}
+
+static void op_load_var(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t vname = frame_pop(f);
+    v_assert_type(vname, string);
+    frame_push(f, scope_get(f->scope, vname.object->string));
+}
+
+static void op_load_var_const(jit_frame_t *f, uintptr_t name) {
+    frame_push(f, scope_get(f->scope, (const char *)name));
+}
+
+static void op_decl_var_const(jit_frame_t *f, uintptr_t name) {
+    scope_decl(f->scope, (const char *)name);
+}
+
+static void op_store_var_const(jit_frame_t *f, uintptr_t name) {
+    value_t value = frame_pop(f);
+    scope_set(f->scope, (const char *)name, value);
+}
+
+static void op_load_func(jit_frame_t *f, uintptr_t compiled) {
+    object_t *closure = new_compiled_func_object((compiled_func_t *)compiled);
+    closure->func.parent_scope = f->scope;
+    frame_push(f, (value_t){.type = value_type_object, .object = closure});
+}
+
+static void op_call(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t arg = frame_pop(f);
+    value_t func = frame_pop(f);
+    frame_push(f, call_func(func, arg));
+}
+
+static void op_store_var(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t value = frame_pop(f);
+    value_t vname = frame_pop(f);
+    v_assert_type(vname, string);
+    scope_set(f->scope, vname.object->string, value);
+}
+
+static void op_dup(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_push(f, frame_top(f));
+}
+
+static void op_not(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_push(f, v_integer(!v_to_bool(frame_pop(f))));
+}
+
+static void op_unary_minus(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_push(f, v_unary_minus(frame_pop(f)));
+}
+
+static void op_typeof(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    frame_push(f, v_string(v_typeof(frame_pop(f))));
+}
+
+static void op_set(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t key = frame_pop(f);
+    value_t dict = frame_pop(f);
+    value_t new_value = frame_pop(f);
+    v_set(dict, key, new_value);
+}
+
+static void op_get(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t key = frame_pop(f);
+    value_t dict = frame_pop(f);
+    frame_push(f, v_get(dict, key));
+}
+
+static void op_get_const(jit_frame_t *f, uintptr_t key) {
+    value_t dict = frame_pop(f);
+    frame_push(f, v_get(dict, *(const value_t *)key));
+}
+
+static void op_rot(jit_frame_t *f, uintptr_t unused) {
+    (void)unused;
+    value_t a = frame_pop(f);
+    value_t b = frame_pop(f);
+    frame_push(f, a);
+    frame_push(f, b);
+}
+
+#define define_bin_op(name)                                     \
+    static void op_##name(jit_frame_t *f, uintptr_t unused) {   \
+        (void)unused;                                           \
+        value_t right = frame_pop(f);                           \
+        value_t left = frame_pop(f);                            \
+        frame_push(f, v_##name(left, right));                   \
+    }
+
+define_bin_op(add) define_bin_op(sub)
+define_bin_op(mul) define_bin_op(div) define_bin_op(mod)
+define_bin_op(eq) define_bin_op(neq)
+define_bin_op(gt) define_bin_op(lt)
+define_bin_op(gte) define_bin_op(lte)
+define_bin_op(in)
+
+// Conditional jumps. They return nonzero if the jump must be taken.
+
+static int cond_goto_if(jit_frame_t *f) {
+    return v_to_bool(frame_pop(f));
+}
+
+static int cond_goto_unless(jit_frame_t *f) {
+    return !v_to_bool(frame_pop(f));
+}
+
+static int cond_goto_if_or_pop(jit_frame_t *f) {
+    if (v_to_bool(frame_top(f))) {
+        return 1;
+    }
+    frame_pop(f);
+    return 0;
+}
+
+static int cond_goto_unless_or_pop(jit_frame_t *f) {
+    if (!v_to_bool(frame_top(f))) {
+        return 1;
+    }
+    frame_pop(f);
+    return 0;
+}
+
+#define define_goto_unless_bin_op(name)                         \
+    static int cond_goto_unless_##name(jit_frame_t *f) {        \
+        value_t right = frame_pop(f);                           \
+        value_t left = frame_pop(f);                            \
+        return !v_to_bool(v_##name(left, right));               \
+    }
+
+define_goto_unless_bin_op(eq) define_goto_unless_bin_op(neq)
+define_goto_unless_bin_op(gt) define_goto_unless_bin_op(lt)
+define_goto_unless_bin_op(gte) define_goto_unless_bin_op(lte)
+
+
+
+//////////////////////////////////////////////////// CODE GENERATION
+
+
+
+typedef struct emitter emitter_t;
+
+struct emitter {
+    unsigned char *code;
+    size_t size;
+};
+
+static void emit_bytes(emitter_t *e, const char *bytes, size_t count) {
+    memcpy(e->code + e->size, bytes, count);
+    e->size += count;
+}
+
+static void emit_uint32(emitter_t *e, uint32_t n) {
+    memcpy(e->code + e->size, &n, 4);
+    e->size += 4;
+}
+
+static void emit_uint64(emitter_t *e, uint64_t n) {
+    memcpy(e->code + e->size, &n, 8);
+    e->size += 8;
+}
+
+// The frame is kept in `rbx`, which is callee-saved.
+static void emit_call(emitter_t *e, void *helper, uintptr_t operand) {
+    emit_bytes(e, "\x48\x89\xdf", 3); // mov rdi, rbx
+    emit_bytes(e, "\x48\xbe", 2); // mov rsi, imm64
+    emit_uint64(e, operand);
+    emit_bytes(e, "\x48\xb8", 2); // mov rax, imm64
+    emit_uint64(e, (uintptr_t)helper);
+    emit_bytes(e, "\xff\xd0", 2); // call rax
+}
+
+// Returns the operand of the instruction at `ip`. `extended` holds the
+// high bits of the preceding `extended_arg`, if any.
+static size_t read_operand(const compiled_func_t *func, size_t ip,
+                           size_t extended) {
+    return extended | (func->code[ip + 1] * 0x100 + func->code[ip + 2]);
+}
+
+static void *get_helper(enum opcode op) {
+    switch (op) {
+#define X(name) case opcode_##name: return op_##name;
+        X(return) X(return_null)
+        X(add) X(sub) X(mul) X(div) X(mod)
+        X(eq) X(neq) X(gt) X(lt) X(gte) X(lte)
+        X(not) X(typeof) X(unary_minus)
+        X(set) X(get) X(get_const) X(in)
+        X(load_empty_list) X(load_empty_dict) X(load_null)
+        X(load_func) X(load_const)
+        X(load_var) X(store_var) X(decl_var)
+        X(load_var_const) X(store_var_const) X(decl_var_const)
+        X(call) X(dup) X(pop) X(rot) X(list_push) X(dict_push)
+#undef X
+    default:
+        return NULL;
+    }
+}
+
+// Returns the helper of a conditional jump
+static void *get_cond(enum opcode op) {
+    switch (op) {
+#define X(name) case opcode_##name: return cond_##name;
+        X(goto_if) X(goto_unless)
+        X(goto_if_or_pop) X(goto_unless_or_pop)
+        X(goto_unless_eq) X(goto_unless_neq)
+        X(goto_unless_gt) X(goto_unless_lt)
+        X(goto_unless_gte) X(goto_unless_lte)
+#undef X
+    default:
+        return NULL;
+    }
+}
+
+static size_t operand_size(enum opcode op) {
+    switch (op) {
+    case opcode_load_const: case opcode_load_func:
+    case opcode_load_var_const: case opcode_store_var_const:
+    case opcode_decl_var_const: case opcode_get_const:
+    case opcode_goto: case opcode_goto_if: case opcode_goto_unless:
+    case opcode_goto_if_or_pop: case opcode_goto_unless_or_pop:
+    case opcode_goto_unless_eq: case opcode_goto_unless_neq:
+    case opcode_goto_unless_gt: case opcode_goto_unless_lt:
+    case opcode_goto_unless_gte: case opcode_goto_unless_lte:
+    case opcode_extended_arg:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+// Computes the operand passed to the helper from the operand of the
+// instruction, `index`. Returns zero if it is invalid.
+static int get_operand(const compiled_func_t *func, enum opcode op,
+                       size_t index, uintptr_t *operand) {
+    *operand = 0;
+    switch (op) {
+    case opcode_load_const:
+    case opcode_get_const:
+        if (index >= func->const_count) {
+            return 0;
+        }
+        *operand = (uintptr_t)(func->consts + index);
+        return 1;
+    case opcode_load_var_const:
+    case opcode_store_var_const:
+    case opcode_decl_var_const:
+        if (index >= func->const_count ||
+            !v_is_string(func->consts[index])) {
+            return 0;
+        }
+        *operand = (uintptr_t)func->consts[index].object->string;
+        return 1;
+    case opcode_load_func:
+        if (index >= func->file->func_count) {
+            return 0;
+        }
+        *operand = (uintptr_t)func->file->funcs[index];
+        return 1;
+    default:
+        return 1;
+    }
+}
+
+static void write_perf_map(const compiled_func_t *func,
+                           const struct jit_code *jit) {
+    // Shared by the isolates
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    static FILE *perf_map;
+    size_t index = 0;
+    while (index < func->file->func_count && func->file->funcs[index] != func) {
+        index++;
+    }
+    pthread_mutex_lock(&mutex);
+    if (!perf_map) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+        perf_map = fopen(path, "a");
+    }
+    if (perf_map) {
+        fprintf(perf_map, "%lx %lx toy:func%zu(%s)\n",
+                (unsigned long)(uintptr_t)jit->code, (unsigned long)jit->size,
+                index, func->param_name ? func->param_name : "");
+        fflush(perf_map);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+static struct jit_code *compile(compiled_func_t *func) {
+    if (!func->code || func->register_count || func->aot) {
+        return NULL;
+    }
+
+    // No template is longer than 40 bytes.
+    size_t length = func->code_length;
+    size_t capacity = 64 + length * 40;
+    unsigned char *map = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    struct jit_code *jit = xmalloc(sizeof(struct jit_code));
+    *jit = (struct jit_code){
+        .code = map,
+        .size = capacity,
+        .entries = xmalloc(sizeof(uint32_t) * (length + 1)),
+    };
+    for (size_t i = 0; i <= length; i++) {
+        jit->entries[i] = UINT32_MAX;
+    }
+
+    // Positions of the jump displacements, to be patched
+    size_t *fixups = xmalloc(sizeof(size_t) * (length + 1));
+    size_t fixup_count = 0;
+
+    emitter_t e = {.code = map, .size = 0};
+    emit_bytes(&e, "\x53", 1); // push rbx
+    emit_bytes(&e, "\x48\x89\xfb", 3); // mov rbx, rdi
+    emit_bytes(&e, "\xff\xe6", 2); // jmp rsi
+
+    size_t ip = 0;
+    size_t extended = 0;
+    int prefixed = 0;
+    while (ip < length) {
+        enum opcode op = func->code[ip];
+        if (op >= opcode__count || ip + operand_size(op) >= length) {
+            goto fail;
+        }
+        if (!prefixed) {
+            jit->entries[ip] = e.size;
+        }
+        size_t index = 0;
+        if (operand_size(op)) {
+            index = read_operand(func, ip, extended);
+        }
+        if (op == opcode_extended_arg) {
+            // Emits nothing, the next instruction takes the operand
+            extended = index << 16;
+            prefixed = 1;
+            ip += 3;
+            continue;
+        }
+        extended = 0;
+        prefixed = 0;
+
+        if (op == opcode_goto || get_cond(op)) {
+            if (index <= ip) {
+                // Garbage collection is requested on loop iterations
+                emit_call(&e, request_garbage_collection, 0);
+            }
+            if (op == opcode_goto) {
+                emit_bytes(&e, "\xe9", 1); // jmp rel32
+            } else {
+                emit_call(&e, get_cond(op), 0);
+                emit_bytes(&e, "\x85\xc0", 2); // test eax, eax
+                emit_bytes(&e, "\x0f\x85", 2); // jnz rel32
+            }
+            fixups[fixup_count++] = e.size;
+            emit_uint32(&e, index);
+        } else {
+            void *helper = get_helper(op);
+            uintptr_t operand;
+            if (!helper || !get_operand(func, op, index, &operand)) {
+                goto fail;
+            }
+            emit_call(&e, helper, operand);
+            if (op == opcode_return || op == opcode_return_null) {
+                emit_bytes(&e, "\x5b", 1); // pop rbx
+                emit_bytes(&e, "\xc3", 1); // ret
+            }
+        }
+        ip += 1 + operand_size(op);
+    }
+    emit_bytes(&e, "\x0f\x0b", 2); // ud2, the code must not end here
+
+    for (size_t i = 0; i < fixup_count; i++) {
+        uint32_t target;
+        memcpy(&target, map + fixups[i], 4);
+        if (target >= length || jit->entries[target] == UINT32_MAX) {
+            goto fail;
+        }
+        uint32_t displacement = jit->entries[target] - (fixups[i] + 4);
+        memcpy(map + fixups[i], &displacement, 4);
+    }
+    free(fixups);
+
+    if (mprotect(map, capacity, PROT_READ | PROT_EXEC)) {
+        func->jit = jit;
+        jit_free(func);
+        return NULL;
+    }
+    write_perf_map(func, jit);
+    return jit;
+
+fail:
+    free(fixups);
+    func->jit = jit;
+    jit_free(func);
+    return NULL;
+}
+
+int jit_tick(compiled_func_t *func) {
+    unsigned threshold = get_threshold();
+    if (!threshold) {
+        return 0;
+    }
+    if (func->hotness < threshold) {
+        func->hotness++;
+        if (func->hotness < threshold) {
+            return 0;
+        }
+        func->jit = compile(func);
+    }
+    return func->jit != NULL;
+}
+
+value_t jit_run(compiled_func_t *func, value_t scope,
+                const value_t *stack, size_t stack_size, size_t ip) {
+    struct jit_code *jit = func->jit;
+    if (ip >= func->code_length || jit->entries[ip] == UINT32_MAX) {
+        die("jit_run(): invalid entry");
+    }
+    jit_frame_t frame = {
+        .size = stack_size,
+        .scope = scope,
+        .result = v_null,
+    };
+    if (stack_size) {
+        memcpy(frame.stack, stack, sizeof(value_t) * stack_size);
+    }
+    jit_entry_t *entry = (jit_entry_t *)(void *)jit->code;
+    entry(&frame, jit->code + jit->entries[ip]);
+    return frame.result;
+}
+
+void jit_free(compiled_func_t *func) {
+    if (!func->jit) {
+        return;
+    }
+    munmap(func->jit->code, func->jit->size);
+    free(func->jit->entries);
+    free(func->jit);
+    func->jit = NULL;
+}
+
+#else
+
+int jit_tick(compiled_func_t *func) {
+    (void)func;
+    return 0;
+}
+
+value_t jit_run(compiled_func_t *func, value_t scope,
+                const value_t *stack, size_t stack_size, size_t ip) {
+    (void)func;
+    (void)scope;
+    (void)stack;
+    (void)stack_size;
+    (void)ip;
+    die("no JIT on this platform");
+}
+
+void jit_free(compiled_func_t *func) {
+    (void)func;
+}
+
+#endif
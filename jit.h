@@ -0,0 +1,20 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include "value.h"
+
+struct compiled_func;
+
+// Counts a call or a loop iteration of the function, and compiles it once
+// it is hot. Returns nonzero if the function has machine code.
+int jit_tick(struct compiled_func *func);
+
+// Runs the machine code of the function from the instruction at `ip`,
+// with the given stack, whose references are taken over.
+value_t jit_run(struct compiled_func *func, value_t scope,
+                const value_t *stack, size_t stack_size, size_t ip);
+
+void jit_free(struct compiled_func *func);
+
+#endif /* JIT_H */
@@ -0,0 +1,536 @@
+#include "toy.h"
+#include "simd.h"
+#include <inttypes.h>
+
+// `JSON.parse()` and `JSON.stringify()`.
+//
+// There are no booleans, `true` and `false` are parsed as 1 and 0.
+// Strings cannot contain NUL characters, since toy strings are
+// NUL-terminated.
+
+// Maximum nesting of lists and dicts. Deeper documents are rejected
+// instead of overflowing the C stack, and it catches cycles in
+// `stringify()`.
+#define MAX_DEPTH 5000
+
+
+
+//////////////////////////////////////////////////// PARSER
+
+
+
+typedef struct parser parser_t;
+
+struct parser {
+    const char *source, *p;
+    const char *end; // The terminating NUL
+    unsigned depth;
+};
+
+// Used to scan the runs of whitespace and of plain string characters,
+// see `simd.c`
+static simd_byte_set_t whitespace_set, string_special_set;
+
+static void init_parser_sets(void) {
+    simd_byte_set_init(&whitespace_set, " \n\r\t", 4);
+    simd_byte_set_init(&string_special_set, "\"\\", 2);
+    simd_byte_set_add_range(&string_special_set, 0, 0x1f);
+}
+
+__attribute__((noreturn))
+static void parser_error(const parser_t *parser, const char *message) {
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "JSON.parse(): %s at offset %zu",
+             message, (size_t)(parser->p - parser->source));
+    die(buffer);
+}
+
+static void skip_whitespace(parser_t *parser) {
+    const char *p = parser->p;
+    if (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t') {
+        parser->p += simd_find_not_in_set(&whitespace_set, p, parser->end - p);
+    }
+}
+
+static int hex_digit(char c) {
+    return c >= '0' && c <= '9' ? c - '0' :
+        c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+        c >= 'A' && c <= 'F' ? c - 'A' + 10 :
+        -1;
+}
+
+static unsigned parse_hex4(parser_t *parser) {
+    unsigned code = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_digit(parser->p[i]);
+        if (digit < 0) {
+            parser_error(parser, "invalid \\u escape");
+        }
+        code = code << 4 | digit;
+    }
+    parser->p += 4;
+    return code;
+}
+
+static char *encode_utf8(char *out, unsigned code) {
+    if (code < 0x80) {
+        *out++ = code;
+    } else if (code < 0x800) {
+        *out++ = 0xc0 | code >> 6;
+        *out++ = 0x80 | (code & 0x3f);
+    } else if (code < 0x10000) {
+        *out++ = 0xe0 | code >> 12;
+        *out++ = 0x80 | (code >> 6 & 0x3f);
+        *out++ = 0x80 | (code & 0x3f);
+    } else {
+        *out++ = 0xf0 | code >> 18;
+        *out++ = 0x80 | (code >> 12 & 0x3f);
+        *out++ = 0x80 | (code >> 6 & 0x3f);
+        *out++ = 0x80 | (code & 0x3f);
+    }
+    return out;
+}
+
+// Decodes the escape sequence after a backslash.
+static char *parse_escape(parser_t *parser, char *out) {
+    char c = *parser->p++;
+    switch (c) {
+    case '"': case '\\': case '/': *out++ = c; return out;
+    case 'b': *out++ = '\b'; return out;
+    case 'f': *out++ = '\f'; return out;
+    case 'n': *out++ = '\n'; return out;
+    case 'r': *out++ = '\r'; return out;
+    case 't': *out++ = '\t'; return out;
+    case 'u': break;
+    default:
+        parser->p--;
+        parser_error(parser, "invalid escape sequence");
+    }
+
+    unsigned code = parse_hex4(parser);
+    if (code >= 0xd800 && code < 0xdc00 &&
+        parser->p[0] == '\\' && parser->p[1] == 'u') {
+        const char *save = parser->p;
+        parser->p += 2;
+        unsigned low = parse_hex4(parser);
+        if (low >= 0xdc00 && low < 0xe000) {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        } else {
+            parser->p = save;
+        }
+    }
+    if (!code) {
+        parser_error(parser, "NUL characters are not supported");
+    }
+    return encode_utf8(out, code);
+}
+
+// Returns a malloc'd string. The opening quote has been read.
+static char *parse_string_contents(parser_t *parser) {
+    // A first pass finds the end, so that the result is allocated once.
+    // An escape sequence is never shorter than its UTF-8 encoding.
+    const char *begin = parser->p, *p = begin;
+    int has_escapes = 0;
+    for (;;) {
+        p += simd_find_in_set(&string_special_set, p, parser->end - p);
+        if (*p == '"') {
+            break;
+        }
+        if (*p != '\\') {
+            parser->p = p;
+            parser_error(parser, *p ? "control character in string" :
+                         "unterminated string");
+        }
+        has_escapes = 1;
+        if (!*++p) {
+            parser->p = p;
+            parser_error(parser, "unterminated string");
+        }
+        p++;
+    }
+    if (!has_escapes) {
+        parser->p = p + 1;
+        return xstrndup(begin, p - begin);
+    }
+
+    char *result = xmalloc(p - begin + 1), *out = result;
+    while (*parser->p != '"') {
+        if (*parser->p == '\\') {
+            parser->p++;
+            out = parse_escape(parser, out);
+        } else {
+            *out++ = *parser->p++;
+        }
+    }
+    *out = 0;
+    parser->p++;
+    return result;
+}
+
+static value_t parse_number(parser_t *parser) {
+    const char *begin = parser->p, *p = begin;
+    if (*p == '-') {
+        p++;
+    }
+    if (*p == '0') {
+        p++;
+    } else if (isdigit(*p)) {
+        while (isdigit(*p)) {
+            p++;
+        }
+    } else {
+        parser_error(parser, "invalid number");
+    }
+
+    // Fast path for the integers which fit in 15 digits
+    if (*p != '.' && *p != 'e' && *p != 'E' && p - begin <= 15) {
+        int64_t n = 0;
+        for (const char *d = *begin == '-' ? begin + 1 : begin; d < p; d++) {
+            n = n * 10 + (*d - '0');
+        }
+        parser->p = p;
+        if (*begin == '-') {
+            return n ? v_integer(-n) : v_number(-0.0);
+        }
+        return v_integer(n);
+    }
+
+    if (*p == '.') {
+        p++;
+        if (!isdigit(*p)) {
+            parser->p = p;
+            parser_error(parser, "invalid number");
+        }
+        while (isdigit(*p)) {
+            p++;
+        }
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-') {
+            p++;
+        }
+        if (!isdigit(*p)) {
+            parser->p = p;
+            parser_error(parser, "invalid number");
+        }
+        while (isdigit(*p)) {
+            p++;
+        }
+    }
+    parser->p = p;
+    return v_number(strtod(begin, 0));
+}
+
+static int parse_word(parser_t *parser, const char *word) {
+    size_t length = strlen(word);
+    if (strncmp(parser->p, word, length) == 0) {
+        parser->p += length;
+        return 1;
+    }
+    return 0;
+}
+
+static value_t parse_value(parser_t *parser);
+
+static value_t parse_list(parser_t *parser) {
+    value_t list = v_list();
+    skip_whitespace(parser);
+    if (*parser->p == ']') {
+        parser->p++;
+        return list;
+    }
+    for (;;) {
+        v_list_push(list, parse_value(parser));
+        skip_whitespace(parser);
+        char c = *parser->p++;
+        if (c == ']') {
+            return list;
+        }
+        if (c != ',') {
+            parser->p--;
+            parser_error(parser, "expected ',' or ']'");
+        }
+    }
+}
+
+static value_t parse_dict(parser_t *parser) {
+    value_t dict = v_dict();
+    skip_whitespace(parser);
+    if (*parser->p == '}') {
+        parser->p++;
+        return dict;
+    }
+    for (;;) {
+        skip_whitespace(parser);
+        if (*parser->p != '"') {
+            parser_error(parser, "expected a string");
+        }
+        parser->p++;
+        char *key = parse_string_contents(parser);
+        skip_whitespace(parser);
+        if (*parser->p != ':') {
+            parser_error(parser, "expected ':'");
+        }
+        parser->p++;
+        dict_set(&dict.object->dict, key, parse_value(parser));
+        free(key);
+
+        skip_whitespace(parser);
+        char c = *parser->p++;
+        if (c == '}') {
+            return dict;
+        }
+        if (c != ',') {
+            parser->p--;
+            parser_error(parser, "expected ',' or '}'");
+        }
+    }
+}
+
+static value_t parse_value(parser_t *parser) {
+    skip_whitespace(parser);
+    char c = *parser->p;
+    if (c == '"') {
+        parser->p++;
+        return v_string_owned(parse_string_contents(parser));
+    }
+    if (c == '-' || isdigit(c)) {
+        return parse_number(parser);
+    }
+    if (c == '[' || c == '{') {
+        if (++parser->depth > MAX_DEPTH) {
+            parser_error(parser, "too deeply nested");
+        }
+        parser->p++;
+        value_t v = c == '[' ? parse_list(parser) : parse_dict(parser);
+        parser->depth--;
+        return v;
+    }
+    if (parse_word(parser, "null")) {
+        return v_null;
+    }
+    if (parse_word(parser, "true")) {
+        return v_integer(1);
+    }
+    if (parse_word(parser, "false")) {
+        return v_integer(0);
+    }
+    parser_error(parser, c ? "unexpected character" : "unexpected end");
+}
+
+// The garbage collector cannot run while parsing, so the partial
+// results need no references.
+static value_t v_json_parse(value_t ctx, value_t vsource) {
+    (void)ctx;
+    v_assert_type(vsource, string);
+    const char *source = vsource.object->string;
+    size_t length = strlen(source);
+    if (!simd_is_valid_utf8(source, length)) {
+        die("JSON.parse(): invalid UTF-8");
+    }
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_parser_sets);
+    parser_t parser = {
+        .source = source,
+        .p = source,
+        .end = source + length,
+        .depth = 0,
+    };
+    value_t v = parse_value(&parser);
+    skip_whitespace(&parser);
+    if (*parser.p) {
+        parser_error(&parser, "unexpected data after the value");
+    }
+    return v;
+}
+
+
+
+//////////////////////////////////////////////////// STRINGIFIER
+
+
+
+typedef struct buffer buffer_t;
+
+struct buffer {
+    char *data;
+    size_t length, capacity;
+};
+
+// Makes room for `n` more bytes.
+static char *buffer_reserve(buffer_t *buffer, size_t n) {
+    if (buffer->length + n > buffer->capacity) {
+        while (buffer->length + n > buffer->capacity) {
+            buffer->capacity *= 2;
+        }
+        buffer->data = xrealloc(buffer->data, buffer->capacity);
+    }
+    return buffer->data + buffer->length;
+}
+
+static void buffer_append(buffer_t *buffer, const char *s, size_t n) {
+    memcpy(buffer_reserve(buffer, n), s, n);
+    buffer->length += n;
+}
+
+#define buffer_append_literal(buffer, s) \
+    buffer_append((buffer), (s), sizeof(s) - 1)
+
+static void stringify_number(buffer_t *buffer, value_t v) {
+    char *out = buffer_reserve(buffer, 32);
+    if (v_is_integer(v)) {
+        buffer->length += sprintf(out, "%" PRId64, v.integer);
+    } else if (!isfinite(v.number)) {
+        buffer_append_literal(buffer, "null");
+    } else if (v.number == 0) {
+        buffer_append_literal(buffer, "0"); // -0, like JavaScript
+    } else {
+        // The shortest representation which reads back exactly
+        int n;
+        for (int precision = 15; precision <= 17; precision++) {
+            n = sprintf(out, "%.*g", precision, v.number);
+            if (strtod(out, 0) == v.number) {
+                break;
+            }
+        }
+        buffer->length += n;
+    }
+}
+
+static void stringify_string(buffer_t *buffer, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    size_t length = strlen(s);
+    buffer_reserve(buffer, length + 2);
+    buffer->data[buffer->length++] = '"';
+    const char *run = s;
+    for (const char *p = s; *p; p++) {
+        unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        buffer_append(buffer, run, p - run);
+        run = p + 1;
+        char escape[6] = {'\\', c, 0};
+        size_t n = 2;
+        switch (c) {
+        case '"': case '\\': break;
+        case '\b': escape[1] = 'b'; break;
+        case '\f': escape[1] = 'f'; break;
+        case '\n': escape[1] = 'n'; break;
+        case '\r': escape[1] = 'r'; break;
+        case '\t': escape[1] = 't'; break;
+        default:
+            memcpy(escape + 1, "u00", 3);
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 15];
+            n = 6;
+        }
+        buffer_append(buffer, escape, n);
+    }
+    buffer_append(buffer, run, s + length - run);
+    buffer_append_literal(buffer, "\"");
+}
+
+static void stringify(buffer_t *buffer, value_t v, unsigned depth);
+
+static void stringify_list(buffer_t *buffer, const list_t *list,
+                           unsigned depth) {
+    buffer_append_literal(buffer, "[");
+    for (size_t i = 0; i < list->length; i++) {
+        if (i) {
+            buffer_append_literal(buffer, ",");
+        }
+        stringify(buffer, list->items[i], depth);
+    }
+    buffer_append_literal(buffer, "]");
+}
+
+// The entries are in insertion order, i.e. from the last one of the
+// linked list to the first one. Functions are skipped, like in
+// JavaScript.
+static void stringify_dict(buffer_t *buffer, const dict_t *dict,
+                           unsigned depth) {
+    buffer_append_literal(buffer, "{");
+    const dict_entry_t *e = *dict;
+    while (e && e->next) {
+        e = e->next;
+    }
+    int first = 1;
+    for (; e; e = e->prev) {
+        if (v_is_func(e->value)) {
+            continue;
+        }
+        if (!first) {
+            buffer_append_literal(buffer, ",");
+        }
+        first = 0;
+        stringify_string(buffer, e->key);
+        buffer_append_literal(buffer, ":");
+        stringify(buffer, e->value, depth);
+    }
+    buffer_append_literal(buffer, "}");
+}
+
+static void stringify_float64_array(buffer_t *buffer,
+                                    const float64_array_t *a) {
+    buffer_append_literal(buffer, "[");
+    for (size_t i = 0; i < a->length; i++) {
+        if (i) {
+            buffer_append_literal(buffer, ",");
+        }
+        stringify_number(buffer, v_number(a->data[i]));
+    }
+    buffer_append_literal(buffer, "]");
+}
+
+static void stringify(buffer_t *buffer, value_t v, unsigned depth) {
+    if (v_is_number(v)) {
+        stringify_number(buffer, v);
+        return;
+    }
+    if (!v_is_object(v) || v_is_func(v)) {
+        buffer_append_literal(buffer, "null");
+        return;
+    }
+    if (v_is_string(v)) {
+        stringify_string(buffer, v.object->string);
+        return;
+    }
+
+    if (++depth > MAX_DEPTH) {
+        die("JSON.stringify(): cyclic or too deeply nested value");
+    }
+    switch (v.object->type) {
+    case object_type_list:
+        stringify_list(buffer, &v.object->list, depth);
+        break;
+    case object_type_dict:
+        stringify_dict(buffer, &v.object->dict, depth);
+        break;
+    case object_type_float64_array:
+        stringify_float64_array(buffer, &v.object->float64_array);
+        break;
+    default:
+        buffer_append_literal(buffer, "null");
+    }
+}
+
+static value_t v_json_stringify(value_t ctx, value_t v) {
+    (void)ctx;
+    buffer_t buffer = {
+        .data = xmalloc(4096),
+        .length = 0,
+        .capacity = 4096,
+    };
+    stringify(&buffer, v, 0);
+    *buffer_reserve(&buffer, 1) = 0;
+    return v_string_owned(xrealloc(buffer.data, buffer.length + 1));
+}
+
+value_t get_json(void) {
+    value_t json = v_dict();
+    v_set(json, v_string("parse"), v_native_func(v_json_parse));
+    v_set(json, v_string("stringify"), v_native_func(v_json_stringify));
+    return json;
+}
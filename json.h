@@ -0,0 +1,9 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "value.h"
+
+// Returns the global `JSON` dict, with `parse` and `stringify`.
+value_t get_json(void);
+
+#endif /* JSON_H */
@@ -10,12 +10,25 @@ int main(int argc, const char **argv) {
         die("cannot open the given file");
     }
 
-    size_t max_file_size = 64 * 1000;
-    char *source = xmalloc(max_file_size);
-    size_t length = fread(source, 1, max_file_size, file);
+    // Generated scripts can be large
+    size_t capacity = 64 * 1024, length = 0, n;
+    char *source = xmalloc(capacity);
+    while ((n = fread(source + length, 1, capacity - length - 1, file))) {
+        length += n;
+        if (length + 1 == capacity) {
+            capacity *= 2;
+            source = xrealloc(source, capacity);
+        }
+    }
     source[length] = 0;
-    eval_source(source);
     fclose(file);
+
+    toy_isolate_t *isolate = toy_isolate_new();
+    if (toy_isolate_eval(isolate, source)) {
+        fprintf(stderr, "fatal: %s\n", toy_isolate_error(isolate));
+        return 1;
+    }
+    toy_isolate_free(isolate);
     free(source);
     return 0;
 }
@@ -1,26 +1,28 @@
 #include "toy.h"
 
-unsigned long object_count = 0;
-unsigned long allocation_count_since_last_gc = 0;
-object_t *big_linked_list = 0;
-
 static object_t *new_object(void) {
-    object_count++;
-    allocation_count_since_last_gc++;
+    toy_isolate_t *isolate = current_isolate;
+    isolate->object_count++;
+    isolate->allocation_count_since_last_gc++;
     object_t *o = xmalloc(sizeof(object_t));
+    o->marked = 0;
     o->ref_count = 0;
     o->prev = 0;
-    o->next = big_linked_list;
-    if (big_linked_list) {
-        big_linked_list->prev = o;
+    o->next = isolate->big_linked_list;
+    if (isolate->big_linked_list) {
+        isolate->big_linked_list->prev = o;
+    }
+    isolate->big_linked_list = o;
+    if (isolate->sweep.state == sweep_state_lazy) {
+        sweep_lazily(isolate);
     }
-    big_linked_list = o;
     return o;
 }
 
 void free_object_unsafe(object_t *o) {
-    if (o == big_linked_list) {
-        big_linked_list = o->next;
+    toy_isolate_t *isolate = current_isolate;
+    if (o == isolate->big_linked_list) {
+        isolate->big_linked_list = o->next;
     }
     if (o->prev) {
         o->prev->next = o->next;
@@ -28,9 +30,15 @@ void free_object_unsafe(object_t *o) {
     if (o->next) {
         o->next->prev = o->prev;
     }
+    destroy_object(o);
+    isolate->object_count--;
+}
 
+void destroy_object(object_t *o) {
     switch (o->type) {
-    case object_type_list: // fallthrough
+    case object_type_list:
+        free(o->list.items);
+        break;
     case object_type_dict:
         dict_delete_all(&o->dict);
         break;
@@ -39,15 +47,52 @@ void free_object_unsafe(object_t *o) {
         break;
     case object_type_func:
         break;
+    case object_type_float64_array:
+        free(o->float64_array.data);
+        break;
+    case object_type_line_reader:
+        line_reader_free(o->line_reader);
+        break;
     }
     free(o);
-    object_count--;
+}
+
+size_t object_size(const object_t *o) {
+    size_t size = sizeof(*o);
+    switch (o->type) {
+    case object_type_list:
+        return size + sizeof(value_t) * o->list.capacity;
+    case object_type_dict:
+        for (dict_entry_t *e = o->dict; e; e = e->next) {
+            size += sizeof(*e) + strlen(e->key) + 1;
+        }
+        return size;
+    case object_type_string:
+        return size + o->string_length + 1;
+    case object_type_func:
+        return size;
+    case object_type_float64_array:
+        return size + sizeof(double) * o->float64_array.length;
+    case object_type_line_reader:
+        return size + line_reader_size(o->line_reader);
+    }
+    return size;
 }
 
 object_t *new_string_object(const char *cs) {
     object_t *o = new_object();
     o->type = object_type_string;
     o->string = xstrdup(cs);
+    o->string_length = strlen(cs);
+    return o;
+}
+
+// Takes the ownership of `cs`, which is not copied.
+object_t *new_string_object_owned(char *cs) {
+    object_t *o = new_object();
+    o->type = object_type_string;
+    o->string = cs;
+    o->string_length = strlen(cs);
     return o;
 }
 
@@ -59,9 +104,9 @@ object_t *new_dict_object(void) {
 }
 
 object_t *new_list_object(void) {
-    object_t *o = new_dict_object();
+    object_t *o = new_object();
     o->type = object_type_list;
-    dict_set(&o->dict, "length", v_number(0));
+    o->list = (list_t){.items = 0, .length = 0, .capacity = 0};
     return o;
 }
 
@@ -87,3 +132,27 @@ object_t *new_compiled_func_object(compiled_func_t *compiled) {
         .parent_scope = v_null,
     });
 }
+
+object_t *new_float64_array_object(size_t length) {
+    object_t *o = new_object();
+    o->type = object_type_float64_array;
+    o->float64_array = (float64_array_t){
+        .data = xcalloc(length ? length : 1, sizeof(double)),
+        .length = length,
+    };
+    return o;
+}
+
+// Takes the ownership of the reader.
+object_t *new_line_reader_object(struct line_reader *reader) {
+    object_t *o = new_object();
+    o->type = object_type_line_reader;
+    o->line_reader = reader;
+    return o;
+}
+
+value_t create_method(value_t object, native_func_t func) {
+    value_t m = v_native_func(func);
+    m.object->func.parent_scope = object;
+    return m;
+}
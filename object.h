@@ -1,6 +1,8 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include <pthread.h>
+#include <setjmp.h>
 #include "dict.h"
 
 typedef struct object object_t;
@@ -9,13 +11,32 @@ typedef struct func func_t;
 
 typedef value_t (*native_func_t)(value_t parent_scope, value_t arg);
 
+typedef struct list list_t;
+
+struct list {
+    value_t *items;
+    size_t length, capacity;
+};
+
+typedef struct float64_array float64_array_t;
+
+// Contiguous doubles, see `float64_array.c`
+struct float64_array {
+    double *data;
+    size_t length;
+};
+
 enum object_type {
     object_type_dict,
     object_type_list,
     object_type_string,
     object_type_func,
+    object_type_float64_array,
+    object_type_line_reader, // see `io.c`
 };
 
+#define OBJECT_TYPE_COUNT (object_type_line_reader + 1)
+
 struct func {
     struct compiled_func *compiled; // null if native
     native_func_t native;  // null if not native
@@ -31,22 +52,83 @@ struct object {
     object_t *prev, *next; // Garbage collection junk
     int marked, ref_count; // More garbage collection junk
     union {
-        dict_t dict; // This is also used for lists. No, I’m not kidding.
-        char *string;
+        dict_t dict;
+        list_t list;
+        struct {
+            char *string;
+            size_t string_length;
+        };
         func_t func;
+        float64_array_t float64_array;
+        struct line_reader *line_reader;
     };
 };
 
 void free_object_unsafe(object_t *o);
+void destroy_object(object_t *o); // Neither unlinked nor counted
+size_t object_size(const object_t *o); // In bytes, with what it owns
 object_t *new_string_object(const char *cs);
+object_t *new_string_object_owned(char *cs); // `cs` must be malloc'd
 object_t *new_dict_object(void);
 object_t *new_list_object(void);
 object_t *new_native_func_object(native_func_t func);
 object_t *new_compiled_func_object(struct compiled_func *compiled);
+object_t *new_float64_array_object(size_t length); // Filled with zeros
+object_t *new_line_reader_object(struct line_reader *reader);
+
+// Returns a native function bound to `object`, which is passed as the
+// first argument of `func`.
+value_t create_method(value_t object, native_func_t func);
+
+enum sweep_state {
+    sweep_state_done,
+    sweep_state_lazy, // Continued by the allocations
+    sweep_state_background, // By the `sweeper` thread
+};
+
+// Statistics of a collection, see `collect_garbage.c`
+typedef struct gc_stats {
+    unsigned long number; // 1 for the first collection of the isolate
+    const char *reason; // What triggered it
+    unsigned long objects_before;
+    unsigned long marked[OBJECT_TYPE_COUNT], freed[OBJECT_TYPE_COUNT];
+    size_t bytes_freed;
+    double mark_ms, sweep_ms;
+} gc_stats_t;
+
+// The objects of the last collection which are not swept yet. They are
+// out of `big_linked_list`, see `collect_garbage.c`.
+typedef struct sweep {
+    enum sweep_state state;
+    object_t *unswept;
+    object_t *survivors, *last_survivor;
+    unsigned long freed;
+    pthread_t sweeper;
+    gc_stats_t stats; // Of the collection being swept
+} sweep_t;
+
+// The state of an isolate (see `isolate.h`). A thread runs in at most
+// one isolate at a time, `current_isolate`, in which the objects are
+// allocated and collected.
+struct toy_isolate {
+    object_t *big_linked_list; // Contains every allocated object.
+    unsigned long object_count;
+    unsigned long allocation_count_since_last_gc;
+    unsigned long object_count_after_last_gc;
+    sweep_t sweep;
+    unsigned long gc_count;
+    gc_stats_t last_gc; // Of the last collection whose sweep is done
+
+    // Loaded on the first evaluation
+    struct compiled_file *builtin_file;
+    value_t compiler; // The function exported by `compile.js`
+
+    struct scheduler *scheduler; // Of the green threads, see `vm.c`
+
+    jmp_buf *error_handler; // Where `die()` jumps to, if not null
+    char *error;
+};
 
-// These global variables are used by the garbage collector.
-extern object_t *big_linked_list; // Contains every allocated object.
-extern unsigned long object_count;
-extern unsigned long allocation_count_since_last_gc;
+extern __thread struct toy_isolate *current_isolate;
 
 #endif /* OBJECT_H */
@@ -0,0 +1,480 @@
+#include "toy.h"
+#include <unistd.h>
+
+// `parallel.map(list)(func)` calls `func` on each item on several
+// threads, and returns the results in order, like `list.map(func)`.
+//
+// Objects never cross isolates, so each worker thread runs in its own
+// isolate, into which the function (with everything it can reach,
+// scopes included) and then each item are copied. The results are
+// copied back at the end. Side effects on the copies are not visible
+// to the caller.
+//
+// The items are split into ranges, one per worker. A worker takes
+// `parallel.chunk` items at a time from the beginning of its range, and
+// an idle worker steals the second half of the range of another one.
+
+#define CHUNKS_PER_WORKER 8
+
+
+
+//////////////////////////////////////////////////// COPY
+
+
+
+// The copies of the objects and of the compiled files, so that the
+// shared objects stay shared, and the cycles terminate.
+typedef struct copier {
+    struct copy {
+        const void *from;
+        void *to;
+    } *copies;
+    size_t count, capacity; // `capacity` is a power of 2
+} copier_t;
+
+static size_t hash_pointer(const void *p) {
+    uintptr_t n = (uintptr_t)p;
+    return (n >> 4) ^ (n >> 12);
+}
+
+static void **copier_slot(copier_t *c, const void *from) {
+    size_t mask = c->capacity - 1;
+    for (size_t i = hash_pointer(from) & mask;; i = (i + 1) & mask) {
+        if (!c->copies[i].from || c->copies[i].from == from) {
+            c->copies[i].from = from;
+            return &c->copies[i].to;
+        }
+    }
+}
+
+static void copier_grow(copier_t *c) {
+    struct copy *old = c->copies;
+    size_t old_capacity = c->capacity;
+    c->capacity = c->capacity ? c->capacity * 2 : 64;
+    c->copies = xcalloc(c->capacity, sizeof(struct copy));
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].from) {
+            *copier_slot(c, old[i].from) = old[i].to;
+        }
+    }
+    free(old);
+}
+
+static void *copier_get(copier_t *c, const void *from) {
+    return c->count ? *copier_slot(c, from) : NULL;
+}
+
+static void copier_add(copier_t *c, const void *from, void *to) {
+    if (2 * (c->count + 1) > c->capacity) {
+        copier_grow(c);
+    }
+    *copier_slot(c, from) = to;
+    c->count++;
+}
+
+static void copier_clear(copier_t *c) {
+    if (c->count) {
+        memset(c->copies, 0, sizeof(struct copy) * c->capacity);
+        c->count = 0;
+    }
+}
+
+// The copied files of a worker, freed with its isolate
+typedef struct file_copies {
+    copier_t copier;
+    compiled_file_t **files;
+    size_t count;
+    value_t keep; // Keeps the constants of the copies alive
+} file_copies_t;
+
+static value_t copy_value(copier_t *c, file_copies_t *files, value_t v);
+
+static compiled_file_t *copy_file(file_copies_t *files,
+                                  const compiled_file_t *from) {
+    compiled_file_t *file = copier_get(&files->copier, from);
+    if (file) {
+        return file;
+    }
+
+    file = xmalloc(sizeof(*file));
+    *file = (compiled_file_t){
+        .funcs = xmalloc(sizeof(compiled_func_t *) * from->func_count),
+        .func_count = from->func_count,
+        .source = v_null,
+        .compiler = v_null,
+    };
+    copier_add(&files->copier, from, file);
+    files->files = xrealloc(files->files,
+                            sizeof(compiled_file_t *) * (files->count + 1));
+    files->files[files->count++] = file;
+
+    copier_t consts = {0};
+    for (size_t i = 0; i < from->func_count; i++) {
+        const compiled_func_t *f = from->funcs[i];
+        if (f->aot) {
+            die("parallel.map(): cannot copy ahead-of-time compiled code");
+        }
+        if (!f->code) {
+            die("parallel.map(): cannot copy a function of another file");
+        }
+        compiled_func_t *func = xmalloc(sizeof(*func));
+        *func = *f;
+        func->file = file;
+        func->param_name = f->param_name ? xstrdup(f->param_name) : 0;
+        func->name = f->name ? xstrdup(f->name) : 0;
+        func->lines = xmalloc(sizeof(uint32_t) * (2 * f->line_count | 1));
+        if (f->line_count) {
+            memcpy(func->lines, f->lines,
+                   sizeof(uint32_t) * 2 * f->line_count);
+        }
+        func->code = xmalloc(f->code_length);
+        memcpy(func->code, f->code, f->code_length);
+        func->consts = xmalloc(sizeof(value_t) * f->const_count);
+        for (size_t j = 0; j < f->const_count; j++) {
+            func->consts[j] = copy_value(&consts, files, f->consts[j]);
+        }
+        func->jit = 0;
+        func->hotness = 0;
+        file->funcs[i] = func;
+    }
+    free(consts.copies);
+
+    value_t entry = {
+        .type = value_type_object,
+        .object = new_compiled_func_object(file->funcs[0]),
+    };
+    v_list_push(files->keep, entry);
+    return file;
+}
+
+static object_t *copy_object(copier_t *c, file_copies_t *files,
+                             const object_t *from) {
+    object_t *o = copier_get(c, from);
+    if (o) {
+        return o;
+    }
+
+    switch (from->type) {
+    case object_type_string: {
+        char *s = xmalloc(from->string_length + 1);
+        memcpy(s, from->string, from->string_length + 1);
+        o = new_string_object_owned(s);
+        o->string_length = from->string_length;
+        copier_add(c, from, o);
+        break;
+    }
+    case object_type_list: {
+        const list_t *list = &from->list;
+        o = new_list_object();
+        copier_add(c, from, o);
+        if (list->length) {
+            o->list.items = xmalloc(sizeof(value_t) * list->length);
+            o->list.capacity = list->length;
+        }
+        for (size_t i = 0; i < list->length; i++) {
+            o->list.items[i] = copy_value(c, files, list->items[i]);
+            o->list.length++;
+        }
+        break;
+    }
+    case object_type_dict: {
+        o = new_dict_object();
+        copier_add(c, from, o);
+        const dict_entry_t *e = from->dict;
+        while (e && e->next) {
+            e = e->next;
+        }
+        // From the oldest entry, to keep the order
+        for (; e; e = e->prev) {
+            dict_set_new(&o->dict, e->key, copy_value(c, files, e->value));
+        }
+        break;
+    }
+    case object_type_func: {
+        const compiled_func_t *compiled = from->func.compiled;
+        if (compiled) {
+            compiled_file_t *file = copy_file(files, compiled->file);
+            size_t i = 0;
+            while (compiled->file->funcs[i] != compiled) {
+                i++;
+            }
+            o = new_compiled_func_object(file->funcs[i]);
+        } else {
+            o = new_native_func_object(from->func.native);
+        }
+        copier_add(c, from, o);
+        o->func.parent_scope = copy_value(c, files,
+                                          from->func.parent_scope);
+        break;
+    }
+    case object_type_float64_array: {
+        size_t length = from->float64_array.length;
+        o = new_float64_array_object(length);
+        memcpy(o->float64_array.data, from->float64_array.data,
+               sizeof(double) * length);
+        copier_add(c, from, o);
+        break;
+    }
+    case object_type_line_reader:
+        die("parallel.map(): cannot copy a file reader");
+    }
+    return o;
+}
+
+static value_t copy_value(copier_t *c, file_copies_t *files, value_t v) {
+    if (!v_is_object(v)) {
+        return v;
+    }
+    return (value_t){
+        .type = value_type_object,
+        .object = copy_object(c, files, v.object),
+    };
+}
+
+// Compiles the lazy functions of the file of `func`, and the ones they
+// contain, so that the workers need no compiler.
+static void compile_file(value_t func) {
+    const compiled_func_t *compiled = func.object->func.compiled;
+    if (!compiled) {
+        return;
+    }
+    compiled_file_t *file = compiled->file;
+    for (size_t i = 0; i < file->func_count; i++) {
+        if (!file->funcs[i]->code) {
+            compile_lazily(file->funcs[i]);
+        }
+    }
+}
+
+
+
+//////////////////////////////////////////////////// WORKERS
+
+
+
+typedef struct job job_t;
+
+typedef struct worker {
+    job_t *job;
+    pthread_t thread;
+    toy_isolate_t *isolate;
+    file_copies_t files;
+
+    pthread_mutex_t mutex;
+    size_t begin, end; // The remaining items
+} worker_t;
+
+struct job {
+    const list_t *items;
+    value_t func;
+    value_t *results; // In the isolates of the workers
+    size_t chunk;
+    worker_t *workers;
+    unsigned worker_count;
+    int failed;
+};
+
+// Takes the next chunk of the range of the worker.
+static int take_chunk(worker_t *w, size_t *begin, size_t *end) {
+    pthread_mutex_lock(&w->mutex);
+    *begin = w->begin;
+    *end = w->begin + w->job->chunk < w->end ?
+        w->begin + w->job->chunk : w->end;
+    w->begin = *end;
+    pthread_mutex_unlock(&w->mutex);
+    return *begin < *end;
+}
+
+// Steals the second half of the range of another worker.
+static int steal(worker_t *w) {
+    job_t *job = w->job;
+    unsigned index = w - job->workers;
+    for (unsigned i = 1; i < job->worker_count; i++) {
+        worker_t *victim = &job->workers[(index + i) % job->worker_count];
+        pthread_mutex_lock(&victim->mutex);
+        size_t middle = victim->begin + (victim->end - victim->begin) / 2;
+        size_t end = victim->end;
+        victim->end = middle < end ? middle : end;
+        pthread_mutex_unlock(&victim->mutex);
+        if (middle < end) {
+            pthread_mutex_lock(&w->mutex);
+            w->begin = middle;
+            w->end = end;
+            pthread_mutex_unlock(&w->mutex);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void work(void *data) {
+    worker_t *w = data;
+    job_t *job = w->job;
+    w->files.keep = v_list();
+    v_inc_ref(w->files.keep);
+    value_t results = v_list();
+    v_inc_ref(results);
+
+    copier_t copier = {0};
+    value_t func = copy_value(&copier, &w->files, job->func);
+    v_inc_ref(func);
+
+    size_t begin, end;
+    while (take_chunk(w, &begin, &end) || (steal(w) &&
+                                           take_chunk(w, &begin, &end))) {
+        for (size_t i = begin; i < end; i++) {
+            if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+                free(copier.copies);
+                return;
+            }
+            copier_clear(&copier);
+            value_t item = copy_value(&copier, &w->files,
+                                      job->items->items[i]);
+            value_t result = call_func(func, item);
+            v_list_push(results, result);
+            job->results[i] = result;
+        }
+    }
+    free(copier.copies);
+}
+
+static void *run_worker(void *data) {
+    worker_t *w = data;
+    if (isolate_run(w->isolate, work, w)) {
+        __atomic_store_n(&w->job->failed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void free_worker(worker_t *w) {
+    toy_isolate_free(w->isolate);
+    for (size_t i = 0; i < w->files.count; i++) {
+        free_compiled_file(w->files.files[i]);
+    }
+    free(w->files.files);
+    free(w->files.copier.copies);
+    pthread_mutex_destroy(&w->mutex);
+}
+
+static unsigned default_worker_count(void) {
+    const char *s = getenv("TOY_PARALLEL_WORKERS");
+    long count = s ? strtol(s, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+}
+
+// The context is `[parallel, list]`.
+static value_t parallel_map_with(value_t ctx, value_t func) {
+    value_t vparallel = ctx.object->list.items[0];
+    value_t list = ctx.object->list.items[1];
+    v_assert_type(list, list);
+    if (!v_is_func(func)) {
+        die("parallel.map(): not a function");
+    }
+    v_inc_ref(list);
+    v_inc_ref(func);
+    compile_file(func);
+
+    size_t length = list.object->list.length;
+    value_t vworkers = v_get(vparallel, v_string("workers"));
+    long count = v_is_null(vworkers) ? (long)default_worker_count() :
+        v_to_integer(vworkers);
+    count = (size_t)count < length ? count : (long)length;
+    count = count > 0 ? count : 1;
+    value_t vchunk = v_get(vparallel, v_string("chunk"));
+    long chunk = v_is_null(vchunk) ?
+        (long)(length / (count * CHUNKS_PER_WORKER)) : v_to_integer(vchunk);
+
+    job_t job = {
+        .items = &list.object->list,
+        .func = func,
+        .results = xcalloc(length ? length : 1, sizeof(value_t)),
+        .chunk = chunk > 0 ? chunk : 1,
+        .workers = xcalloc(count, sizeof(worker_t)),
+        .worker_count = count,
+        .failed = 0,
+    };
+    for (long i = 0; i < count; i++) {
+        worker_t *w = &job.workers[i];
+        w->job = &job;
+        w->isolate = toy_isolate_new();
+        pthread_mutex_init(&w->mutex, NULL);
+        w->begin = length * i / count;
+        w->end = length * (i + 1) / count;
+    }
+
+    // The current thread is the first worker.
+    for (long i = 1; i < count; i++) {
+        if (pthread_create(&job.workers[i].thread, NULL, run_worker,
+                           &job.workers[i])) {
+            die("parallel.map(): cannot create a thread");
+        }
+    }
+    run_worker(&job.workers[0]);
+    for (long i = 1; i < count; i++) {
+        pthread_join(job.workers[i].thread, NULL);
+    }
+
+    const char *error = 0;
+    for (long i = 0; i < count && !error; i++) {
+        error = toy_isolate_error(job.workers[i].isolate);
+    }
+    value_t results = v_null;
+    char *message = 0;
+    if (error) {
+        message = xmalloc(strlen(error) + 32);
+        sprintf(message, "parallel.map(): %s", error);
+    } else {
+        results = v_list();
+        list_t *l = &results.object->list;
+        l->items = xmalloc(sizeof(value_t) * (length ? length : 1));
+        l->capacity = length ? length : 1;
+        copier_t copier = {0};
+        file_copies_t files = {.keep = v_list()};
+        v_inc_ref(files.keep);
+        for (size_t i = 0; i < length; i++) {
+            copier_clear(&copier);
+            l->items[l->length++] = copy_value(&copier, &files,
+                                               job.results[i]);
+        }
+        v_dec_ref(files.keep);
+        free(copier.copies);
+        free(files.copier.copies);
+        if (files.count) {
+            // The copies are garbage, and the isolate can only be freed
+            // after `die()`.
+            message = xstrdup("parallel.map(): cannot return a function");
+            for (size_t i = 0; i < files.count; i++) {
+                free_compiled_file(files.files[i]);
+            }
+        }
+        free(files.files);
+    }
+
+    for (long i = 0; i < count; i++) {
+        free_worker(&job.workers[i]);
+    }
+    free(job.workers);
+    free(job.results);
+    v_dec_ref(list);
+    v_dec_ref(func);
+    if (message) {
+        current_frame = 0; // The errors of the workers are located already
+        die(message);
+    }
+    return results;
+}
+
+static value_t parallel_map(value_t vparallel, value_t list) {
+    value_t ctx = v_list();
+    v_list_push(ctx, vparallel);
+    v_list_push(ctx, list);
+    return create_method(ctx, parallel_map_with);
+}
+
+value_t get_parallel(void) {
+    value_t parallel = v_dict();
+    v_set(parallel, v_string("map"), create_method(parallel, parallel_map));
+    v_set(parallel, v_string("workers"), v_null);
+    v_set(parallel, v_string("chunk"), v_null);
+    return parallel;
+}
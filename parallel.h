@@ -0,0 +1,10 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "value.h"
+
+// Returns the global `parallel` dict, with `map`, and the `workers` and
+// `chunk` settings (null by default, see `parallel.c`).
+value_t get_parallel(void);
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,316 @@
+#include "toy.h"
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#  include <x86intrin.h>
+#endif
+
+// Each thread counts the opcodes it dispatches, and the pairs of
+// consecutive opcodes (the candidates for superinstructions), in its own
+// tables. Reading the clock at each dispatch would be too slow, so the
+// time of one dispatch out of `SAMPLE_PERIOD` is measured: from the
+// beginning of that opcode to the beginning of the next one, in the
+// current frame or not. So the time of a call is the time before the
+// first opcode of the callee, and the pauses of the GC are counted in
+// the opcode before them.
+
+#define SAMPLE_PERIOD 16
+
+#if defined(__x86_64__)
+#  define TICK_UNIT "cycles"
+static inline uint64_t read_ticks(void) {
+    return __rdtsc();
+}
+#else
+#  define TICK_UNIT "ns"
+static inline uint64_t read_ticks(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+#endif
+
+typedef struct profile profile_t;
+
+struct profile {
+    uint64_t counts[opcode__count];
+    uint64_t samples[opcode__count];
+    uint64_t ticks[opcode__count]; // Of the samples
+    uint64_t pairs[opcode__count][opcode__count];
+    uint64_t dispatched;
+    int previous; // -1 before the first opcode
+    int sampled; // The opcode being measured, or -1
+    uint64_t sample_start;
+    profile_t *next;
+};
+
+int profile_hooks = 0;
+static int json_output;
+
+// Tables of all the threads, kept until the exit
+static profile_t *profiles;
+static pthread_mutex_t profiles_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread profile_t *current_profile;
+
+static profile_t *get_profile(void) {
+    if (!current_profile) {
+        profile_t *p = xcalloc(1, sizeof(*p));
+        p->previous = -1;
+        p->sampled = -1;
+        pthread_mutex_lock(&profiles_mutex);
+        p->next = profiles;
+        profiles = p;
+        pthread_mutex_unlock(&profiles_mutex);
+        current_profile = p;
+    }
+    return current_profile;
+}
+
+static void profile_opcode(enum opcode opcode) {
+    profile_t *p = get_profile();
+    if (p->sampled >= 0) {
+        p->samples[p->sampled]++;
+        p->ticks[p->sampled] += read_ticks() - p->sample_start;
+        p->sampled = -1;
+    }
+    p->counts[opcode]++;
+    if (p->previous >= 0) {
+        p->pairs[p->previous][opcode]++;
+    }
+    p->previous = opcode;
+    if (++p->dispatched % SAMPLE_PERIOD == 0) {
+        p->sampled = opcode;
+        p->sample_start = read_ticks();
+    }
+}
+
+typedef struct {
+    int opcode;
+    uint64_t count, samples, ticks;
+    double total; // Estimated ticks of all the dispatches
+} opcode_row_t;
+
+typedef struct {
+    int first, second;
+    uint64_t count;
+} pair_row_t;
+
+static int compare_opcode_rows(const void *a, const void *b) {
+    const opcode_row_t *x = a, *y = b;
+    if (x->total != y->total) {
+        return x->total < y->total ? 1 : -1;
+    }
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+static int compare_pair_rows(const void *a, const void *b) {
+    const pair_row_t *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+#define MAX_PAIRS 20
+
+static void print_profile(void) {
+    static opcode_row_t rows[opcode__count];
+    static pair_row_t pairs[opcode__count * opcode__count];
+    uint64_t dispatched = 0;
+    double total_ticks = 0;
+    size_t row_count = 0, pair_count = 0;
+
+    pthread_mutex_lock(&profiles_mutex);
+    for (int i = 0; i < opcode__count; i++) {
+        opcode_row_t row = {.opcode = i};
+        for (profile_t *p = profiles; p; p = p->next) {
+            row.count += p->counts[i];
+            row.samples += p->samples[i];
+            row.ticks += p->ticks[i];
+        }
+        if (!row.count) {
+            continue;
+        }
+        if (row.samples) {
+            row.total = (double)row.ticks / row.samples * row.count;
+        }
+        dispatched += row.count;
+        total_ticks += row.total;
+        rows[row_count++] = row;
+        for (int j = 0; j < opcode__count; j++) {
+            pair_row_t pair = {.first = i, .second = j};
+            for (profile_t *p = profiles; p; p = p->next) {
+                pair.count += p->pairs[i][j];
+            }
+            if (pair.count) {
+                pairs[pair_count++] = pair;
+            }
+        }
+    }
+    pthread_mutex_unlock(&profiles_mutex);
+
+    qsort(rows, row_count, sizeof(*rows), compare_opcode_rows);
+    qsort(pairs, pair_count, sizeof(*pairs), compare_pair_rows);
+    if (pair_count > MAX_PAIRS) {
+        pair_count = MAX_PAIRS;
+    }
+
+    if (json_output) {
+        fprintf(stderr, "{\"unit\": \"" TICK_UNIT "\", "
+                "\"dispatched\": %" PRIu64 ", \"opcodes\": [", dispatched);
+        for (size_t i = 0; i < row_count; i++) {
+            opcode_row_t *r = rows + i;
+            fprintf(stderr, "%s\n  {\"name\": \"%s\", \"count\": %" PRIu64
+                    ", \"samples\": %" PRIu64 ", \"ticks\": %.0f}",
+                    i ? "," : "", opcode_to_string(r->opcode), r->count,
+                    r->samples, r->total);
+        }
+        fprintf(stderr, "], \"pairs\": [");
+        for (size_t i = 0; i < pair_count; i++) {
+            fprintf(stderr, "%s\n  {\"first\": \"%s\", \"second\": \"%s\", "
+                    "\"count\": %" PRIu64 "}", i ? "," : "",
+                    opcode_to_string(pairs[i].first),
+                    opcode_to_string(pairs[i].second), pairs[i].count);
+        }
+        fprintf(stderr, "]}\n");
+        return;
+    }
+
+    fprintf(stderr, "%-24s %14s %7s %10s %7s\n", "opcode", "count", "%",
+            TICK_UNIT "/op", "% time");
+    for (size_t i = 0; i < row_count; i++) {
+        opcode_row_t *r = rows + i;
+        fprintf(stderr, "%-24s %14" PRIu64 " %6.2f%% %10.1f %6.2f%%\n",
+                opcode_to_string(r->opcode), r->count,
+                100.0 * r->count / dispatched,
+                r->samples ? (double)r->ticks / r->samples : 0.0,
+                total_ticks ? 100 * r->total / total_ticks : 0.0);
+    }
+    fprintf(stderr, "\n%-49s %14s %7s\n", "pair", "count", "%");
+    for (size_t i = 0; i < pair_count; i++) {
+        fprintf(stderr, "%-24s %-24s %14" PRIu64 " %6.2f%%\n",
+                opcode_to_string(pairs[i].first),
+                opcode_to_string(pairs[i].second), pairs[i].count,
+                100.0 * pairs[i].count / dispatched);
+    }
+}
+
+// The sampling profiler. `SIGPROF` is sent every millisecond of CPU
+// time, and its handler asks for a sample. The thread which dispatches
+// the next opcode takes it: it walks its chain of VM frames and counts
+// the stack, like `main:12;fib:3;fib:3` (the name of each function and
+// the line it is at, outermost first). Since samples are taken between
+// two instructions, the time of a native function goes to the
+// instruction after its call, which is on the same line most of the
+// time. Frames of the builtin compiler are included.
+//
+// The stacks are printed with their counts in the "folded" format of
+// `flamegraph.pl` and similar tools.
+
+#define SAMPLE_INTERVAL_US 1000
+#define MAX_SAMPLE_DEPTH 256
+
+static dict_t stack_counts; // Of type integer
+static pthread_mutex_t stack_counts_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void handle_sigprof(int signal) {
+    (void)signal;
+    __atomic_fetch_or(&profile_hooks, profile_hook_sample, __ATOMIC_RELAXED);
+}
+
+static void take_sample(void) {
+    const vm_frame_t *frames[MAX_SAMPLE_DEPTH];
+    size_t depth = 0;
+    for (const vm_frame_t *f = current_frame; f; f = f->parent) {
+        if (depth == MAX_SAMPLE_DEPTH) {
+            depth--; // Keeps the outermost frame
+        }
+        frames[depth++] = f;
+    }
+
+    size_t capacity = 64, length = 0;
+    char *stack = xmalloc(capacity);
+    while (depth--) {
+        const compiled_func_t *func = frames[depth]->func;
+        char frame[128];
+        int n = snprintf(frame, sizeof(frame), "%s%s:%u", length ? ";" : "",
+                         func->name ? func->name : "anonymous",
+                         func_line(func, frames[depth]->ip));
+        if (n >= (int)sizeof(frame)) {
+            n = sizeof(frame) - 1;
+        }
+        while (length + n + 1 > capacity) {
+            capacity *= 2;
+            stack = xrealloc(stack, capacity);
+        }
+        memcpy(stack + length, frame, n);
+        length += n;
+    }
+    stack[length] = 0;
+
+    pthread_mutex_lock(&stack_counts_mutex);
+    value_t count = dict_get(&stack_counts, stack);
+    int64_t previous = v_is_null(count) ? 0 : count.integer;
+    dict_set(&stack_counts, stack, v_integer(previous + 1));
+    pthread_mutex_unlock(&stack_counts_mutex);
+    free(stack);
+}
+
+static void print_samples(void) {
+    struct itimerval stop = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_PROF, &stop, NULL);
+    pthread_mutex_lock(&stack_counts_mutex);
+    dict_entry_t *last = stack_counts;
+    while (last && last->next) {
+        last = last->next;
+    }
+    for (dict_entry_t *e = last; e; e = e->prev) { // In insertion order
+        fprintf(stderr, "%s %" PRId64 "\n", e->key, e->value.integer);
+    }
+    pthread_mutex_unlock(&stack_counts_mutex);
+}
+
+static void start_sampling(void) {
+    struct sigaction action = {.sa_handler = handle_sigprof};
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    struct itimerval interval = {
+        .it_interval = {0, SAMPLE_INTERVAL_US},
+        .it_value = {0, SAMPLE_INTERVAL_US},
+    };
+    setitimer(ITIMER_PROF, &interval, NULL);
+    atexit(print_samples);
+}
+
+void profile_dispatch(enum opcode opcode) {
+    int hooks = profile_hooks;
+    if (hooks & profile_hook_sample) {
+        __atomic_fetch_and(&profile_hooks, ~profile_hook_sample,
+                           __ATOMIC_RELAXED);
+        take_sample();
+    }
+    if (hooks & profile_hook_opcodes) {
+        profile_opcode(opcode);
+    }
+}
+
+static void init_once(void) {
+    const char *s = getenv("TOY_PROFILE");
+    if (!s) {
+        return;
+    }
+    if (strcmp(s, "opcodes") == 0 || strcmp(s, "opcodes-json") == 0) {
+        json_output = s[7] != 0;
+        profile_hooks = profile_hook_opcodes;
+        atexit(print_profile);
+    }
+    if (strcmp(s, "samples") == 0) {
+        start_sampling();
+    }
+}
+
+void init_profile(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_once);
+}
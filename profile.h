@@ -0,0 +1,33 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "vm.h"
+
+// Profilers, enabled by the `TOY_PROFILE` environment variable, whose
+// reports are printed to the standard error at exit. See `profile.c`.
+//
+// - `opcodes` (or `opcodes-json`): opcode counts and timings
+// - `samples`: folded stacks of the interpreted functions
+
+enum {
+    profile_hook_opcodes = 1,
+    profile_hook_sample = 2, // Set by the `SIGPROF` handler
+};
+
+extern int profile_hooks;
+
+void init_profile(void);
+
+// Called by the interpreter loops before executing `opcode`, once the
+// `ip` of the current frame has been updated.
+void profile_dispatch(enum opcode opcode);
+
+// A single predictable branch when the profilers are disabled
+#define PROFILE_OPCODE(opcode)                          \
+    do {                                                \
+        if (__builtin_expect(profile_hooks, 0)) {       \
+            profile_dispatch(opcode);                   \
+        }                                               \
+    } while (0)
+
+#endif /* PROFILE_H */
@@ -0,0 +1,824 @@
+#include "toy.h"
+#include "simd.h"
+
+// Each kernel has a portable version, and vectorized versions on
+// x86-64. The numeric kernels exist in SSE2 and AVX2, the string
+// kernels in SSE4.2 and AVX2. The best level supported by the CPU is
+// used, unless `TOY_SIMD` asks for a lower one (see `simd_force_level()`).
+
+enum simd_level {
+    simd_level_scalar,
+    simd_level_sse2,
+    simd_level_sse42,
+    simd_level_avx2,
+};
+
+static const char *const level_names[] = {"scalar", "sse2", "sse4.2", "avx2"};
+
+#if defined(__x86_64__)
+#  include <immintrin.h>
+#  define SSE42 __attribute__((target("sse4.2")))
+#  define AVX2 __attribute__((target("avx2")))
+#endif
+
+static int level = -1;
+
+static enum simd_level get_supported_level(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? simd_level_avx2 :
+        __builtin_cpu_supports("sse4.2") ? simd_level_sse42 :
+        simd_level_sse2;
+#else
+    return simd_level_scalar;
+#endif
+}
+
+int simd_force_level(const char *name) {
+    enum simd_level supported = get_supported_level();
+    for (int i = 0; i <= (int)supported; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            level = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void init_level(void) {
+    if (level >= 0) {
+        return; // Already forced
+    }
+    const char *forced = getenv("TOY_SIMD");
+    if (!forced || !simd_force_level(forced)) {
+        level = get_supported_level();
+    }
+}
+
+static enum simd_level get_level(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_level);
+    return level;
+}
+
+const char *simd_level_name(void) {
+    return level_names[get_level()];
+}
+
+
+
+//////////////////////////////////////////////////// PORTABLE
+
+
+
+static double scalar_sum(const double *a, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+static double scalar_min(const double *a, size_t n) {
+    double min = a[0];
+    for (size_t i = 1; i < n; i++) {
+        min = a[i] < min ? a[i] : min;
+    }
+    return min;
+}
+
+static double scalar_max(const double *a, size_t n) {
+    double max = a[0];
+    for (size_t i = 1; i < n; i++) {
+        max = a[i] > max ? a[i] : max;
+    }
+    return max;
+}
+
+static double scalar_dot(const double *a, const double *b, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static double apply_op(enum simd_op op, double a, double b) {
+    switch (op) {
+    case simd_op_add: return a + b;
+    case simd_op_sub: return a - b;
+    case simd_op_mul: return a * b;
+    case simd_op_div: return a / b;
+    }
+    abort();
+}
+
+static void scalar_scalar_op(enum simd_op op, double *dst, const double *a,
+                             double x, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = apply_op(op, a[i], x);
+    }
+}
+
+static void scalar_vector_op(enum simd_op op, double *dst, const double *a,
+                             const double *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = apply_op(op, a[i], b[i]);
+    }
+}
+
+static int set_has(const simd_byte_set_t *set, unsigned char c) {
+    const unsigned char *rows = c < 0x80 ? set->low : set->high;
+    return rows[c & 15] >> (c >> 4 & 7) & 1;
+}
+
+static size_t scalar_find_in_set(const simd_byte_set_t *set, const char *s,
+                                 size_t n, int negate) {
+    for (size_t i = 0; i < n; i++) {
+        if (set_has(set, s[i]) != negate) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static size_t scalar_find_substring(const char *haystack, size_t n,
+                                    const char *needle, size_t k) {
+    if (!k) {
+        return 0;
+    }
+    if (k > n) {
+        return SIZE_MAX;
+    }
+    const char *p = haystack, *last = haystack + n - k;
+    while ((p = memchr(p, needle[0], last - p + 1))) {
+        if (memcmp(p, needle, k) == 0) {
+            return p - haystack;
+        }
+        p++;
+    }
+    return SIZE_MAX;
+}
+
+// Returns the length of the valid UTF-8 sequence at the beginning of
+// `s`, or zero. Overlong encodings, surrogates and code points above
+// U+10FFFF are invalid.
+static size_t utf8_sequence_length(const unsigned char *s, size_t n) {
+    unsigned char c = s[0];
+    if (c < 0x80) {
+        return 1;
+    }
+    size_t length;
+    unsigned char min = 0x80, max = 0xbf; // Range of the second byte
+    if (c >= 0xc2 && c <= 0xdf) {
+        length = 2;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        length = 3;
+        min = c == 0xe0 ? 0xa0 : min;
+        max = c == 0xed ? 0x9f : max;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        length = 4;
+        min = c == 0xf0 ? 0x90 : min;
+        max = c == 0xf4 ? 0x8f : max;
+    } else {
+        return 0;
+    }
+    if (length > n || s[1] < min || s[1] > max) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+static int scalar_is_valid_utf8(const char *s, size_t n) {
+    for (size_t i = 0; i < n;) {
+        size_t length = utf8_sequence_length((const unsigned char *)s + i,
+                                             n - i);
+        if (!length) {
+            return 0;
+        }
+        i += length;
+    }
+    return 1;
+}
+
+
+
+#if defined(__x86_64__)
+
+//////////////////////////////////////////////////// SSE2
+
+
+
+// Four accumulators hide the latency of the additions.
+static double sse2_sum(const double *a, size_t n) {
+    __m128d s0 = _mm_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+        s2 = _mm_add_pd(s2, _mm_loadu_pd(a + i + 4));
+        s3 = _mm_add_pd(s3, _mm_loadu_pd(a + i + 6));
+    }
+    __m128d s = _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3));
+    double lanes[2];
+    _mm_storeu_pd(lanes, s);
+    return lanes[0] + lanes[1] + scalar_sum(a + i, n - i);
+}
+
+#define define_sse2_extremum(name, op, compare)                         \
+    static double sse2_##name(const double *a, size_t n) {              \
+        if (n < 2) {                                                    \
+            return a[0];                                                \
+        }                                                               \
+        __m128d m = _mm_loadu_pd(a);                                    \
+        size_t i = 2;                                                   \
+        for (; i + 2 <= n; i += 2) {                                    \
+            m = op(m, _mm_loadu_pd(a + i));                             \
+        }                                                               \
+        double lanes[2];                                                \
+        _mm_storeu_pd(lanes, m);                                        \
+        double result = lanes[0] compare lanes[1] ? lanes[0] : lanes[1]; \
+        for (; i < n; i++) {                                            \
+            result = a[i] compare result ? a[i] : result;               \
+        }                                                               \
+        return result;                                                  \
+    }
+
+define_sse2_extremum(min, _mm_min_pd, <)
+define_sse2_extremum(max, _mm_max_pd, >)
+
+static double sse2_dot(const double *a, const double *b, size_t n) {
+    __m128d s0 = _mm_setzero_pd(), s1 = s0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i),
+                                       _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2),
+                                       _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+    return lanes[0] + lanes[1] + scalar_dot(a + i, b + i, n - i);
+}
+
+static __m128d sse2_apply_op(enum simd_op op, __m128d a, __m128d b) {
+    switch (op) {
+    case simd_op_add: return _mm_add_pd(a, b);
+    case simd_op_sub: return _mm_sub_pd(a, b);
+    case simd_op_mul: return _mm_mul_pd(a, b);
+    case simd_op_div: return _mm_div_pd(a, b);
+    }
+    abort();
+}
+
+static void sse2_scalar_op(enum simd_op op, double *dst, const double *a,
+                           double x, size_t n) {
+    __m128d vx = _mm_set1_pd(x);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(dst + i, sse2_apply_op(op, _mm_loadu_pd(a + i), vx));
+    }
+    scalar_scalar_op(op, dst + i, a + i, x, n - i);
+}
+
+static void sse2_vector_op(enum simd_op op, double *dst, const double *a,
+                           const double *b, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(dst + i, sse2_apply_op(op, _mm_loadu_pd(a + i),
+                                             _mm_loadu_pd(b + i)));
+    }
+    scalar_vector_op(op, dst + i, a + i, b + i, n - i);
+}
+
+
+
+//////////////////////////////////////////////////// SSE4.2
+
+
+
+// A byte is in the set if its bit in the row selected by its low nibble
+// is set. Both rows are looked up with `pshufb`, and the sign bit of the
+// byte selects the right one.
+SSE42 static size_t sse42_find_in_set(const simd_byte_set_t *set,
+                                      const char *s, size_t n, int negate) {
+    const __m128i low = _mm_loadu_si128((const __m128i *)set->low);
+    const __m128i high = _mm_loadu_si128((const __m128i *)set->high);
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                       1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    unsigned flip = negate ? 0xffff : 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i lo = _mm_and_si128(v, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i rows = _mm_blendv_epi8(_mm_shuffle_epi8(low, lo),
+                                       _mm_shuffle_epi8(high, lo), v);
+        __m128i bit = _mm_shuffle_epi8(bits, hi);
+        __m128i match = _mm_cmpeq_epi8(_mm_and_si128(rows, bit), bit);
+        unsigned mask = _mm_movemask_epi8(match) ^ flip;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scalar_find_in_set(set, s + i, n - i, negate);
+}
+
+// Compares the first and the last bytes of the needle with 16 positions
+// at once, and only checks the candidates which match both.
+SSE42 static size_t sse42_find_substring(const char *haystack, size_t n,
+                                         const char *needle, size_t k) {
+    if (k < 2 || k > n) {
+        return scalar_find_substring(haystack, n, needle, k);
+    }
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        const char *p = haystack + i;
+        __m128i f = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)p));
+        __m128i l = _mm_cmpeq_epi8(
+            last, _mm_loadu_si128((const __m128i *)(p + k - 1)));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(f, l));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(p + bit + 1, needle + 1, k - 2) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = scalar_find_substring(haystack + i, n - i, needle, k);
+    return rest == SIZE_MAX ? rest : i + rest;
+}
+
+// UTF-8 validation with lookup tables, after "Validating UTF-8 In Less
+// Than One Instruction Per Byte" (Keiser and Lemire). The high nibble
+// of the previous byte, its low nibble and the high nibble of the
+// current byte each select a set of possible errors, and there is an
+// error if the three sets intersect. The tables are shared by the SSE4.2
+// and AVX2 versions.
+
+#define TOO_SHORT (1 << 0)      // 11______ 0_______ or 11______ 11______
+#define TOO_LONG (1 << 1)       // 0_______ 10______
+#define OVERLONG_3 (1 << 2)     // 11100000 100_____
+#define TOO_LARGE (1 << 3)      // 11110100 1001____ and more
+#define SURROGATE (1 << 4)      // 11101101 101_____
+#define OVERLONG_2 (1 << 5)     // 1100000_ 10______
+#define TOO_LARGE_1000 (1 << 6) // 11110101 1000____ and more
+#define OVERLONG_4 (1 << 6)     // 11110000 1000____
+#define TWO_CONTS (1 << 7)      // 10______ 10______
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define BYTE_1_HIGH                                                     \
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,                             \
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,                         \
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,                     \
+        TOO_SHORT | OVERLONG_2,                                         \
+        TOO_SHORT,                                                      \
+        TOO_SHORT | OVERLONG_3 | SURROGATE,                             \
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define BYTE_1_LOW                                                      \
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,                       \
+        CARRY | OVERLONG_2,                                             \
+        CARRY,                                                          \
+        CARRY,                                                          \
+        CARRY | TOO_LARGE,                                              \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,                 \
+        CARRY | TOO_LARGE | TOO_LARGE_1000,                             \
+        CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define BYTE_2_HIGH                                                     \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,                         \
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,                     \
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 |                \
+        TOO_LARGE_1000 | OVERLONG_4,                                    \
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,     \
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,      \
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,      \
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+// Last bytes of a block which start a sequence which does not fit in it
+#define INCOMPLETE_16                                                   \
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,                 \
+        0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+
+typedef struct sse42_utf8 {
+    __m128i error, prev_input, prev_incomplete;
+} sse42_utf8_t;
+
+SSE42 static __m128i sse42_high_nibbles(__m128i v) {
+    return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+}
+
+SSE42 static void sse42_check_utf8_block(sse42_utf8_t *state, __m128i input) {
+    if (!_mm_movemask_epi8(input)) {
+        // Only ASCII, but the previous block can end with a truncated
+        // sequence.
+        state->error = _mm_or_si128(state->error, state->prev_incomplete);
+        state->prev_input = input;
+        return;
+    }
+
+    __m128i prev1 = _mm_alignr_epi8(input, state->prev_input, 15);
+    __m128i byte_1_high = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_1_HIGH),
+                                           sse42_high_nibbles(prev1));
+    __m128i byte_1_low = _mm_shuffle_epi8(
+        _mm_setr_epi8(BYTE_1_LOW), _mm_and_si128(prev1, _mm_set1_epi8(0x0f)));
+    __m128i byte_2_high = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_2_HIGH),
+                                           sse42_high_nibbles(input));
+    __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low),
+                                    byte_2_high);
+
+    // The third and fourth bytes of the sequences must be continuations
+    __m128i prev2 = _mm_alignr_epi8(input, state->prev_input, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, state->prev_input, 13);
+    __m128i must_be_continuation = _mm_or_si128(
+        _mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+        _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80)));
+    must_be_continuation = _mm_and_si128(must_be_continuation,
+                                         _mm_set1_epi8(0x80));
+
+    state->error = _mm_or_si128(state->error,
+                                _mm_xor_si128(must_be_continuation, special));
+    state->prev_incomplete = _mm_subs_epu8(input,
+                                           _mm_setr_epi8(INCOMPLETE_16));
+    state->prev_input = input;
+}
+
+SSE42 static int sse42_is_valid_utf8(const char *s, size_t n) {
+    sse42_utf8_t state = {
+        _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(),
+    };
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        sse42_check_utf8_block(&state,
+                               _mm_loadu_si128((const __m128i *)(s + i)));
+    }
+
+    // The last block is padded with zeros, which also catches a truncated
+    // sequence at the very end.
+    char last[16] = {0};
+    memcpy(last, s + i, n - i);
+    sse42_check_utf8_block(&state, _mm_loadu_si128((const __m128i *)last));
+    sse42_check_utf8_block(&state, _mm_setzero_si128());
+    return _mm_testz_si128(state.error, state.error);
+}
+
+
+
+//////////////////////////////////////////////////// AVX2
+
+
+
+AVX2 static double avx2_horizontal_sum(__m256d v) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v),
+                           _mm256_extractf128_pd(v, 1));
+    double lanes[2];
+    _mm_storeu_pd(lanes, s);
+    return lanes[0] + lanes[1];
+}
+
+AVX2 static double avx2_sum(const double *a, size_t n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+        s2 = _mm256_add_pd(s2, _mm256_loadu_pd(a + i + 8));
+        s3 = _mm256_add_pd(s3, _mm256_loadu_pd(a + i + 12));
+    }
+    __m256d s = _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3));
+    return avx2_horizontal_sum(s) + scalar_sum(a + i, n - i);
+}
+
+#define define_avx2_extremum(name, op, compare)                         \
+    AVX2 static double avx2_##name(const double *a, size_t n) {         \
+        if (n < 4) {                                                    \
+            return scalar_##name(a, n);                                 \
+        }                                                               \
+        __m256d m = _mm256_loadu_pd(a);                                 \
+        size_t i = 4;                                                   \
+        for (; i + 4 <= n; i += 4) {                                    \
+            m = op(m, _mm256_loadu_pd(a + i));                          \
+        }                                                               \
+        double lanes[4];                                                \
+        _mm256_storeu_pd(lanes, m);                                     \
+        double result = scalar_##name(lanes, 4);                        \
+        for (; i < n; i++) {                                            \
+            result = a[i] compare result ? a[i] : result;               \
+        }                                                               \
+        return result;                                                  \
+    }
+
+define_avx2_extremum(min, _mm256_min_pd, <)
+define_avx2_extremum(max, _mm256_max_pd, >)
+
+AVX2 static double avx2_dot(const double *a, const double *b, size_t n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = s0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                             _mm256_loadu_pd(b + i)));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                             _mm256_loadu_pd(b + i + 4)));
+    }
+    return avx2_horizontal_sum(_mm256_add_pd(s0, s1)) +
+        scalar_dot(a + i, b + i, n - i);
+}
+
+AVX2 static __m256d avx2_apply_op(enum simd_op op, __m256d a, __m256d b) {
+    switch (op) {
+    case simd_op_add: return _mm256_add_pd(a, b);
+    case simd_op_sub: return _mm256_sub_pd(a, b);
+    case simd_op_mul: return _mm256_mul_pd(a, b);
+    case simd_op_div: return _mm256_div_pd(a, b);
+    }
+    abort();
+}
+
+AVX2 static void avx2_fill(double *a, double x, size_t n) {
+    __m256d vx = _mm256_set1_pd(x);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(a + i, vx);
+    }
+    for (; i < n; i++) {
+        a[i] = x;
+    }
+}
+
+AVX2 static void avx2_scalar_op(enum simd_op op, double *dst, const double *a,
+                                double x, size_t n) {
+    __m256d vx = _mm256_set1_pd(x);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i,
+                         avx2_apply_op(op, _mm256_loadu_pd(a + i), vx));
+    }
+    scalar_scalar_op(op, dst + i, a + i, x, n - i);
+}
+
+AVX2 static void avx2_vector_op(enum simd_op op, double *dst, const double *a,
+                                const double *b, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, avx2_apply_op(op, _mm256_loadu_pd(a + i),
+                                                _mm256_loadu_pd(b + i)));
+    }
+    scalar_vector_op(op, dst + i, a + i, b + i, n - i);
+}
+
+AVX2 static size_t avx2_find_in_set(const simd_byte_set_t *set, const char *s,
+                                    size_t n, int negate) {
+    const __m256i low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)set->low));
+    const __m256i high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)set->high));
+    const __m256i bits = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    unsigned flip = negate ? 0xffffffff : 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i rows = _mm256_blendv_epi8(_mm256_shuffle_epi8(low, lo),
+                                          _mm256_shuffle_epi8(high, lo), v);
+        __m256i bit = _mm256_shuffle_epi8(bits, hi);
+        __m256i match = _mm256_cmpeq_epi8(_mm256_and_si256(rows, bit), bit);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(match) ^ flip;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + sse42_find_in_set(set, s + i, n - i, negate);
+}
+
+#define load256(p) _mm256_loadu_si256((const __m256i *)(p))
+
+// Same as the SSE4.2 version, with two vectors per iteration
+AVX2 static size_t avx2_find_substring(const char *haystack, size_t n,
+                                       const char *needle, size_t k) {
+    if (k < 2 || k > n) {
+        return scalar_find_substring(haystack, n, needle, k);
+    }
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 64 <= n; i += 64) {
+        const char *p = haystack + i;
+        __m256i m0 = _mm256_and_si256(
+            _mm256_cmpeq_epi8(first, load256(p)),
+            _mm256_cmpeq_epi8(last, load256(p + k - 1)));
+        __m256i m1 = _mm256_and_si256(
+            _mm256_cmpeq_epi8(first, load256(p + 32)),
+            _mm256_cmpeq_epi8(last, load256(p + 32 + k - 1)));
+        __m256i any = _mm256_or_si256(m0, m1);
+        if (_mm256_testz_si256(any, any)) {
+            continue;
+        }
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(m0) |
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(m1) << 32;
+        while (mask) {
+            unsigned bit = __builtin_ctzll(mask);
+            if (memcmp(p + bit + 1, needle + 1, k - 2) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = sse42_find_substring(haystack + i, n - i, needle, k);
+    return rest == SIZE_MAX ? rest : i + rest;
+}
+
+#define INCOMPLETE_32                                                   \
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,     \
+        INCOMPLETE_16
+
+typedef struct avx2_utf8 {
+    __m256i error, prev_input, prev_incomplete;
+} avx2_utf8_t;
+
+AVX2 static __m256i avx2_high_nibbles(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+}
+
+// Same as `_mm_alignr_epi8()` across the two lanes: the last `16 - n`
+// bytes of `prev` followed by the first bytes of `input`
+#define avx2_prev(input, prev, n)                                       \
+    _mm256_alignr_epi8((input),                                         \
+                       _mm256_permute2x128_si256((prev), (input), 0x21), \
+                       16 - (n))
+
+AVX2 static void avx2_check_utf8_block(avx2_utf8_t *state, __m256i input) {
+    if (!_mm256_movemask_epi8(input)) {
+        state->error = _mm256_or_si256(state->error, state->prev_incomplete);
+        state->prev_input = input;
+        return;
+    }
+
+    __m256i prev1 = avx2_prev(input, state->prev_input, 1);
+    __m256i byte_1_high = _mm256_shuffle_epi8(
+        _mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH), avx2_high_nibbles(prev1));
+    __m256i byte_1_low = _mm256_shuffle_epi8(
+        _mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW),
+        _mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)));
+    __m256i byte_2_high = _mm256_shuffle_epi8(
+        _mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH), avx2_high_nibbles(input));
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    __m256i prev2 = avx2_prev(input, state->prev_input, 2);
+    __m256i prev3 = avx2_prev(input, state->prev_input, 3);
+    __m256i must_be_continuation = _mm256_or_si256(
+        _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80)),
+        _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80)));
+    must_be_continuation = _mm256_and_si256(must_be_continuation,
+                                            _mm256_set1_epi8(0x80));
+
+    state->error = _mm256_or_si256(
+        state->error, _mm256_xor_si256(must_be_continuation, special));
+    state->prev_incomplete = _mm256_subs_epu8(
+        input, _mm256_setr_epi8(INCOMPLETE_32));
+    state->prev_input = input;
+}
+
+AVX2 static int avx2_is_valid_utf8(const char *s, size_t n) {
+    avx2_utf8_t state = {
+        _mm256_setzero_si256(), _mm256_setzero_si256(),
+        _mm256_setzero_si256(),
+    };
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        avx2_check_utf8_block(&state,
+                              _mm256_loadu_si256((const __m256i *)(s + i)));
+    }
+    char last[32] = {0};
+    memcpy(last, s + i, n - i);
+    avx2_check_utf8_block(&state, _mm256_loadu_si256((const __m256i *)last));
+    avx2_check_utf8_block(&state, _mm256_setzero_si256());
+    return _mm256_testz_si256(state.error, state.error);
+}
+
+// Select the kernel for the current level.
+#define DISPATCH(name, ...)                                     \
+    switch (get_level()) {                                      \
+    case simd_level_avx2: return avx2_##name(__VA_ARGS__);      \
+    case simd_level_sse42:                                      \
+    case simd_level_sse2: return sse2_##name(__VA_ARGS__);      \
+    default: return scalar_##name(__VA_ARGS__);                 \
+    }
+
+#define DISPATCH_STRING(name, ...)                              \
+    switch (get_level()) {                                      \
+    case simd_level_avx2: return avx2_##name(__VA_ARGS__);      \
+    case simd_level_sse42: return sse42_##name(__VA_ARGS__);    \
+    default: return scalar_##name(__VA_ARGS__);                 \
+    }
+
+#else
+
+#define DISPATCH(name, ...) return scalar_##name(__VA_ARGS__);
+#define DISPATCH_STRING(name, ...) return scalar_##name(__VA_ARGS__);
+
+#endif
+
+
+
+//////////////////////////////////////////////////// PUBLIC API
+
+
+
+double simd_sum(const double *a, size_t n) {
+    DISPATCH(sum, a, n);
+}
+
+double simd_min(const double *a, size_t n) {
+    DISPATCH(min, a, n);
+}
+
+double simd_max(const double *a, size_t n) {
+    DISPATCH(max, a, n);
+}
+
+double simd_dot(const double *a, const double *b, size_t n) {
+    DISPATCH(dot, a, b, n);
+}
+
+void simd_fill(double *a, double x, size_t n) {
+#if defined(__x86_64__)
+    if (get_level() == simd_level_avx2) {
+        avx2_fill(a, x, n);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; i++) {
+        a[i] = x;
+    }
+}
+
+void simd_scalar_op(enum simd_op op, double *dst, const double *a, double x,
+                    size_t n) {
+    DISPATCH(scalar_op, op, dst, a, x, n);
+}
+
+void simd_vector_op(enum simd_op op, double *dst, const double *a,
+                    const double *b, size_t n) {
+    DISPATCH(vector_op, op, dst, a, b, n);
+}
+
+void simd_byte_set_init(simd_byte_set_t *set, const char *bytes, size_t n) {
+    memset(set, 0, sizeof(*set));
+    for (size_t i = 0; i < n; i++) {
+        simd_byte_set_add_range(set, bytes[i], bytes[i]);
+    }
+}
+
+void simd_byte_set_add_range(simd_byte_set_t *set, unsigned char first,
+                             unsigned char last) {
+    for (unsigned c = first; c <= last; c++) {
+        unsigned char *rows = c < 0x80 ? set->low : set->high;
+        rows[c & 15] |= 1 << (c >> 4 & 7);
+    }
+}
+
+static size_t find_in_set(const simd_byte_set_t *set, const char *s,
+                          size_t n, int negate) {
+    DISPATCH_STRING(find_in_set, set, s, n, negate);
+}
+
+size_t simd_find_in_set(const simd_byte_set_t *set, const char *s, size_t n) {
+    return find_in_set(set, s, n, 0);
+}
+
+size_t simd_find_not_in_set(const simd_byte_set_t *set, const char *s,
+                            size_t n) {
+    return find_in_set(set, s, n, 1);
+}
+
+size_t simd_find_substring(const char *haystack, size_t n,
+                           const char *needle, size_t needle_length) {
+    DISPATCH_STRING(find_substring, haystack, n, needle, needle_length);
+}
+
+int simd_is_valid_utf8(const char *s, size_t n) {
+    DISPATCH_STRING(is_valid_utf8, s, n);
+}
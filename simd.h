@@ -0,0 +1,65 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorized kernels. The instruction set (scalar code, SSE2 or AVX2) is
+// chosen at run time, see `simd.c`.
+
+enum simd_op {
+    simd_op_add,
+    simd_op_sub,
+    simd_op_mul,
+    simd_op_div,
+};
+
+double simd_sum(const double *a, size_t n);
+double simd_min(const double *a, size_t n); // `n` must be nonzero
+double simd_max(const double *a, size_t n); // `n` must be nonzero
+double simd_dot(const double *a, const double *b, size_t n);
+void simd_fill(double *a, double x, size_t n);
+
+// dst[i] = a[i] op x
+void simd_scalar_op(enum simd_op op, double *dst, const double *a, double x,
+                    size_t n);
+
+// dst[i] = a[i] op b[i]
+void simd_vector_op(enum simd_op op, double *dst, const double *a,
+                    const double *b, size_t n);
+
+// A set of bytes. Bit `hi % 8` of `low[lo]` (for the bytes below 0x80)
+// or of `high[lo]` (for the others) is set if the byte `hi << 4 | lo`
+// is in the set.
+typedef struct simd_byte_set simd_byte_set_t;
+
+struct simd_byte_set {
+    unsigned char low[16], high[16];
+};
+
+// Initializes the set with the `n` bytes of `bytes`.
+void simd_byte_set_init(simd_byte_set_t *set, const char *bytes, size_t n);
+void simd_byte_set_add_range(simd_byte_set_t *set, unsigned char first,
+                             unsigned char last);
+
+// Return the index of the first byte of `s` which is (or is not) in the
+// set, or `n` if there is none.
+size_t simd_find_in_set(const simd_byte_set_t *set, const char *s, size_t n);
+size_t simd_find_not_in_set(const simd_byte_set_t *set, const char *s,
+                            size_t n);
+
+// Returns the index of the first occurrence of `needle` in `haystack`,
+// or SIZE_MAX.
+size_t simd_find_substring(const char *haystack, size_t n,
+                           const char *needle, size_t needle_length);
+
+int simd_is_valid_utf8(const char *s, size_t n);
+
+// Returns the name of the instruction set in use.
+const char *simd_level_name(void);
+
+// Uses the given level ("scalar", "sse2", "sse4.2" or "avx2") instead
+// of the best one. Returns zero if it is not supported by the CPU.
+int simd_force_level(const char *name);
+
+#endif /* SIMD_H */
@@ -3,18 +3,39 @@
 
 #include <ctype.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "float64_array.h"
+#include "io.h"
+#include "isolate.h"
+#include "jit.h"
+#include "json.h"
 #include "object.h"
+#include "parallel.h"
+#include "profile.h"
 #include "vm.h"
 #include "value.h"
 #include "util.h"
 
 value_t eval_source(const char *source);
+value_t eval_compiled_file(struct compiled_file *file);
+void free_compiled_file(struct compiled_file *file);
+void compile_lazily(struct compiled_func *func);
 void collect_garbage(void);
 void request_garbage_collection(void);
+void set_gc_threads(unsigned count); // Overrides `TOY_GC_THREADS`
+value_t get_gc(void); // The global `gc` dict, see `collect_garbage.c`
+void sweep_lazily(toy_isolate_t *isolate);
+
+// Runs `run(data)` in the isolate, on the current thread. Returns -1 if
+// it dies, see `toy_isolate_error()`.
+int isolate_run(toy_isolate_t *isolate, void (*run)(void *data),
+                void *data);
+void finish_sweep(toy_isolate_t *isolate);
 struct compiled_file *get_builtin_file(void);
+struct compiled_file *get_aot_file(void);
 
 #endif /* TOY_H */
@@ -5,6 +5,10 @@ var fs = require('fs');
 
 // This is basically simple translation from JSON to C source code in order
 // to magically bundle the compiled parser into the `toy` executable.
+//
+// With a file name argument, the given script is compiled ahead of time
+// instead (see `make aot`): each function is also translated into a C
+// function, which the VM runs instead of interpreting the bytecode.
 
 var compile = require('./compile');
 
@@ -29,7 +33,7 @@ var escapeString = function (string) {
     return '"' + e + '"';
 };
 
-var translateFunction = function (compiled) {
+var translateFunction = function (compiled, id, aot) {
     var output = '';
     var emit = function (s) {
         output = output + s;
@@ -40,6 +44,17 @@ var translateFunction = function (compiled) {
     if (compiled.paramName) {
         emit('  .param_name = "' + compiled.paramName + '",\n');
     }
+    emit('  .name = "' + compiled.name + '",\n');
+
+    var lines = compiled.lines;
+    if (lines.length) {
+        emit('  .lines = (uint32_t[]){' + lines.join(', ') + '},\n');
+    }
+    emit('  .line_count = ' + lines.length / 2 + ',\n');
+
+    if (aot) {
+        emit('  .aot = aot_func' + id + ',\n');
+    }
 
     emit('  .code = (unsigned char[]){\n');
     var i = 0;
@@ -56,12 +71,15 @@ var translateFunction = function (compiled) {
         i = i + 1;
     }
     emit('  },\n');
+    emit('  .code_length = ' + compiled.code.length + ',\n');
 
     var consts = compiled.consts;
 
     // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=65673
     if (consts.length) {
-        emit('  .consts = (value_t[' + consts.length + ']){},\n');
+        if (aot) {
+            emit('  .consts = (value_t[' + consts.length + ']){},\n');
+        }
         emit('  .bconsts = (bvalue_t[]){\n');
         i = 0;
         while (i < consts.length) {
@@ -81,14 +99,325 @@ var translateFunction = function (compiled) {
 
     emit('  .const_count = ' + consts.length + ',\n');
 
-    emit('  .file = &file,\n');
+    if (aot) {
+        emit('  .file = &file,\n');
+    }
 
     emit('};\n');
 
     return output;
 };
 
-var translate = function (source) {
+// Number of operand bytes following each opcode. See `operandSizes` in
+// `compile.js`.
+var operandSize = function (op) {
+    var wide = [
+        'load_const', 'load_func', 'load_var_const', 'store_var_const',
+        'decl_var_const', 'get_const'
+    ];
+    if (wide.indexOf(op) !== -1 || op.indexOf('goto') === 0) {
+        return 2;
+    }
+    return 0;
+};
+
+// Stack depth change of the instructions which neither jump nor return.
+var stackEffects = {
+    load_const: 1, load_null: 1, load_empty_list: 1, load_empty_dict: 1,
+    load_func: 1, load_var_const: 1, dup: 1,
+    load_var: 0, not: 0, unary_minus: 0, typeof: 0, get_const: 0, rot: 0,
+    decl_var_const: 0,
+    list_push: -1, pop: -1, decl_var: -1, call: -1, store_var_const: -1,
+    get: -1, add: -1, sub: -1, mul: -1, div: -1, mod: -1, eq: -1, neq: -1,
+    gt: -1, lt: -1, gte: -1, lte: -1, in: -1,
+    dict_push: -2, store_var: -2,
+    set: -3,
+};
+
+var comparisons = ['eq', 'neq', 'gt', 'lt', 'gte', 'lte'];
+
+// An `extended_arg` prefix is merged into the instruction which follows
+// it, whose offset is the one of the prefix.
+var decodeInstructions = function (code) {
+    var instrs = [];
+    var i = 0;
+    while (i < code.length) {
+        var instr = {offset: i, op: code[i]};
+        var high = 0;
+        if (instr.op === 'extended_arg') {
+            high = (code[i + 1] * 256 + code[i + 2]) * 65536;
+            i = i + 3;
+            instr.op = code[i];
+        }
+        if (operandSize(instr.op)) {
+            instr.operand = high + code[i + 1] * 256 + code[i + 2];
+        }
+        instrs.push(instr);
+        i = i + 1 + operandSize(instr.op);
+    }
+    return instrs;
+};
+
+// Sets the `depth` of the stack before each reachable instruction, and
+// the `isTarget` flag of the jump targets. Returns the maximum depth.
+var computeStackDepths = function (instrs) {
+    var byOffset = {};
+    var i = 0;
+    while (i < instrs.length) {
+        byOffset[instrs[i].offset] = i;
+        i = i + 1;
+    }
+
+    var maxDepth = 0;
+    var pending = [[0, 0]];
+    var visit = function (index, depth) {
+        var instr = instrs[index];
+        if (instr.depth !== undefined) {
+            if (instr.depth !== depth) {
+                die('inconsistent stack depth at ' + instr.offset);
+            }
+            return;
+        }
+        instr.depth = depth;
+        maxDepth = Math.max(maxDepth, depth);
+        pending.push([index, depth]);
+    };
+
+    instrs[0].depth = 0;
+    while (pending.length) {
+        var item = pending.pop();
+        var instr = instrs[item[0]];
+        var depth = item[1];
+        var op = instr.op;
+        var next = item[0] + 1;
+
+        if (op === 'return' || op === 'return_null') {
+            continue;
+        }
+        if (op.indexOf('goto') !== 0) {
+            if (!(op in stackEffects)) {
+                die('cannot compile ' + op + ' ahead of time');
+            }
+            maxDepth = Math.max(maxDepth, depth + stackEffects[op]);
+            visit(next, depth + stackEffects[op]);
+            continue;
+        }
+
+        var target = byOffset[instr.operand];
+        instrs[target].isTarget = true;
+        if (op === 'goto') {
+            visit(target, depth);
+        } else if (op === 'goto_if_or_pop' || op === 'goto_unless_or_pop') {
+            visit(target, depth);
+            visit(next, depth - 1);
+        } else {
+            var popped = op === 'goto_if' || op === 'goto_unless' ? 1 : 2;
+            visit(target, depth - popped);
+            visit(next, depth - popped);
+        }
+    }
+    return maxDepth;
+};
+
+// Translates the bytecode of a function into the body of a C function.
+// Each stack slot becomes a local variable, which holds a reference like
+// the stack of the VM does.
+var translateCode = function (compiled, id) {
+    var output = '';
+    var emit = function (s) {
+        output = output + '  ' + s + '\n';
+    };
+
+    var instrs = decodeInstructions(compiled.code);
+    var maxDepth = computeStackDepths(instrs);
+    var consts = compiled.consts;
+
+    var slot = function (i) {
+        return 's' + i;
+    };
+    var constant = function (index) {
+        return 'func' + id + '.consts[' + index + ']';
+    };
+    var name = function (index) {
+        if (typeof consts[index] !== 'string') {
+            die('a name must be a string');
+        }
+        return escapeString(consts[index]);
+    };
+    var push = function (i, value) {
+        emit(slot(i) + ' = ' + value + ';');
+        emit('v_inc_ref(' + slot(i) + ');');
+    };
+    var pop = function (i) {
+        emit('v_dec_ref(' + slot(i) + ');');
+    };
+    // Replaces the slots from `i` to the top by the given value.
+    var reduce = function (i, top, value) {
+        emit('r = ' + value + ';');
+        while (top >= i) {
+            pop(top);
+            top = top - 1;
+        }
+        push(i, 'r');
+    };
+    var popAll = function (depth) {
+        while (depth > 0) {
+            depth = depth - 1;
+            pop(depth);
+        }
+    };
+    var jump = function (instr) {
+        return 'goto L' + instr.operand + ';';
+    };
+
+    output = output + '  value_t r;\n';
+    if (maxDepth) {
+        var slots = [];
+        var i = 0;
+        while (i < maxDepth) {
+            slots.push(slot(i) + ' = v_null');
+            i = i + 1;
+        }
+        output = output + '  value_t ' + slots.join(', ') + ';\n';
+    }
+    emit('(void)r;');
+    emit('request_garbage_collection();');
+
+    var translateInstruction = function (instr) {
+        var d = instr.depth;
+        var op = instr.op;
+        var operand = instr.operand;
+        if (d === undefined) {
+            return; // Dead code
+        }
+        if (instr.isTarget) {
+            output = output + ' L' + instr.offset + ':;\n';
+        }
+
+        if (op === 'return') {
+            if (!d) {
+                emit('return v_null;');
+                return;
+            }
+            emit('r = ' + slot(d - 1) + ';');
+            popAll(d);
+            emit('return r;');
+        } else if (op === 'return_null') {
+            popAll(d);
+            emit('return v_null;');
+        } else if (op === 'load_const') {
+            push(d, constant(operand));
+        } else if (op === 'load_null') {
+            push(d, 'v_null');
+        } else if (op === 'load_empty_list') {
+            push(d, 'v_list()');
+        } else if (op === 'load_empty_dict') {
+            push(d, 'v_dict()');
+        } else if (op === 'load_func') {
+            push(d, 'aot_closure(' + operand + ', scope)');
+        } else if (op === 'load_var_const') {
+            push(d, 'scope_get(scope, ' + name(operand) + ')');
+        } else if (op === 'dup') {
+            push(d, slot(d - 1));
+        } else if (op === 'load_var') {
+            emit('v_assert_type(' + slot(d - 1) + ', string);');
+            reduce(d - 1, d - 1,
+                   'scope_get(scope, ' + slot(d - 1) + '.object->string)');
+        } else if (op === 'not') {
+            reduce(d - 1, d - 1, 'v_integer(!v_to_bool(' + slot(d - 1) + '))');
+        } else if (op === 'unary_minus') {
+            reduce(d - 1, d - 1, 'v_unary_minus(' + slot(d - 1) + ')');
+        } else if (op === 'typeof') {
+            reduce(d - 1, d - 1, 'v_string(v_typeof(' + slot(d - 1) + '))');
+        } else if (op === 'get_const') {
+            reduce(d - 1, d - 1,
+                   'v_get(' + slot(d - 1) + ', ' + constant(operand) + ')');
+        } else if (op === 'rot') {
+            emit('r = ' + slot(d - 1) + ';');
+            emit(slot(d - 1) + ' = ' + slot(d - 2) + ';');
+            emit(slot(d - 2) + ' = r;');
+        } else if (op === 'decl_var_const') {
+            emit('scope_decl(scope, ' + name(operand) + ');');
+        } else if (op === 'decl_var') {
+            emit('v_assert_type(' + slot(d - 1) + ', string);');
+            emit('scope_decl(scope, ' + slot(d - 1) + '.object->string);');
+            pop(d - 1);
+        } else if (op === 'store_var_const') {
+            emit('scope_set(scope, ' + name(operand) + ', ' + slot(d - 1) + ');');
+            pop(d - 1);
+        } else if (op === 'store_var') {
+            emit('v_assert_type(' + slot(d - 2) + ', string);');
+            emit('scope_set(scope, ' + slot(d - 2) + '.object->string, ' +
+                 slot(d - 1) + ');');
+            pop(d - 1);
+            pop(d - 2);
+        } else if (op === 'list_push') {
+            emit('v_assert_type(' + slot(d - 2) + ', list);');
+            emit('v_list_push(' + slot(d - 2) + ', ' + slot(d - 1) + ');');
+            pop(d - 1);
+        } else if (op === 'dict_push') {
+            emit('v_set(' + slot(d - 3) + ', ' + slot(d - 2) + ', ' +
+                 slot(d - 1) + ');');
+            pop(d - 1);
+            pop(d - 2);
+        } else if (op === 'set') {
+            emit('v_set(' + slot(d - 2) + ', ' + slot(d - 1) + ', ' +
+                 slot(d - 3) + ');');
+            pop(d - 1);
+            pop(d - 2);
+            pop(d - 3);
+        } else if (op === 'pop') {
+            pop(d - 1);
+        } else if (op === 'call') {
+            reduce(d - 2, d - 1,
+                   'call_func(' + slot(d - 2) + ', ' + slot(d - 1) + ')');
+        } else if (op === 'get') {
+            reduce(d - 2, d - 1,
+                   'v_get(' + slot(d - 2) + ', ' + slot(d - 1) + ')');
+        } else if (op in stackEffects) {
+            // Binary operators
+            reduce(d - 2, d - 1,
+                   'v_' + op + '(' + slot(d - 2) + ', ' + slot(d - 1) + ')');
+        } else if (op === 'goto') {
+            if (operand <= instr.offset) {
+                emit('request_garbage_collection();');
+            }
+            emit(jump(instr));
+        } else if (op === 'goto_if' || op === 'goto_unless') {
+            var negation = op === 'goto_unless' ? '!' : '';
+            emit('r = ' + slot(d - 1) + ';');
+            pop(d - 1);
+            emit('if (' + negation + 'v_to_bool(r)) ' + jump(instr));
+        } else if (op === 'goto_if_or_pop' || op === 'goto_unless_or_pop') {
+            var negation = op === 'goto_unless_or_pop' ? '!' : '';
+            emit('if (' + negation + 'v_to_bool(' + slot(d - 1) + ')) ' +
+                 jump(instr));
+            pop(d - 1);
+        } else if (comparisons.indexOf(op.slice('goto_unless_'.length)) !== -1) {
+            var comparison = op.slice('goto_unless_'.length);
+            emit('r = v_' + comparison + '(' + slot(d - 2) + ', ' +
+                 slot(d - 1) + ');');
+            pop(d - 1);
+            pop(d - 2);
+            emit('if (!v_to_bool(r)) ' + jump(instr));
+        } else {
+            die('cannot compile ' + op + ' ahead of time');
+        }
+    };
+
+    var i = 0;
+    while (i < instrs.length) {
+        translateInstruction(instrs[i]);
+        i = i + 1;
+    }
+
+    // `scope` is unused by the functions which have no variable
+    return 'static value_t aot_func' + id + '(value_t scope) {\n' +
+        '  (void)scope;\n' + output + '}\n';
+};
+
+// The `name` argument is the name of the C function returning the file.
+var translate = function (source, name, aot) {
     var output = '';
     var emit = function (s) {output = output + s;};
 
@@ -98,33 +427,77 @@ var translate = function (source) {
 
     var funcs = compile(source);
 
-    emit('static compiled_file_t file = {\n');
-    emit('  .func_count = ' + funcs.length + ',\n');
-    emit('  .funcs = (compiled_func_t[' + funcs.length + ']){},\n');
-    emit('};\n\n');
+    if (aot) {
+        var i = 0;
+        while (i < funcs.length) {
+            emit('static value_t aot_func' + i + '(value_t scope);\n');
+            i = i + 1;
+        }
+        emit('\n');
+    }
+
+    if (aot) {
+        emit('static compiled_file_t file = {\n');
+        emit('  .func_count = ' + funcs.length + ',\n');
+        emit('  .funcs = (compiled_func_t *[' + funcs.length + ']){},\n');
+        emit('};\n\n');
+    }
 
     var i = 0;
     while (i < funcs.length) {
         var func = funcs[i];
         emit('static compiled_func_t func' + i + ' = ');
-        emit(translateFunction(func));
+        emit(translateFunction(func, i, aot));
         emit('\n');
         i = i + 1;
     }
 
-    emit('compiled_file_t *get_builtin_file(void) {\n');
+    // Only the nested functions are loaded with `load_func`
+    if (aot && funcs.length > 1) {
+        emit('static value_t aot_closure(unsigned index, value_t scope) {\n');
+        emit('  object_t *closure = new_compiled_func_object(file.funcs[index]);\n');
+        emit('  closure->func.parent_scope = scope;\n');
+        emit('  return (value_t){.type = value_type_object, .object = closure};\n');
+        emit('}\n\n');
+    }
+
+    if (aot) {
+        i = 0;
+        while (i < funcs.length) {
+            emit(translateCode(funcs[i], i));
+            emit('\n');
+            i = i + 1;
+        }
+    }
 
-    emit('  compiled_func_t funcs[' + funcs.length + '] = {');
+    if (!aot) {
+        // Each isolate gets its own copy, see `new_builtin_file()`.
+        emit('static compiled_func_t *const funcs[' + funcs.length + '] = {');
+        i = 0;
+        while (i < funcs.length) {
+            emit('&func' + i + ', ');
+            i = i + 1;
+        }
+        emit('};\n\n');
+        emit('compiled_file_t *' + name + '(void) {\n');
+        emit('  return new_builtin_file(funcs, ' + funcs.length + ');\n');
+        emit('}\n');
+        return output;
+    }
+
+    emit('compiled_file_t *' + name + '(void) {\n');
+
+    emit('  compiled_func_t *funcs[' + funcs.length + '] = {');
     i = 0;
     while (i < funcs.length) {
-        emit('func' + i + ', ');
+        emit('&func' + i + ', ');
         i = i + 1;
     }
     emit('};\n\n');
 
     emit('  memmove(file.funcs, funcs, sizeof(funcs));\n');
     emit('  for (int i = 0; i < ' + funcs.length + '; i++) {\n');
-    emit('    compiled_func_t *func = file.funcs + i;\n');
+    emit('    compiled_func_t *func = file.funcs[i];\n');
     emit('    bvalue_array_to_v(func->consts, func->bconsts, func->const_count);\n');
     emit('  }\n');
     emit('  return &file;\n');
@@ -133,5 +506,10 @@ var translate = function (source) {
     return output;
 };
 
-var source = fs.readFileSync('compile.js').toString();
-console.log(translate(source));
+if (process.argv.length > 2) {
+    var script = fs.readFileSync(process.argv[2]).toString();
+    console.log(translate(script, 'get_aot_file', true));
+} else {
+    var source = fs.readFileSync('compile.js').toString();
+    console.log(translate(source, 'get_builtin_file', false));
+}
@@ -5,8 +5,25 @@
         die("cannot allocate memory");          \
     }
 
+// In an isolate evaluated by `toy_isolate_eval()`, the error is
+// returned to the embedder instead. The error is followed by the
+// location of the function being interpreted, if any.
 void die(const char *error) {
-    fprintf(stderr, "fatal: %s\n", error);
+    io_flush();
+    char location[128];
+    describe_location(location, sizeof(location));
+    toy_isolate_t *isolate = current_isolate;
+    if (isolate && isolate->error_handler) {
+        if (!isolate->error) {
+            size_t size = strlen(error) + strlen(location) + 1;
+            isolate->error = malloc(size);
+            if (isolate->error) {
+                snprintf(isolate->error, size, "%s%s", error, location);
+            }
+        }
+        longjmp(*isolate->error_handler, 1);
+    }
+    fprintf(stderr, "fatal: %s%s\n", error, location);
     exit(1);
 }
 
@@ -16,8 +33,26 @@ void *xmalloc(size_t size) {
     return d;
 }
 
+void *xcalloc(size_t count, size_t size) {
+    void *d = calloc(count, size);
+    ASSERT_ENOUGH_MEM(d);
+    return d;
+}
+
+void *xrealloc(void *p, size_t size) {
+    void *d = realloc(p, size);
+    ASSERT_ENOUGH_MEM(d);
+    return d;
+}
+
 char *xstrdup(const char *s) {
     char *r = strdup(s);
     ASSERT_ENOUGH_MEM(r);
     return r;
 }
+
+char *xstrndup(const char *s, size_t n) {
+    char *r = strndup(s, n);
+    ASSERT_ENOUGH_MEM(r);
+    return r;
+}
@@ -5,6 +5,9 @@
 
 __attribute__((noreturn)) void die(const char *error);
 void *xmalloc(size_t size);
+void *xcalloc(size_t count, size_t size);
+void *xrealloc(void *p, size_t size);
 char *xstrdup(const char *s);
+char *xstrndup(const char *s, size_t n);
 
 #endif /* UTIL_H */
@@ -1,12 +1,15 @@
 #include "toy.h"
+#include "simd.h"
+#include <inttypes.h>
 #include <stdarg.h>
 
 const value_t v_null = {.type = value_type_null};
 
 int v_to_bool(value_t v) {
-    return v.type == value_type_number ? !!v.number :
+    return v.type == value_type_integer ? !!v.integer :
+        v.type == value_type_number ? !!v.number :
         v.type == value_type_null ? 0 :
-        v_is_string(v) ? strlen(v.object->string) :
+        v_is_string(v) ? *v.object->string != 0 :
         1;
 }
 
@@ -18,6 +21,12 @@ char *v_to_string(value_t v) {
         return xstrdup(buf);
     }
 
+    case value_type_integer: {
+        char buf[32];
+        snprintf(buf, 32, "%" PRId64, v.integer);
+        return xstrdup(buf);
+    }
+
     case value_type_null:
         return xstrdup("null");
 
@@ -26,6 +35,8 @@ char *v_to_string(value_t v) {
         case object_type_dict: return xstrdup("[dict]");
         case object_type_list: return xstrdup("[list]");
         case object_type_func: return xstrdup("[function]");
+        case object_type_float64_array: return xstrdup("[Float64Array]");
+        case object_type_line_reader: return xstrdup("[line reader]");
         case object_type_string: return xstrdup(v.object->string);
         }
     }
@@ -33,6 +44,9 @@ char *v_to_string(value_t v) {
 }
 
 double v_to_number(value_t v) {
+    if (v_is_integer(v)) {
+        return v.integer;
+    }
     if (v_is_number(v)) {
         return v.number;
     }
@@ -46,6 +60,9 @@ double v_to_number(value_t v) {
 }
 
 long v_to_integer(value_t v) {
+    if (v_is_integer(v)) {
+        return v.integer;
+    }
     double n = v_to_number(v);
     if (n >= MAX_SAFE_INTEGER) {
         n = MAX_SAFE_INTEGER;
@@ -56,9 +73,22 @@ long v_to_integer(value_t v) {
     return n;
 }
 
+// Integers out of the safe range become doubles.
+static value_t int64_to_v(int64_t n) {
+    if (n >= MIN_SAFE_INTEGER && n <= MAX_SAFE_INTEGER) {
+        return v_integer(n);
+    }
+    return (value_t){.type = value_type_number, .number = n};
+}
+
+#define both_integers(a, b) (v_is_integer(a) && v_is_integer(b))
+
 value_t v_add(value_t a, value_t b) {
+    if (both_integers(a, b)) {
+        return int64_to_v(a.integer + b.integer);
+    }
     if (v_is_number(a) && v_is_number(b)) {
-        return v_number(a.number + b.number);
+        return v_number(v_to_number(a) + v_to_number(b));
     }
 
     char *left = v_to_string(a);
@@ -73,32 +103,89 @@ value_t v_add(value_t a, value_t b) {
     return result;
 }
 
-// Binary operations on numbers (except modulo, which requires integers)
-#define X(name, op)                                   \
-    value_t v_##name(value_t a, value_t b) {          \
-        if (v_is_number(a) && v_is_number(b)) {       \
-            return v_number(a.number op b.number);    \
-        }                                             \
-        return v_number(0);                           \
+value_t v_sub(value_t a, value_t b) {
+    if (both_integers(a, b)) {
+        return int64_to_v(a.integer - b.integer);
+    }
+    if (v_is_number(a) && v_is_number(b)) {
+        return v_number(v_to_number(a) - v_to_number(b));
+    }
+    return v_integer(0);
+}
+
+value_t v_mul(value_t a, value_t b) {
+    int64_t product;
+    // Falls back to doubles for -0, like `0 * -5`
+    if (both_integers(a, b) &&
+        !__builtin_mul_overflow(a.integer, b.integer, &product) &&
+        (product || (a.integer >= 0 && b.integer >= 0))) {
+        return int64_to_v(product);
+    }
+    if (v_is_number(a) && v_is_number(b)) {
+        return v_number(v_to_number(a) * v_to_number(b));
+    }
+    return v_integer(0);
+}
+
+value_t v_div(value_t a, value_t b) {
+    if (both_integers(a, b) && b.integer && a.integer % b.integer == 0 &&
+        (a.integer || b.integer > 0)) {
+        return v_integer(a.integer / b.integer);
+    }
+    if (v_is_number(a) && v_is_number(b)) {
+        return v_number(v_to_number(a) / v_to_number(b));
+    }
+    return v_integer(0);
+}
+
+value_t v_unary_minus(value_t a) {
+    if (v_is_integer(a) && a.integer) {
+        return v_integer(-a.integer);
     }
-X(sub, -) X(mul, *) X(div, /) X(gt, >) X(lt, <) X(gte, >=) X(lte, <=)
+    return v_number(-v_to_number(a));
+}
+
+// Comparisons of numbers
+#define X(name, op)                                             \
+    value_t v_##name(value_t a, value_t b) {                    \
+        if (both_integers(a, b)) {                              \
+            return v_integer(a.integer op b.integer);           \
+        }                                                       \
+        if (v_is_number(a) && v_is_number(b)) {                 \
+            return v_integer(v_to_number(a) op v_to_number(b)); \
+        }                                                       \
+        return v_integer(0);                                    \
+    }
+X(gt, >) X(lt, <) X(gte, >=) X(lte, <=)
 #undef X
 
+// Modulo requires integers, the operands are truncated.
 value_t v_mod(value_t a, value_t b) {
     if (v_is_number(a) && v_is_number(b)) {
-        return v_number(v_to_integer(a) % v_to_integer(b));
+        int64_t divisor = v_to_integer(b);
+        if (!divisor) {
+            return v_integer(0);
+        }
+        return v_integer(v_to_integer(a) % divisor);
     }
-    return v_number(0);
+    return v_integer(0);
 }
 
 static int object_equal(const object_t *a, const object_t *b) {
     return a->type != b->type ? 0 :
-        a->type == object_type_string ? strcmp(a->string, b->string) == 0 :
+        a->type == object_type_string ?
+        a->string_length == b->string_length &&
+        memcmp(a->string, b->string, a->string_length) == 0 :
         0;
 }
 
 int v_equal(value_t a, value_t b) {
+    // -0 is a double, but it equals the integer 0
+    if (v_is_number(a) && v_is_number(b) && a.type != b.type) {
+        return v_to_number(a) == v_to_number(b);
+    }
     return a.type != b.type ? 0 :
+        a.type == value_type_integer ? a.integer == b.integer :
         a.type == value_type_number ? a.number == b.number :
         a.type == value_type_null ? 1 :
         object_equal(a.object, b.object);
@@ -108,6 +195,7 @@ const char *v_typeof(value_t a) {
     switch (a.type) {
     case value_type_null: return "null";
     case value_type_number: return "number";
+    case value_type_integer: return "number";
     case value_type_object:
         switch (a.object->type) {
         case object_type_string: return "string";
@@ -125,16 +213,31 @@ void v_set(value_t dict, value_t key, value_t v) {
     } else if (v_is_list(dict)) {
         size_t index = v_to_integer(key);
         if (index < v_list_length(dict)) {
-            return dict_setv(&dict.object->dict, key, v);
+            dict.object->list.items[index] = v;
+        }
+    } else if (v_is_float64_array(dict)) {
+        size_t index = v_to_integer(key);
+        if (index < dict.object->float64_array.length) {
+            dict.object->float64_array.data[index] = v_to_number(v);
         }
     }
 }
 
+// Converts a key to a list or string index. Returns zero if the key is
+// not a positive integer.
+static int get_index(value_t key, size_t *index) {
+    if (v_is_integer(key) && key.integer >= 0) {
+        *index = key.integer;
+        return 1;
+    }
+    return 0;
+}
+
 static value_t string_slice(value_t vstring, value_t vindex) {
     v_assert_type(vstring, string);
     size_t index = v_to_integer(vindex);
     const char *string = vstring.object->string;
-    size_t len = strlen(string);
+    size_t len = vstring.object->string_length;
     if (index >= len) {
         return v_string("");
     }
@@ -152,32 +255,136 @@ static value_t string_index_of(value_t vstring, value_t vneedle) {
     v_assert_type(vstring, string);
 
     const char *s = vstring.object->string;
-    char *begin = strstr(s, vneedle.object->string);
-    return begin ? v_number(begin - s) : v_number(-1);
+    const char *needle = vneedle.object->string;
+    size_t index = simd_find_substring(s, vstring.object->string_length,
+                                       needle, vneedle.object->string_length);
+    return index == SIZE_MAX ? v_integer(-1) : v_integer(index);
+}
+
+// Returns the index of the first character of the string which is one
+// of the characters of the argument, or -1.
+static value_t string_index_of_any(value_t vstring, value_t vchars) {
+    v_assert_type(vchars, string);
+    v_assert_type(vstring, string);
+
+    const char *chars = vchars.object->string;
+    simd_byte_set_t set;
+    simd_byte_set_init(&set, chars, vchars.object->string_length);
+    const char *s = vstring.object->string;
+    size_t length = vstring.object->string_length;
+    size_t index = simd_find_in_set(&set, s, length);
+    return index == length ? v_integer(-1) : v_integer(index);
 }
 
 static value_t string_char_code_at(value_t vstring, value_t index) {
     v_assert_type(vstring, string);
     size_t i = v_to_integer(index);
     const char *s = vstring.object->string;
-    return i < strlen(s) ? v_number(s[i]) : v_null;
+    return i < vstring.object->string_length ? v_integer(s[i]) : v_null;
+}
+
+static value_t string_last_index_of(value_t vstring, value_t vneedle) {
+    v_assert_type(vneedle, string);
+    v_assert_type(vstring, string);
+
+    const char *s = vstring.object->string;
+    const char *needle = vneedle.object->string;
+    size_t length = vstring.object->string_length;
+    size_t needle_length = vneedle.object->string_length;
+    for (size_t i = length + 1; i-- > needle_length;) {
+        if (memcmp(s + i - needle_length, needle, needle_length) == 0) {
+            return v_integer(i - needle_length);
+        }
+    }
+    return v_integer(-1);
+}
+
+// Returns an empty list which can hold `capacity` items without being
+// reallocated.
+static value_t new_list_with_capacity(size_t capacity) {
+    value_t list = v_list();
+    if (capacity) {
+        list.object->list.items = xmalloc(sizeof(value_t) * capacity);
+        list.object->list.capacity = capacity;
+    }
+    return list;
+}
+
+// Splits around each occurrence of the separator. An empty separator
+// splits the string into characters.
+static value_t string_split(value_t vstring, value_t vsep) {
+    v_assert_type(vsep, string);
+    v_assert_type(vstring, string);
+
+    const char *s = vstring.object->string;
+    const char *sep = vsep.object->string;
+    size_t length = vstring.object->string_length;
+    size_t sep_length = vsep.object->string_length;
+    if (!sep_length) {
+        value_t list = new_list_with_capacity(length);
+        for (size_t i = 0; i < length; i++) {
+            v_list_push(list, v_string_owned(xstrndup(s + i, 1)));
+        }
+        return list;
+    }
+
+    size_t count = 1;
+    for (size_t i = 0, found;
+         (found = simd_find_substring(s + i, length - i, sep, sep_length)) !=
+             SIZE_MAX;
+         i += found + sep_length) {
+        count++;
+    }
+    value_t list = new_list_with_capacity(count);
+    for (size_t i = 0;;) {
+        size_t found = simd_find_substring(s + i, length - i, sep, sep_length);
+        if (found == SIZE_MAX) {
+            v_list_push(list, v_string(s + i));
+            return list;
+        }
+        v_list_push(list, v_string_owned(xstrndup(s + i, found)));
+        i += found + sep_length;
+    }
+}
+
+// A list has its indices and `length`, like in JavaScript.
+static int list_has(value_t list, value_t key) {
+    size_t index;
+    if (get_index(key, &index)) {
+        return index < v_list_length(list);
+    }
+    if (v_is_string(key)) {
+        const char *s = key.object->string;
+        char *end;
+        long n = strtol(s, &end, 10);
+        if (*s && !*end) {
+            return n >= 0 && (size_t)n < v_list_length(list);
+        }
+        return strcmp(s, "length") == 0;
+    }
+    return 0;
 }
 
 value_t v_in(value_t key, value_t dict) {
-    return v_number((v_is_dict(dict) || v_is_list(dict)) &&
-                    dict_hasv(&dict.object->dict, key));
+    if (v_is_list(dict)) {
+        return v_integer(list_has(dict, key));
+    }
+    return v_integer(v_is_dict(dict) && dict_hasv(&dict.object->dict, key));
 }
 
 size_t v_list_length(value_t list) {
     v_assert_type(list, list);
-    return v_to_integer(dict_get(&list.object->dict, "length"));
+    return list.object->list.length;
 }
 
 value_t v_list_push(value_t list, value_t new) {
     v_assert_type(list, list);
-    size_t index = v_list_length(list);
-    dict_setv(&list.object->dict, v_number(index), new);
-    dict_set(&list.object->dict, "length", v_number(index + 1));
+    list_t *l = &list.object->list;
+    if (l->length == l->capacity) {
+        l->capacity = l->capacity ? l->capacity * 2 : 4;
+        l->items = xrealloc(l->items, sizeof(value_t) * l->capacity);
+    }
+    l->items[l->length++] = new;
     return v_null;
 }
 
@@ -186,11 +393,11 @@ static value_t v_list_concat(value_t a, value_t b) {
     value_t new = v_list();
     size_t length = v_list_length(a), i;
     for (i = 0; i < length; i++) {
-        v_list_push(new, v_get(a, v_number(i)));
+        v_list_push(new, a.object->list.items[i]);
     }
     length = v_list_length(b);
     for (i = 0; i < length; i++) {
-        v_list_push(new, v_get(b, v_number(i)));
+        v_list_push(new, b.object->list.items[i]);
     }
     return new;
 }
@@ -199,22 +406,288 @@ static value_t v_list_index_of(value_t list, value_t item) {
     v_assert_type(list, list);
     size_t length = v_list_length(list);
     for (size_t i = 0; i < length; i++) {
-        if (v_equal(v_get(list, v_number(i)), item)) {
-            return v_number(i);
+        if (v_equal(list.object->list.items[i], item)) {
+            return v_integer(i);
+        }
+    }
+    return v_integer(-1);
+}
+
+static value_t list_last_index_of(value_t list, value_t item) {
+    v_assert_type(list, list);
+    for (size_t i = v_list_length(list); i-- > 0;) {
+        if (v_equal(list.object->list.items[i], item)) {
+            return v_integer(i);
         }
     }
-    return v_number(-1);
+    return v_integer(-1);
 }
 
-static value_t create_method(value_t object, native_func_t func) {
-    value_t m = v_native_func(func);
-    m.object->func.parent_scope = object;
-    return m;
+// Same as `slice()` on strings, there is no end index.
+static value_t list_slice(value_t list, value_t vindex) {
+    v_assert_type(list, list);
+    const list_t *l = &list.object->list;
+    size_t index = v_to_integer(vindex);
+    if (index >= l->length) {
+        return v_list();
+    }
+    value_t new = new_list_with_capacity(l->length - index);
+    memcpy(new.object->list.items, l->items + index,
+           sizeof(value_t) * (l->length - index));
+    new.object->list.length = l->length - index;
+    return new;
+}
+
+// The separator defaults to a comma.
+static value_t list_join(value_t list, value_t vsep) {
+    v_assert_type(list, list);
+    const list_t *l = &list.object->list;
+    char *sep = v_is_null(vsep) ? xstrdup(",") : v_to_string(vsep);
+    size_t sep_length = strlen(sep);
+
+    // The items which are not strings are converted first.
+    char **strings = xmalloc(sizeof(char *) * (l->length + 1));
+    size_t length = 0;
+    for (size_t i = 0; i < l->length; i++) {
+        value_t item = l->items[i];
+        strings[i] = v_is_string(item) ? item.object->string :
+            v_to_string(item);
+        length += strlen(strings[i]) + (i ? sep_length : 0);
+    }
+
+    char *result = xmalloc(length + 1), *p = result;
+    for (size_t i = 0; i < l->length; i++) {
+        if (i) {
+            memcpy(p, sep, sep_length);
+            p += sep_length;
+        }
+        size_t item_length = strlen(strings[i]);
+        memcpy(p, strings[i], item_length);
+        p += item_length;
+        if (!v_is_string(l->items[i])) {
+            free(strings[i]);
+        }
+    }
+    *p = 0;
+    free(strings);
+    free(sep);
+    return v_string_owned(result);
+}
+
+// The callbacks of `map()`, `filter()` and `reduce()` can push items to
+// the list, the new items are ignored. The result is referenced while
+// the callbacks run, since they can trigger the garbage collector.
+
+static value_t list_map(value_t list, value_t func) {
+    v_assert_type(list, list);
+    const list_t *l = &list.object->list;
+    size_t length = l->length;
+    value_t result = new_list_with_capacity(length);
+    v_inc_ref(result);
+    for (size_t i = 0; i < length && i < l->length; i++) {
+        v_list_push(result, call_func(func, l->items[i]));
+    }
+    v_dec_ref(result);
+    return result;
+}
+
+static value_t list_filter(value_t list, value_t func) {
+    v_assert_type(list, list);
+    const list_t *l = &list.object->list;
+    size_t length = l->length;
+    value_t result = new_list_with_capacity(length);
+    v_inc_ref(result);
+    for (size_t i = 0; i < length && i < l->length; i++) {
+        value_t item = l->items[i];
+        if (v_to_bool(call_func(func, item))) {
+            v_list_push(result, item);
+        }
+    }
+    v_dec_ref(result);
+    return result;
+}
+
+// Functions take one argument, so the reducer is curried:
+// `[1, 2, 3].reduce(function (a) { return function (b) { ... }; })`.
+// The first item is the initial accumulator. Returns null if the list
+// is empty.
+static value_t list_reduce(value_t list, value_t func) {
+    v_assert_type(list, list);
+    const list_t *l = &list.object->list;
+    size_t length = l->length;
+    if (!length) {
+        return v_null;
+    }
+    value_t acc = l->items[0];
+    for (size_t i = 1; i < length && i < l->length; i++) {
+        value_t reducer = call_func(func, acc);
+        acc = call_func(reducer, l->items[i]);
+    }
+    return acc;
+}
+
+// Lists are sorted in place with an introsort: a quicksort which falls
+// back to a heapsort when the recursion gets too deep, and finishes the
+// small partitions with an insertion sort. The comparator is curried
+// like the reducer above, and returns a negative number if its first
+// argument comes first. Without comparator, null comes first, then the
+// numbers in ascending order, then the strings in lexicographic order,
+// then the other values.
+
+struct sort {
+    value_t compare; // may be null
+    const list_t *list;
+    value_t *items; // used to detect changes made by the comparator
+    size_t length;
+};
+
+static int sort_rank(value_t v) {
+    return v_is_null(v) ? 0 : v_is_number(v) ? 1 : v_is_string(v) ? 2 : 3;
+}
+
+static int default_compare(value_t a, value_t b) {
+    int rank_a = sort_rank(a), rank_b = sort_rank(b);
+    if (rank_a != rank_b || rank_a == 0 || rank_a == 3) {
+        return rank_a - rank_b;
+    }
+    if (rank_a == 2) {
+        return strcmp(a.object->string, b.object->string);
+    }
+    if (both_integers(a, b)) {
+        return (a.integer > b.integer) - (a.integer < b.integer);
+    }
+    double x = v_to_number(a), y = v_to_number(b);
+    return (x > y) - (x < y);
+}
+
+static int sort_less(struct sort *sort, value_t a, value_t b) {
+    if (v_is_null(sort->compare)) {
+        return default_compare(a, b) < 0;
+    }
+    value_t compare_a = call_func(sort->compare, a);
+    double result = v_to_number(call_func(compare_a, b));
+    if (sort->list->items != sort->items ||
+        sort->list->length != sort->length) {
+        die("sort(): the list has been modified by the comparator");
+    }
+    return result < 0;
+}
+
+static void swap_items(value_t *a, value_t *b) {
+    value_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void insertion_sort(struct sort *sort, value_t *items, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        for (size_t j = i; j > 0 && sort_less(sort, items[j], items[j - 1]);
+             j--) {
+            swap_items(items + j, items + j - 1);
+        }
+    }
+}
+
+static void sift_down(struct sort *sort, value_t *items, size_t root,
+                      size_t n) {
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= n) {
+            return;
+        }
+        if (child + 1 < n && sort_less(sort, items[child], items[child + 1])) {
+            child++;
+        }
+        if (!sort_less(sort, items[root], items[child])) {
+            return;
+        }
+        swap_items(items + root, items + child);
+        root = child;
+    }
+}
+
+static void heap_sort(struct sort *sort, value_t *items, size_t n) {
+    for (size_t i = n / 2; i-- > 0;) {
+        sift_down(sort, items, i, n);
+    }
+    for (size_t end = n - 1; end > 0; end--) {
+        swap_items(items, items + end);
+        sift_down(sort, items, 0, end);
+    }
+}
+
+// The bounds checks in the partition loops make sure that an
+// inconsistent comparator cannot make it read outside of the list.
+static void introsort(struct sort *sort, value_t *items, size_t n,
+                      unsigned depth) {
+    while (n > 16) {
+        if (!depth--) {
+            heap_sort(sort, items, n);
+            return;
+        }
+
+        // Median of three, moved to the first item
+        size_t mid = n / 2;
+        if (sort_less(sort, items[mid], items[0])) {
+            swap_items(items + mid, items);
+        }
+        if (sort_less(sort, items[n - 1], items[mid])) {
+            swap_items(items + n - 1, items + mid);
+            if (sort_less(sort, items[mid], items[0])) {
+                swap_items(items + mid, items);
+            }
+        }
+        swap_items(items, items + mid);
+
+        size_t i = 0, j = n;
+        for (;;) {
+            do {
+                i++;
+            } while (i < n && sort_less(sort, items[i], items[0]));
+            do {
+                j--;
+            } while (j > 0 && sort_less(sort, items[0], items[j]));
+            if (i >= j) {
+                break;
+            }
+            swap_items(items + i, items + j);
+        }
+        swap_items(items, items + j);
+
+        // Recurses on the smaller side to bound the stack depth
+        if (j < n - j - 1) {
+            introsort(sort, items, j, depth);
+            items += j + 1;
+            n -= j + 1;
+        } else {
+            introsort(sort, items + j + 1, n - j - 1, depth);
+            n = j;
+        }
+    }
+    insertion_sort(sort, items, n);
+}
+
+// Returns the list itself.
+static value_t list_sort(value_t list, value_t compare) {
+    v_assert_type(list, list);
+    const list_t *l = &list.object->list;
+    struct sort sort = {
+        .compare = compare,
+        .list = l,
+        .items = l->items,
+        .length = l->length,
+    };
+    unsigned depth = 0;
+    for (size_t n = l->length; n > 1; n /= 2) {
+        depth += 2;
+    }
+    introsort(&sort, l->items, l->length, depth);
+    return list;
 }
 
 static value_t get_list_property(value_t list, const char *key) {
     if (strcmp(key, "length") == 0) {
-        return dict_get(&list.object->dict, "length");
+        return v_integer(v_list_length(list));
     }
     if (strcmp(key, "indexOf") == 0) {
         return create_method(list, v_list_index_of);
@@ -225,13 +698,34 @@ static value_t get_list_property(value_t list, const char *key) {
     if (strcmp(key, "concat") == 0) {
         return create_method(list, v_list_concat);
     }
+    if (strcmp(key, "lastIndexOf") == 0) {
+        return create_method(list, list_last_index_of);
+    }
+    if (strcmp(key, "slice") == 0) {
+        return create_method(list, list_slice);
+    }
+    if (strcmp(key, "join") == 0) {
+        return create_method(list, list_join);
+    }
+    if (strcmp(key, "map") == 0) {
+        return create_method(list, list_map);
+    }
+    if (strcmp(key, "filter") == 0) {
+        return create_method(list, list_filter);
+    }
+    if (strcmp(key, "reduce") == 0) {
+        return create_method(list, list_reduce);
+    }
+    if (strcmp(key, "sort") == 0) {
+        return create_method(list, list_sort);
+    }
 
     return v_null;
 }
 
 static value_t get_string_property(value_t string, const char *key) {
     if (strcmp(key, "length") == 0) {
-        return v_number(strlen(string.object->string));
+        return v_integer(string.object->string_length);
     }
     if (strcmp(key, "slice") == 0) {
         return create_method(string, string_slice);
@@ -242,6 +736,15 @@ static value_t get_string_property(value_t string, const char *key) {
     if (strcmp(key, "charCodeAt") == 0) {
         return create_method(string, string_char_code_at);
     }
+    if (strcmp(key, "indexOfAny") == 0) {
+        return create_method(string, string_index_of_any);
+    }
+    if (strcmp(key, "lastIndexOf") == 0) {
+        return create_method(string, string_last_index_of);
+    }
+    if (strcmp(key, "split") == 0) {
+        return create_method(string, string_split);
+    }
 
     return v_null;
 }
@@ -251,11 +754,12 @@ value_t v_get(value_t obj, value_t key) {
         return dict_getv(&obj.object->dict, key);
 
     } else if (v_is_list(obj)) {
-        if (v_is_number(key)) {
-            size_t index = v_to_integer(key);
+        size_t index;
+        if (get_index(key, &index)) {
             if (index < v_list_length(obj)) {
-                return dict_getv(&obj.object->dict, key);
+                return obj.object->list.items[index];
             }
+            return v_null;
         }
 
         char *skey = v_to_string(key);
@@ -264,10 +768,10 @@ value_t v_get(value_t obj, value_t key) {
         return result;
 
     } else if (v_is_string(obj)) {
-        if (v_is_number(key)) {
-            size_t index = key.number;
+        size_t index;
+        if (get_index(key, &index)) {
             const char *s = obj.object->string;
-            if (index < strlen(s)) {
+            if (index < obj.object->string_length) {
                 char c[2] = {s[index], 0};
                 return v_string(c);
             }
@@ -278,6 +782,18 @@ value_t v_get(value_t obj, value_t key) {
         value_t result = get_string_property(obj, skey);
         free(skey);
         return result;
+
+    } else if (v_is_float64_array(obj)) {
+        size_t index;
+        if (get_index(key, &index)) {
+            const float64_array_t *a = &obj.object->float64_array;
+            return index < a->length ? v_number(a->data[index]) : v_null;
+        }
+
+        char *skey = v_to_string(key);
+        value_t result = get_float64_array_property(obj, skey);
+        free(skey);
+        return result;
     }
 
     return v_null;
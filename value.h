@@ -3,6 +3,7 @@
 
 #include <math.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define MAX_SAFE_INTEGER (9007199254740991)
 #define MIN_SAFE_INTEGER (-9007199254740991)
@@ -10,9 +11,13 @@
 typedef struct object object_t;
 typedef struct value value_t;
 
+// Numbers are either integers or doubles. Integers in the safe range
+// are always represented as `value_type_integer`, the other numbers as
+// `value_type_number`.
 enum value_type {
     value_type_null,
     value_type_number,
+    value_type_integer,
     value_type_object,
 };
 
@@ -21,15 +26,32 @@ struct value {
     union {
         object_t *object;
         double number; // NaN is invalid
+        int64_t integer;
     };
 };
 
 extern const value_t v_null;
 
+// `n` must be in the safe integer range.
+static inline value_t v_integer(int64_t n) {
+    return (value_t){
+        .type = value_type_integer,
+        .integer = n,
+    };
+}
+
 static inline value_t v_number(double nbr) {
+    if (isnan(nbr)) {
+        return v_integer(0);
+    }
+    // -0 stays a double, the integers have no sign bit for it
+    if (nbr >= MIN_SAFE_INTEGER && nbr <= MAX_SAFE_INTEGER &&
+        nbr == (int64_t)nbr && (nbr != 0 || !signbit(nbr))) {
+        return v_integer((int64_t)nbr);
+    }
     return (value_t){
         .type = value_type_number,
-        .number = isnan((double)nbr) ? 0 : nbr
+        .number = nbr,
     };
 }
 
@@ -45,6 +67,14 @@ static inline value_t v_number(double nbr) {
         .object = new_string_object(cstr),      \
     })
 
+// The string must be allocated with `malloc()`. It is freed with the
+// object.
+#define v_string_owned(cstr)                    \
+    ((value_t){                                 \
+        .type = value_type_object,              \
+        .object = new_string_object_owned(cstr),\
+    })
+
 #define v_string_from_char(c)                   \
     (v_string((char[]){c}))
 
@@ -67,11 +97,14 @@ static inline value_t v_number(double nbr) {
      (v).object->type == object_type_##expected_type)
 
 #define v_is_null(v)    ((v).type == value_type_null)
-#define v_is_number(v)  ((v).type == value_type_number)
+#define v_is_number(v)  ((v).type == value_type_number ||      \
+                         (v).type == value_type_integer)
+#define v_is_integer(v) ((v).type == value_type_integer)
 #define v_is_dict(v)    (v_is_object_of_type((v), dict))
 #define v_is_list(v)    (v_is_object_of_type((v), list))
 #define v_is_string(v)  (v_is_object_of_type((v), string))
 #define v_is_func(v)    (v_is_object_of_type((v), func))
+#define v_is_float64_array(v) (v_is_object_of_type((v), float64_array))
 
 // Used to force the GC not to collect an object (because the GC does not
 // visit the C stack).
@@ -106,11 +139,12 @@ long v_to_integer(value_t v);
     X(add) X(sub) X(mul) X(div) X(mod) X(gt) X(lt) X(gte) X(lte)
 #undef X
 
+value_t v_unary_minus(value_t a);
 const char *v_typeof(value_t a);
 
 int v_equal(value_t a, value_t b);
-#define v_eq(a, b)  (v_number(v_equal(a, b)))
-#define v_neq(a, b) (v_number(!v_equal(a, b)))
+#define v_eq(a, b)  (v_integer(v_equal(a, b)))
+#define v_neq(a, b) (v_integer(!v_equal(a, b)))
 
 value_t v_in(value_t key, value_t dict);
 void v_set(value_t dict, value_t key, value_t v);
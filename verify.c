@@ -0,0 +1,251 @@
+#include "toy.h"
+
+// The bytecode verifier. It checks the stack-based code of a function
+// once, when it is loaded, so that the interpreter runs it without
+// checking each instruction (see `interpret()` in `vm.c`):
+//
+// - each opcode is a stack-based one, and its operand is in the code
+// - an `extended_arg` prefix is followed by an instruction with an operand
+// - the constants are in range, and the names are strings
+// - the functions of `load_func` are in the file
+// - the jumps target instructions of the function
+// - the stack has the same depth on every path to an instruction, never
+//   pops more than it has and never exceeds `STACK_CAPACITY`
+// - the code does not run past its end
+//
+// The unreachable instructions are not checked, they never run.
+
+enum operand {
+    operand_none,
+    operand_const,
+    operand_name, // A constant, which must be a string
+    operand_func,
+    operand_target,
+};
+
+enum flow {
+    flow_next,
+    flow_branch, // Jumps or goes to the next instruction
+    flow_jump,
+    flow_return,
+};
+
+typedef struct effect {
+    // The stack must have at least `pops` values. `pushes` are pushed
+    // instead, and `pops_if_next` more are popped when a branch doesn't
+    // jump (see `goto_if_or_pop`).
+    unsigned char pops, pushes, pops_if_next;
+    unsigned char operand; // enum operand
+    unsigned char flow; // enum flow
+    unsigned char valid;
+} effect_t;
+
+#define EFFECT(pops_, pushes_, operand_, flow_)                 \
+    {.pops = pops_, .pushes = pushes_, .operand = operand_,     \
+     .flow = flow_, .valid = 1}
+
+#define BIN_OP EFFECT(2, 1, operand_none, flow_next)
+
+#define GOTO_UNLESS_BIN_OP EFFECT(2, 0, operand_target, flow_branch)
+
+static const effect_t effects[opcode__count] = {
+    [opcode_return] = EFFECT(0, 0, operand_none, flow_return),
+    [opcode_return_null] = EFFECT(0, 0, operand_none, flow_return),
+
+    [opcode_add] = BIN_OP, [opcode_sub] = BIN_OP, [opcode_mul] = BIN_OP,
+    [opcode_div] = BIN_OP, [opcode_mod] = BIN_OP,
+    [opcode_eq] = BIN_OP, [opcode_neq] = BIN_OP,
+    [opcode_gt] = BIN_OP, [opcode_lt] = BIN_OP,
+    [opcode_gte] = BIN_OP, [opcode_lte] = BIN_OP,
+    [opcode_in] = BIN_OP, [opcode_get] = BIN_OP,
+
+    [opcode_not] = EFFECT(1, 1, operand_none, flow_next),
+    [opcode_typeof] = EFFECT(1, 1, operand_none, flow_next),
+    [opcode_unary_minus] = EFFECT(1, 1, operand_none, flow_next),
+    [opcode_set] = EFFECT(3, 0, operand_none, flow_next),
+
+    [opcode_load_empty_list] = EFFECT(0, 1, operand_none, flow_next),
+    [opcode_load_empty_dict] = EFFECT(0, 1, operand_none, flow_next),
+    [opcode_load_null] = EFFECT(0, 1, operand_none, flow_next),
+    [opcode_load_func] = EFFECT(0, 1, operand_func, flow_next),
+    [opcode_load_const] = EFFECT(0, 1, operand_const, flow_next),
+    [opcode_load_var] = EFFECT(1, 1, operand_none, flow_next),
+    [opcode_store_var] = EFFECT(2, 0, operand_none, flow_next),
+    [opcode_decl_var] = EFFECT(1, 0, operand_none, flow_next),
+
+    [opcode_goto] = EFFECT(0, 0, operand_target, flow_jump),
+    [opcode_goto_if] = EFFECT(1, 0, operand_target, flow_branch),
+    [opcode_goto_unless] = EFFECT(1, 0, operand_target, flow_branch),
+    [opcode_goto_if_or_pop] = {
+        .pops = 1, .pushes = 1, .pops_if_next = 1,
+        .operand = operand_target, .flow = flow_branch, .valid = 1,
+    },
+    [opcode_goto_unless_or_pop] = {
+        .pops = 1, .pushes = 1, .pops_if_next = 1,
+        .operand = operand_target, .flow = flow_branch, .valid = 1,
+    },
+    [opcode_goto_unless_eq] = GOTO_UNLESS_BIN_OP,
+    [opcode_goto_unless_neq] = GOTO_UNLESS_BIN_OP,
+    [opcode_goto_unless_gt] = GOTO_UNLESS_BIN_OP,
+    [opcode_goto_unless_lt] = GOTO_UNLESS_BIN_OP,
+    [opcode_goto_unless_gte] = GOTO_UNLESS_BIN_OP,
+    [opcode_goto_unless_lte] = GOTO_UNLESS_BIN_OP,
+
+    [opcode_call] = EFFECT(2, 1, operand_none, flow_next),
+    [opcode_dup] = EFFECT(1, 2, operand_none, flow_next),
+    [opcode_pop] = EFFECT(1, 0, operand_none, flow_next),
+    [opcode_rot] = EFFECT(2, 2, operand_none, flow_next),
+    [opcode_list_push] = EFFECT(2, 1, operand_none, flow_next),
+    [opcode_dict_push] = EFFECT(3, 1, operand_none, flow_next),
+
+    [opcode_load_var_const] = EFFECT(0, 1, operand_name, flow_next),
+    [opcode_store_var_const] = EFFECT(1, 0, operand_name, flow_next),
+    [opcode_decl_var_const] = EFFECT(0, 0, operand_name, flow_next),
+    [opcode_get_const] = EFFECT(1, 1, operand_const, flow_next),
+};
+
+static unsigned read_uint16(const compiled_func_t *func, size_t ip) {
+    return func->code[ip] * 0x100 + func->code[ip + 1];
+}
+
+// Decodes the instruction at `ip`, with its `extended_arg` prefix if it
+// has one. Returns its size, or zero if it is invalid.
+static size_t decode(const compiled_func_t *func, size_t ip,
+                     enum opcode *op, size_t *operand) {
+    const size_t length = func->code_length;
+    size_t prefix = 0;
+    *operand = 0;
+    if (func->code[ip] == opcode_extended_arg) {
+        if (ip + 3 >= length) {
+            return 0;
+        }
+        *operand = (size_t)read_uint16(func, ip + 1) << 16;
+        prefix = 3;
+        ip += prefix;
+    }
+    *op = func->code[ip];
+    if (*op >= opcode__count || !effects[*op].valid) {
+        return 0;
+    }
+    if (effects[*op].operand == operand_none) {
+        return prefix ? 0 : 1;
+    }
+    if (ip + 3 > length) {
+        return 0;
+    }
+    *operand |= read_uint16(func, ip + 1);
+    return prefix + 3;
+}
+
+static int check_operand(const compiled_func_t *func, const effect_t *e,
+                         size_t operand, const unsigned char *starts) {
+    switch (e->operand) {
+    case operand_const:
+        return operand < func->const_count;
+    case operand_name:
+        return operand < func->const_count &&
+            v_is_string(func->consts[operand]);
+    case operand_func:
+        // Files only grow, see `append_compiled_funcs()`
+        return operand < func->file->func_count;
+    case operand_target:
+        return operand < func->code_length && starts[operand];
+    default:
+        return 1;
+    }
+}
+
+// Records the depth of the stack before the instruction at `ip`. Returns
+// zero if another path reaches it with another depth.
+static int reach(long *depths, size_t *pending, size_t *pending_count,
+                 size_t ip, long depth) {
+    if (depths[ip] >= 0) {
+        return depths[ip] == depth;
+    }
+    depths[ip] = depth;
+    pending[(*pending_count)++] = ip;
+    return 1;
+}
+
+static int verify(compiled_func_t *func, unsigned char *starts,
+                  long *depths, size_t *pending) {
+    const size_t length = func->code_length;
+
+    // Finds the instructions, and checks their operands but the targets
+    for (size_t ip = 0; ip < length; ) {
+        enum opcode op;
+        size_t operand;
+        size_t size = decode(func, ip, &op, &operand);
+        if (!size) {
+            return 0;
+        }
+        const effect_t *e = effects + op;
+        starts[ip] = 1;
+        if (e->operand != operand_target &&
+            !check_operand(func, e, operand, starts)) {
+            return 0;
+        }
+        ip += size;
+    }
+
+    size_t pending_count = 0, max_depth = 0;
+    reach(depths, pending, &pending_count, 0, 0);
+    while (pending_count) {
+        size_t ip = pending[--pending_count];
+        enum opcode op;
+        size_t operand;
+        size_t next = ip + decode(func, ip, &op, &operand);
+        const effect_t *e = effects + op;
+        long depth = depths[ip];
+        if (depth < e->pops) {
+            return 0;
+        }
+        depth += e->pushes - e->pops;
+        if (depth > STACK_CAPACITY) {
+            return 0;
+        }
+        if ((size_t)depth > max_depth) {
+            max_depth = depth;
+        }
+        if (e->flow == flow_return) {
+            continue;
+        }
+        if (e->operand == operand_target) {
+            if (!check_operand(func, e, operand, starts) ||
+                !reach(depths, pending, &pending_count, operand, depth)) {
+                return 0;
+            }
+        }
+        if (e->flow != flow_jump) {
+            if (next >= length ||
+                !reach(depths, pending, &pending_count, next,
+                       depth - e->pops_if_next)) {
+                return 0;
+            }
+        }
+    }
+    func->max_stack_depth = max_depth;
+    return 1;
+}
+
+int verify_func(compiled_func_t *func) {
+    func->verified = 0;
+    if (!func->code || func->register_count || !func->code_length) {
+        return 0;
+    }
+    size_t length = func->code_length;
+    unsigned char *starts = calloc(length, 1);
+    long *depths = malloc(sizeof(long) * length);
+    size_t *pending = malloc(sizeof(size_t) * length);
+    if (!starts || !depths || !pending) {
+        die("verify_func(): out of memory");
+    }
+    for (size_t i = 0; i < length; i++) {
+        depths[i] = -1;
+    }
+    func->verified = verify(func, starts, depths, pending);
+    free(starts);
+    free(depths);
+    free(pending);
+    return func->verified;
+}
@@ -1,4 +1,6 @@
 #include "toy.h"
+#include <sys/mman.h>
+#include <ucontext.h>
 
 static value_t scope_lookup(value_t scope, const char *name) {
     if (dict_has(&scope.object->dict, name)) {
@@ -20,17 +22,17 @@ static value_t scope_lookup_or_die(value_t scope, const char *name) {
     die(v_to_string(v_add(v_string("undefined variable "), namev)));
 }
 
-static value_t scope_get(value_t scope, const char *name) {
+value_t scope_get(value_t scope, const char *name) {
     scope = scope_lookup_or_die(scope, name);
     return dict_get(&scope.object->dict, name);
 }
 
-static void scope_set(value_t scope, const char *name, value_t v) {
+void scope_set(value_t scope, const char *name, value_t v) {
     scope = scope_lookup_or_die(scope, name);
     dict_set(&scope.object->dict, name, v);
 }
 
-static void scope_decl(value_t scope, const char *name) {
+void scope_decl(value_t scope, const char *name) {
     if (!dict_has(&scope.object->dict, name)) {
         dict_set(&scope.object->dict, name, v_null);
     }
@@ -64,15 +66,16 @@ value_t call_func(value_t func, value_t arg) {
 
 typedef struct stackk stackk_t;
 
-#define STACK_CAPACITY 20
-
 struct stackk {
     value_t list[STACK_CAPACITY];
     size_t size;
 };
 
-static value_t stack_pop(stackk_t *stack) {
-    if (!stack->size) {
+// The checks are skipped if `checked` is zero, for the verified code.
+// See `interpret()`.
+
+static inline value_t stack_pop(stackk_t *stack, int checked) {
+    if (checked && !stack->size) {
         die("stack underflow");
     }
     value_t value = stack->list[--(stack->size)];
@@ -80,15 +83,15 @@ static value_t stack_pop(stackk_t *stack) {
     return value;
 }
 
-static value_t stack_get_top(const stackk_t *stack) {
-    if (!stack->size) {
+static inline value_t stack_get_top(const stackk_t *stack, int checked) {
+    if (checked && !stack->size) {
         die("empty stack");
     }
     return stack->list[stack->size - 1];
 }
 
-static void stack_push(stackk_t *stack, value_t value) {
-    if (stack->size == STACK_CAPACITY) {
+static inline void stack_push(stackk_t *stack, value_t value, int checked) {
+    if (checked && stack->size == STACK_CAPACITY) {
         die("stack overflow");
     }
     v_inc_ref(value);
@@ -101,19 +104,8 @@ static void stack_flush(stackk_t * stack) {
     }
 }
 
-value_t eval_func(value_t funcv, value_t scope) {
-    v_assert_type(funcv, func);
-    v_inc_ref(funcv);
-    v_inc_ref(scope);
-    func_t *func = &funcv.object->func;
-    const compiled_func_t *comp = func->compiled;
-    stackk_t stack = {};
-    size_t ip = 0;
-
-#define tos (stack_get_top(&stack))
-
-#define push(v) stack_push(&stack, (v))
-#define pop()   stack_pop(&stack)
+// Instruction decoding, shared by both interpreter loops. They need
+// `comp`, `ip` and `checked` variables.
 
 #define peek_opcode(offset) (comp->code[ip + (offset)])
 
@@ -124,14 +116,124 @@ value_t eval_func(value_t funcv, value_t scope) {
         next__op;                               \
     })
 
-    // Big endian
+// Big endian
 #define peek_uint16()                                   \
     ((unsigned)peek_opcode(0) * 0x100 + peek_opcode(1)) \
 
+#define next_uint16()                           \
+    ({                                          \
+        unsigned next__n = peek_uint16();       \
+        ip += 2;                                \
+        next__n;                                \
+    })
+
+// The operand of an instruction, with the high bits of the preceding
+// `extended_arg`, if any. It needs an `extended_arg` variable.
+#define next_operand()                                          \
+    ({                                                          \
+        size_t next__arg = extended_arg | next_uint16();        \
+        extended_arg = 0;                                       \
+        next__arg;                                              \
+    })
+
+#define next_const()                                            \
+    ({                                                          \
+        size_t next__index = next_operand();                    \
+        if (checked && next__index >= comp->const_count) {      \
+            die("const index out of range");                    \
+        }                                                       \
+        comp->consts[next__index];                              \
+    })
+
+// The name of a variable or a property, stored in the constants
+#define next_name()                             \
+    ({                                          \
+        value_t next__name = next_const();      \
+        if (checked) {                          \
+            v_assert_type(next__name, string);  \
+        }                                       \
+        next__name.object->string;              \
+    })
+
+__thread vm_frame_t *current_frame = 0;
+
+// The position in the frames of the functions which are not interpreted
+#define UNKNOWN_IP SIZE_MAX
+
+static value_t eval_register_func(const compiled_func_t *comp,
+                                  value_t scope, vm_frame_t *frame);
+
+static value_t eval_frame(value_t funcv, value_t scope, vm_frame_t *frame);
+
+static inline value_t interpret(value_t funcv, value_t scope,
+                                vm_frame_t *frame, const int checked);
+
+value_t eval_func(value_t funcv, value_t scope) {
+    v_assert_type(funcv, func);
+    vm_frame_t frame = {
+        .func = funcv.object->func.compiled,
+        .ip = 0,
+        .parent = current_frame,
+    };
+    current_frame = &frame;
+    value_t result = eval_frame(funcv, scope, &frame);
+    current_frame = frame.parent;
+    return result;
+}
+
+static value_t eval_frame(value_t funcv, value_t scope, vm_frame_t *frame) {
+    v_inc_ref(funcv);
+    v_inc_ref(scope);
+    func_t *func = &funcv.object->func;
+    if (!func->compiled->code) {
+        compile_lazily(func->compiled);
+    }
+    const compiled_func_t *comp = func->compiled;
+    if (comp->aot || comp->register_count) {
+        if (comp->aot) {
+            frame->ip = UNKNOWN_IP;
+        }
+        value_t result = comp->aot ? comp->aot(scope) :
+            eval_register_func(comp, scope, frame);
+        v_dec_ref(funcv);
+        v_dec_ref(scope);
+        return result;
+    }
+    if (jit_tick(func->compiled)) {
+        frame->ip = UNKNOWN_IP;
+        value_t result = jit_run(func->compiled, scope, NULL, 0, 0);
+        v_dec_ref(funcv);
+        v_dec_ref(scope);
+        return result;
+    }
+    // Two copies of the loop, with and without the checks
+    return comp->verified ? interpret(funcv, scope, frame, 0) :
+        interpret(funcv, scope, frame, 1);
+}
+
+// The stack-based interpreter loop. If `checked` is zero, the function
+// has been verified (see `verify.c`): the operands are valid and the
+// stack never underflows nor overflows, so they are not checked.
+static inline __attribute__((always_inline))
+value_t interpret(value_t funcv, value_t scope, vm_frame_t *frame,
+                  const int checked) {
+    func_t *func = &funcv.object->func;
+    const compiled_func_t *comp = func->compiled;
+    stackk_t stack = {};
+    size_t ip = 0;
+    size_t extended_arg = 0;
+
+#define tos (stack_get_top(&stack, checked))
+
+#define push(v) stack_push(&stack, (v), checked)
+#define pop()   stack_pop(&stack, checked)
+
     for (;;) {
         request_garbage_collection();
 
+        frame->ip = ip;
         enum opcode opcode = next_opcode();
+        PROFILE_OPCODE(opcode);
         switch (opcode) {
         case opcode_return:
             v_dec_ref(funcv);
@@ -142,15 +244,15 @@ value_t eval_func(value_t funcv, value_t scope) {
             }
             return tos;
 
-        case opcode_load_const: {
-            unsigned index = peek_uint16();
-            ip += 2;
-            if (index >= comp->const_count) {
-                die("load_const: const index out of range");
-            }
-            push(comp->consts[index]);
+        case opcode_return_null:
+            v_dec_ref(funcv);
+            v_dec_ref(scope);
+            stack_flush(&stack);
+            return v_null;
+
+        case opcode_load_const:
+            push(next_const());
             break;
-        }
 
         case opcode_load_null:
             push(v_null);
@@ -198,13 +300,20 @@ value_t eval_func(value_t funcv, value_t scope) {
             break;
         }
 
+        case opcode_load_var_const:
+            push(scope_get(scope, next_name()));
+            break;
+
+        case opcode_decl_var_const:
+            scope_decl(scope, next_name());
+            break;
+
         case opcode_load_func: {
-            unsigned index = peek_uint16();
-            ip += 2;
-            if (index >= comp->file->func_count) {
+            size_t index = next_operand();
+            if (checked && index >= comp->file->func_count) {
                 die("load_func: func index out of range");
             }
-            compiled_func_t *comp_closure = comp->file->funcs + index;
+            compiled_func_t *comp_closure = comp->file->funcs[index];
             object_t *closure_obj = new_compiled_func_object(comp_closure);
             closure_obj->func.parent_scope = scope;
             value_t closure_value = {
@@ -230,29 +339,74 @@ value_t eval_func(value_t funcv, value_t scope) {
             break;
         }
 
+        case opcode_store_var_const: {
+            value_t value = pop();
+            scope_set(scope, next_name(), value);
+            break;
+        }
+
         case opcode_dup:
             push(tos);
             break;
 
-        case opcode_goto:
-            ip = peek_uint16();
+        case opcode_goto: {
+            size_t target = next_operand();
+            if (target < ip && jit_tick(func->compiled)) {
+                // Runs the rest of the loop as machine code. The stack
+                // references are taken over.
+                frame->ip = UNKNOWN_IP;
+                value_t result = jit_run(func->compiled, scope,
+                                         stack.list, stack.size, target);
+                v_dec_ref(funcv);
+                v_dec_ref(scope);
+                return result;
+            }
+            ip = target;
             break;
+        }
 
         case opcode_goto_if: {
-            unsigned next = peek_uint16();
-            ip += 2;
+            size_t next = next_operand();
             if (v_to_bool(pop())) {
                 ip = next;
             }
             break;
         }
 
+        case opcode_goto_unless: {
+            size_t next = next_operand();
+            if (!v_to_bool(pop())) {
+                ip = next;
+            }
+            break;
+        }
+
+        case opcode_goto_if_or_pop: {
+            size_t next = next_operand();
+            if (v_to_bool(tos)) {
+                ip = next;
+            } else {
+                pop();
+            }
+            break;
+        }
+
+        case opcode_goto_unless_or_pop: {
+            size_t next = next_operand();
+            if (!v_to_bool(tos)) {
+                ip = next;
+            } else {
+                pop();
+            }
+            break;
+        }
+
         case opcode_not:
-            push(v_number(!v_to_bool(pop())));
+            push(v_integer(!v_to_bool(pop())));
             break;
 
         case opcode_unary_minus:
-            push(v_number(-v_to_number(pop())));
+            push(v_unary_minus(pop()));
             break;
 
         case opcode_typeof:
@@ -274,6 +428,16 @@ value_t eval_func(value_t funcv, value_t scope) {
             break;
         }
 
+        case opcode_get_const: {
+            value_t dict = pop();
+            push(v_get(dict, next_const()));
+            break;
+        }
+
+        case opcode_extended_arg:
+            extended_arg = (size_t)next_uint16() << 16;
+            break;
+
         case opcode_rot: {
             value_t a = pop();
             value_t b = pop();
@@ -297,6 +461,255 @@ value_t eval_func(value_t funcv, value_t scope) {
         case_bin_op(gte) case_bin_op(lte)
         case_bin_op(in)
 
+#define case_goto_unless_bin_op(name)                           \
+            case opcode_goto_unless_##name: {                   \
+                size_t _next = next_operand();                  \
+                value_t _right = pop();                         \
+                value_t _left = pop();                          \
+                if (!v_to_bool(v_##name(_left, _right))) {      \
+                    ip = _next;                                 \
+                }                                               \
+                break;                                          \
+            }
+
+        case_goto_unless_bin_op(eq) case_goto_unless_bin_op(neq)
+        case_goto_unless_bin_op(gt) case_goto_unless_bin_op(lt)
+        case_goto_unless_bin_op(gte) case_goto_unless_bin_op(lte)
+
+        default:
+            die(v_to_string(v_add(v_string("unknown opcode "),
+                                  v_number(opcode))));
+        }
+    }
+}
+
+static void reg_set(value_t *reg, value_t v) {
+    v_inc_ref(v);
+    v_dec_ref(*reg);
+    *reg = v;
+}
+
+// Register-based counterpart of `interpret()`. Registers hold a
+// reference to their value, like the stack.
+static value_t eval_register_func(const compiled_func_t *comp,
+                                  value_t scope, vm_frame_t *frame) {
+    value_t regs[comp->register_count];
+    for (size_t i = 0; i < comp->register_count; i++) {
+        regs[i] = v_null;
+    }
+    size_t ip = 0;
+    const int checked = 1; // The register code is not verified
+    size_t extended_arg = 0; // Only used by the stack-based code
+
+#define next_reg()                                      \
+    ({                                                  \
+        unsigned next__reg = peek_opcode(0);            \
+        ip++;                                           \
+        if (next__reg >= comp->register_count) {        \
+            die("register out of range");               \
+        }                                               \
+        regs + next__reg;                               \
+    })
+
+#define flush_regs()                                    \
+    do {                                                \
+        for (size_t _i = 0; _i < comp->register_count; _i++) {  \
+            v_dec_ref(regs[_i]);                        \
+        }                                               \
+    } while (0)
+
+    for (;;) {
+        request_garbage_collection();
+
+        frame->ip = ip;
+        enum opcode opcode = next_opcode();
+        PROFILE_OPCODE(opcode);
+        switch (opcode) {
+        case opcode_r_return: {
+            value_t result = *next_reg();
+            flush_regs();
+            return result;
+        }
+
+        case opcode_r_return_null:
+            flush_regs();
+            return v_null;
+
+        case opcode_r_move: {
+            value_t *dst = next_reg();
+            reg_set(dst, *next_reg());
+            break;
+        }
+
+        case opcode_r_load_const: {
+            value_t *dst = next_reg();
+            reg_set(dst, next_const());
+            break;
+        }
+
+        case opcode_r_load_null:
+            reg_set(next_reg(), v_null);
+            break;
+
+        case opcode_r_load_empty_list:
+            reg_set(next_reg(), v_list());
+            break;
+
+        case opcode_r_load_empty_dict:
+            reg_set(next_reg(), v_dict());
+            break;
+
+        case opcode_r_list_push: {
+            value_t list = *next_reg();
+            value_t item = *next_reg();
+            v_assert_type(list, list);
+            v_list_push(list, item);
+            break;
+        }
+
+        case opcode_r_dict_push: {
+            value_t dict = *next_reg();
+            value_t key = *next_reg();
+            value_t value = *next_reg();
+            v_set(dict, key, value);
+            break;
+        }
+
+        case opcode_r_load_func: {
+            value_t *dst = next_reg();
+            unsigned index = next_uint16();
+            if (index >= comp->file->func_count) {
+                die("load_func: func index out of range");
+            }
+            compiled_func_t *comp_closure = comp->file->funcs[index];
+            object_t *closure_obj = new_compiled_func_object(comp_closure);
+            closure_obj->func.parent_scope = scope;
+            value_t closure_value = {
+                .type = value_type_object,
+                .object = closure_obj,
+            };
+            reg_set(dst, closure_value);
+            break;
+        }
+
+        case opcode_r_load_var: {
+            value_t *dst = next_reg();
+            reg_set(dst, scope_get(scope, next_name()));
+            break;
+        }
+
+        case opcode_r_store_var: {
+            value_t value = *next_reg();
+            scope_set(scope, next_name(), value);
+            break;
+        }
+
+        case opcode_r_decl_var:
+            scope_decl(scope, next_name());
+            break;
+
+        case opcode_r_call: {
+            value_t *dst = next_reg();
+            value_t child_func = *next_reg();
+            value_t arg = *next_reg();
+            reg_set(dst, call_func(child_func, arg));
+            break;
+        }
+
+        case opcode_r_set: {
+            value_t dict = *next_reg();
+            value_t key = *next_reg();
+            value_t value = *next_reg();
+            v_set(dict, key, value);
+            break;
+        }
+
+        case opcode_r_get: {
+            value_t *dst = next_reg();
+            value_t dict = *next_reg();
+            value_t key = *next_reg();
+            reg_set(dst, v_get(dict, key));
+            break;
+        }
+
+        case opcode_r_get_const: {
+            value_t *dst = next_reg();
+            value_t dict = *next_reg();
+            reg_set(dst, v_get(dict, next_const()));
+            break;
+        }
+
+        case opcode_r_not: {
+            value_t *dst = next_reg();
+            reg_set(dst, v_integer(!v_to_bool(*next_reg())));
+            break;
+        }
+
+        case opcode_r_unary_minus: {
+            value_t *dst = next_reg();
+            reg_set(dst, v_unary_minus(*next_reg()));
+            break;
+        }
+
+        case opcode_r_typeof: {
+            value_t *dst = next_reg();
+            reg_set(dst, v_string(v_typeof(*next_reg())));
+            break;
+        }
+
+        case opcode_r_goto:
+            ip = peek_uint16();
+            break;
+
+        case opcode_r_goto_if: {
+            value_t cond = *next_reg();
+            unsigned next = next_uint16();
+            if (v_to_bool(cond)) {
+                ip = next;
+            }
+            break;
+        }
+
+        case opcode_r_goto_unless: {
+            value_t cond = *next_reg();
+            unsigned next = next_uint16();
+            if (!v_to_bool(cond)) {
+                ip = next;
+            }
+            break;
+        }
+
+#define case_r_bin_op(name)                             \
+            case opcode_r_##name: {                     \
+                value_t *_dst = next_reg();             \
+                value_t _left = *next_reg();            \
+                value_t _right = *next_reg();           \
+                reg_set(_dst, v_##name(_left, _right)); \
+                break;                                  \
+            }
+
+        case_r_bin_op(add) case_r_bin_op(sub)
+        case_r_bin_op(mul) case_r_bin_op(div) case_r_bin_op(mod)
+        case_r_bin_op(eq) case_r_bin_op(neq)
+        case_r_bin_op(gt) case_r_bin_op(lt)
+        case_r_bin_op(gte) case_r_bin_op(lte)
+        case_r_bin_op(in)
+
+#define case_r_goto_unless_bin_op(name)                         \
+            case opcode_r_goto_unless_##name: {                 \
+                value_t _left = *next_reg();                    \
+                value_t _right = *next_reg();                   \
+                unsigned _next = next_uint16();                 \
+                if (!v_to_bool(v_##name(_left, _right))) {      \
+                    ip = _next;                                 \
+                }                                               \
+                break;                                          \
+            }
+
+        case_r_goto_unless_bin_op(eq) case_r_goto_unless_bin_op(neq)
+        case_r_goto_unless_bin_op(gt) case_r_goto_unless_bin_op(lt)
+        case_r_goto_unless_bin_op(gte) case_r_goto_unless_bin_op(lte)
+
         default:
             die(v_to_string(v_add(v_string("unknown opcode "),
                                   v_number(opcode))));
@@ -310,6 +723,44 @@ static const char *opcode_names[opcode__count + 1] = {
 #undef X
 };
 
+unsigned func_line(const compiled_func_t *func, size_t ip) {
+    if (ip == UNKNOWN_IP || !func->line_count || ip < func->lines[0]) {
+        return 0;
+    }
+    // The last entry whose offset is not after `ip`
+    size_t low = 0, high = func->line_count;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (func->lines[2 * middle] <= ip) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return func->lines[2 * low + 1];
+}
+
+// Errors in the builtin compiler are located by the compiler itself.
+void describe_location(char *buffer, size_t size) {
+    vm_frame_t *frame = current_frame;
+    toy_isolate_t *isolate = current_isolate;
+    *buffer = 0;
+    if (!frame || !isolate || frame->func->file == isolate->builtin_file) {
+        return;
+    }
+    const char *name = frame->func->name ? frame->func->name : "anonymous";
+    unsigned line = func_line(frame->func, frame->ip);
+    if (line) {
+        snprintf(buffer, size, " (line %u, in %s)", line, name);
+    } else {
+        snprintf(buffer, size, " (in %s)", name);
+    }
+}
+
+const char *opcode_to_string(enum opcode opcode) {
+    return opcode < opcode__count ? opcode_names[opcode] : "?";
+}
+
 enum opcode string_to_opcode(const char *s) {
     for (int i = 0; i < opcode__count; i++) {
         if (opcode_names[i] && strcmp(opcode_names[i], s) == 0) {
@@ -318,3 +769,269 @@ enum opcode string_to_opcode(const char *s) {
     }
     return -1;
 }
+
+
+
+
+//////////////////////////////////////////////////// GREEN THREADS
+
+
+
+// `spawn(func)` runs `func` in a green thread. The green threads of an
+// isolate take turns on its OS thread: a green thread runs until it
+// calls `yield()`, or blocks on a channel, or ends. These calls happen
+// between two instructions, so the switches are at safepoints. Each
+// green thread has its own C stack, hence its own chain of `eval_func`
+// frames, swapped with `swapcontext()`.
+//
+// `channel(n)` returns a channel with a buffer of `n` values (1 by
+// default): a dict with `send(value)`, which blocks while the buffer is
+// full, and `recv()`, which blocks while it is empty.
+//
+// The script waits for its green threads at the end. It dies if some of
+// them are still blocked then, since their frames hold references which
+// can't be released without running them.
+
+#define GREEN_STACK_SIZE (1024 * 1024)
+
+typedef struct green_thread green_thread_t;
+
+enum green_state {
+    green_state_runnable,
+    green_state_sending, // Blocked on `channel`
+    green_state_receiving,
+    green_state_done,
+};
+
+struct green_thread {
+    ucontext_t context;
+    void *stack; // Null for the main thread, which uses the OS one
+    vm_frame_t *frame; // Its `current_frame` while it is switched out
+    value_t func;
+    enum green_state state;
+    object_t *channel;
+    green_thread_t *next; // In the run queue, or the blocked list
+};
+
+struct scheduler {
+    green_thread_t main, *current;
+    green_thread_t *first, *last; // The run queue
+    green_thread_t *blocked;
+    green_thread_t *done; // Its stack is freed by the next thread
+};
+
+static void free_green_thread(green_thread_t *t) {
+    munmap(t->stack, GREEN_STACK_SIZE);
+    free(t);
+}
+
+static scheduler_t *get_scheduler(void) {
+    toy_isolate_t *isolate = current_isolate;
+    if (!isolate->scheduler) {
+        scheduler_t *s = xcalloc(1, sizeof(*s));
+        s->main.state = green_state_runnable;
+        s->current = &s->main;
+        isolate->scheduler = s;
+    }
+    return isolate->scheduler;
+}
+
+static void enqueue(scheduler_t *s, green_thread_t *t) {
+    t->next = 0;
+    if (s->last) {
+        s->last->next = t;
+    } else {
+        s->first = t;
+    }
+    s->last = t;
+}
+
+static void free_done_thread(scheduler_t *s) {
+    if (s->done) {
+        free_green_thread(s->done);
+        s->done = 0;
+    }
+}
+
+// Runs the next thread of the queue. Returns when the current thread is
+// resumed, unless it is done.
+static void switch_thread(scheduler_t *s) {
+    green_thread_t *from = s->current, *to = s->first;
+    if (!to) {
+        die("deadlock: every green thread is blocked");
+    }
+    s->first = to->next;
+    if (!s->first) {
+        s->last = 0;
+    }
+    s->current = to;
+    if (from->state == green_state_done) {
+        s->done = from;
+        setcontext(&to->context);
+    }
+    from->frame = current_frame;
+    swapcontext(&from->context, &to->context);
+    current_frame = from->frame;
+    free_done_thread(s);
+}
+
+static void run_green_thread(void) {
+    scheduler_t *s = current_isolate->scheduler;
+    free_done_thread(s);
+    green_thread_t *t = s->current;
+    current_frame = 0;
+    call_func(t->func, v_null);
+    v_dec_ref(t->func);
+    t->state = green_state_done;
+    switch_thread(s);
+}
+
+static void block(scheduler_t *s, object_t *channel, enum green_state state) {
+    green_thread_t *t = s->current;
+    t->state = state;
+    t->channel = channel;
+    t->next = s->blocked;
+    s->blocked = t;
+    switch_thread(s);
+}
+
+// Makes runnable the oldest thread blocked in the given state.
+static void wake(scheduler_t *s, object_t *channel, enum green_state state) {
+    green_thread_t **link = &s->blocked, **found = 0;
+    for (; *link; link = &(*link)->next) {
+        if ((*link)->channel == channel && (*link)->state == state) {
+            found = link;
+        }
+    }
+    if (found) {
+        green_thread_t *t = *found;
+        *found = t->next;
+        t->state = green_state_runnable;
+        t->channel = 0;
+        enqueue(s, t);
+    }
+}
+
+int green_yield(void) {
+    scheduler_t *s = current_isolate->scheduler;
+    if (!s || !s->first) {
+        return 0;
+    }
+    enqueue(s, s->current);
+    switch_thread(s);
+    return 1;
+}
+
+void run_green_threads(void) {
+    scheduler_t *s = current_isolate->scheduler;
+    while (s && s->first) {
+        green_yield();
+    }
+    if (s && s->blocked) {
+        die("deadlock: a green thread is still blocked at the end");
+    }
+    free_scheduler(s);
+    current_isolate->scheduler = 0;
+}
+
+// Drops the remaining threads. After an error, the current thread may
+// be a green one, which `die()` left.
+void free_scheduler(scheduler_t *s) {
+    if (!s) {
+        return;
+    }
+    int current_freed = s->current == &s->main || s->current == s->done;
+    green_thread_t *lists[] = {s->first, s->blocked};
+    for (int i = 0; i < 2; i++) {
+        green_thread_t *t = lists[i];
+        while (t) {
+            green_thread_t *next = t->next;
+            if (t == s->current) {
+                current_freed = 1; // It died blocking, see `switch_thread()`
+            }
+            if (t != &s->main) {
+                free_green_thread(t);
+            }
+            t = next;
+        }
+    }
+    if (!current_freed) {
+        free_green_thread(s->current);
+    }
+    free_done_thread(s);
+    free(s);
+}
+
+value_t v_spawn(value_t ctx, value_t func) {
+    (void)ctx;
+    if (!v_is_func(func)) {
+        die("spawn(): not a function");
+    }
+    scheduler_t *s = get_scheduler();
+    green_thread_t *t = xcalloc(1, sizeof(*t));
+    t->stack = mmap(NULL, GREEN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (t->stack == MAP_FAILED) {
+        die("spawn(): cannot allocate a stack");
+    }
+    mprotect(t->stack, 4096, PROT_NONE); // Guard page
+    getcontext(&t->context);
+    t->context.uc_stack.ss_sp = t->stack;
+    t->context.uc_stack.ss_size = GREEN_STACK_SIZE;
+    t->context.uc_link = 0;
+    makecontext(&t->context, run_green_thread, 0);
+    t->func = func;
+    v_inc_ref(func);
+    t->state = green_state_runnable;
+    enqueue(s, t);
+    return v_null;
+}
+
+value_t v_yield(value_t ctx, value_t unused) {
+    (void)ctx;
+    (void)unused;
+    green_yield();
+    return v_null;
+}
+
+// The context is `[buffer, capacity]`.
+static value_t channel_send(value_t ctx, value_t v) {
+    scheduler_t *s = get_scheduler();
+    value_t buffer = ctx.object->list.items[0];
+    size_t capacity = ctx.object->list.items[1].integer;
+    while (buffer.object->list.length >= capacity) {
+        block(s, ctx.object, green_state_sending);
+    }
+    v_list_push(buffer, v);
+    wake(s, ctx.object, green_state_receiving);
+    return v_null;
+}
+
+static value_t channel_recv(value_t ctx, value_t unused) {
+    (void)unused;
+    scheduler_t *s = get_scheduler();
+    list_t *buffer = &ctx.object->list.items[0].object->list;
+    while (!buffer->length) {
+        block(s, ctx.object, green_state_receiving);
+    }
+    value_t v = buffer->items[0];
+    memmove(buffer->items, buffer->items + 1,
+            sizeof(value_t) * --buffer->length);
+    wake(s, ctx.object, green_state_sending);
+    return v;
+}
+
+value_t v_channel(value_t ctx, value_t vcapacity) {
+    (void)ctx;
+    long capacity = v_is_null(vcapacity) ? 1 : v_to_integer(vcapacity);
+    if (capacity < 1) {
+        die("channel(): the capacity must be positive");
+    }
+    value_t state = v_list();
+    v_list_push(state, v_list());
+    v_list_push(state, v_integer(capacity));
+    value_t channel = v_dict();
+    v_set(channel, v_string("send"), create_method(state, channel_send));
+    v_set(channel, v_string("recv"), create_method(state, channel_recv));
+    return channel;
+}
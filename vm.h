@@ -1,6 +1,7 @@
 #ifndef VM_H
 #define VM_H
 
+#include <stdint.h>
 #include <stdlib.h>
 #include "value.h"
 
@@ -15,24 +16,97 @@ typedef struct compiled_file compiled_file_t;
 
 struct compiled_func {
     char *param_name; // may be null
-    unsigned char *code;
+    unsigned char *code; // null until a lazy function is compiled
+    size_t code_length;
     value_t *consts;
     struct bvalue *bconsts;
     size_t const_count;
     compiled_file_t *file;
+
+    // Nonzero if the code is register-based
+    size_t register_count;
+
+    // Compiled ahead of time, see `make aot`. Runs instead of the code.
+    value_t (*aot)(value_t scope);
+
+    // See `jit.c`
+    struct jit_code *jit;
+    unsigned hotness;
+
+    // Location of a lazy function in the source of the file
+    size_t source_begin, source_end, source_line;
+
+    // Debug information: the name of the function, and its line table.
+    // That's `line_count` pairs of a code offset and the source line of
+    // the code from that offset, sorted by offset. See `func_line()`.
+    char *name;
+    uint32_t *lines;
+    size_t line_count;
+
+    // Set by `verify_func()`. The verified functions are interpreted
+    // without the checks of each instruction.
+    int verified;
+    size_t max_stack_depth;
 };
 
+// Checks the stack-based code of the function, see `verify.c`. Returns
+// nonzero and sets `verified` if it is valid. Must be called again after
+// the code changes.
+int verify_func(compiled_func_t *func);
+
+// Returns the source line of the instruction at `ip`, or 0 if unknown.
+unsigned func_line(const compiled_func_t *func, size_t ip);
+
+// The functions being evaluated by `eval_func()` on the current thread
+// form a chain of frames, innermost first. `ip` is the offset of the
+// instruction being executed by the interpreter loops.
+typedef struct vm_frame vm_frame_t;
+
+struct vm_frame {
+    const compiled_func_t *func;
+    size_t ip;
+    vm_frame_t *parent;
+};
+
+extern __thread vm_frame_t *current_frame;
+
+// Writes where the innermost frame is, like ` (line 3)`, or an empty
+// string if that's unknown. For the errors of `die()`.
+void describe_location(char *buffer, size_t size);
+
+// Maximum stack size of a running function
+#define STACK_CAPACITY 20
+
 struct compiled_file {
-    compiled_func_t *funcs;
+    compiled_func_t **funcs;
     size_t func_count;
+
+    // Used to compile the lazy functions. Null if there is none.
+    value_t source;
+    value_t compiler; // The function exported by `compile.js`
 };
 
 value_t call_func(value_t func, value_t arg);
 
+// Variable access, following the `<parent>` chain of the scopes
+value_t scope_get(value_t scope, const char *name);
+void scope_set(value_t scope, const char *name, value_t v);
+void scope_decl(value_t scope, const char *name);
+
 // The optional `<parent>` property of the scope must be set
 value_t eval_func(value_t func, value_t scope);
 
 // Returns -1 on error
 enum opcode string_to_opcode(const char *s);
+const char *opcode_to_string(enum opcode opcode);
+
+// Green threads, see the end of `vm.c`
+typedef struct scheduler scheduler_t;
+value_t v_spawn(value_t ctx, value_t func);
+value_t v_yield(value_t ctx, value_t unused);
+value_t v_channel(value_t ctx, value_t capacity);
+int green_yield(void); // Returns zero if no other thread could run
+void run_green_threads(void); // Until they are all done or blocked
+void free_scheduler(scheduler_t *s);
 
 #endif /* VM_H */